@@ -70,6 +70,9 @@ static vfs_fs_fns myfatfs_fs_fns = {
   .mkdir    = myfatfs_mkdir,
   .fsinfo   = myfatfs_fsinfo,
   .fscfg    = NULL,
+  .gc       = NULL,
+  .cache    = NULL,
+  .maxopen  = NULL,
   .format   = NULL,
   .chdrive  = myfatfs_chdrive,
   .chdir    = myfatfs_chdir,
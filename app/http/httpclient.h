@@ -46,6 +46,11 @@ static const char log_prefix[] = "HTTP client: ";
  */
 #define HTTP_REQUEST_TIMEOUT_MS    (10000)
 
+/*
+ * Time a keep-alive connection is kept open waiting for the next request.
+ */
+#define HTTP_KEEPALIVE_TIMEOUT_MS  (10000)
+
 /*
  * "full_response" is a string containing all response headers and the response body.
  * "response_body and "http_status" are extracted from "full_response" for convenience.
@@ -55,46 +60,59 @@ static const char log_prefix[] = "HTTP client: ";
  */
 typedef void (* http_callback_t)(char * response_body, int http_status, char * full_response);
 
+/*
+ * Optional streaming mode: if a data callback is given, the response body is
+ * passed to it piece by piece as it is received instead of being accumulated,
+ * so the size of the body is not limited by BUFFER_SIZE_MAX. Only the headers
+ * are buffered, and the final http_callback_t gets an empty "response_body".
+ * Chunked bodies are passed on decoded. The bodies of redirections are not passed on.
+ */
+typedef void (* http_data_callback_t)(char * data, int len);
+
 /*
  * Call this function to skip URL parsing if the arguments are already in separate variables.
  */
-void ICACHE_FLASH_ATTR http_raw_request(const char * hostname, int port, bool secure, const char * method, const char * path, const char * headers, const char * post_data, http_callback_t callback_handle, int redirect_follow_count);
+void ICACHE_FLASH_ATTR http_raw_request(const char * hostname, int port, bool secure, const char * method, const char * path, const char * headers, const char * post_data, http_callback_t callback_handle, http_data_callback_t data_handle, int redirect_follow_count);
 
 /*
  * Request data from URL use custom method.
  * The data should be encoded as any format.
+ * Responses are parsed as they arrive and complete on their Content-Length or last
+ * chunk. If the headers contain "Connection: keep-alive" the connection is kept open
+ * for HTTP_KEEPALIVE_TIMEOUT_MS and reused by the next request to the same server;
+ * if the server closes it before answering, the request is sent once more on a new one.
  * Try:
- * http_request("http://httpbin.org/post", "OPTIONS", "Content-type: text/plain", "Hello world", http_callback_example, 0);
+ * http_request("http://httpbin.org/post", "OPTIONS", "Content-type: text/plain", "Hello world", http_callback_example, NULL, 0);
  */
-void ICACHE_FLASH_ATTR http_request(const char * url, const char * method, const char * headers, const char * post_data, http_callback_t callback_handle, int redirect_follow_count);
+void ICACHE_FLASH_ATTR http_request(const char * url, const char * method, const char * headers, const char * post_data, http_callback_t callback_handle, http_data_callback_t data_handle, int redirect_follow_count);
 
 /*
  * Post data to a web form.
  * The data should be encoded as any format.
  * Try:
- * http_post("http://httpbin.org/post", "Content-type: application/json", "{\"hello\": \"world\"}", http_callback_example);
+ * http_post("http://httpbin.org/post", "Content-type: application/json", "{\"hello\": \"world\"}", http_callback_example, NULL);
  */
-void ICACHE_FLASH_ATTR http_post(const char * url, const char * headers, const char * post_data, http_callback_t callback_handle);
+void ICACHE_FLASH_ATTR http_post(const char * url, const char * headers, const char * post_data, http_callback_t callback_handle, http_data_callback_t data_handle);
 
 /*
  * Download a web page from its URL.
  * Try:
- * http_get("http://wtfismyip.com/text", NULL, http_callback_example);
+ * http_get("http://wtfismyip.com/text", NULL, http_callback_example, NULL);
  */
-void ICACHE_FLASH_ATTR http_get(const char * url, const char * headers, http_callback_t callback_handle);
+void ICACHE_FLASH_ATTR http_get(const char * url, const char * headers, http_callback_t callback_handle, http_data_callback_t data_handle);
 /*
  * Delete a web page from its URL.
  * Try:
- * http_delete("http://wtfismyip.com/text", NULL, http_callback_example);
+ * http_delete("http://wtfismyip.com/text", NULL, NULL, http_callback_example, NULL);
  */
-void ICACHE_FLASH_ATTR http_delete(const char * url, const char * headers, const char * post_data, http_callback_t callback_handle);
+void ICACHE_FLASH_ATTR http_delete(const char * url, const char * headers, const char * post_data, http_callback_t callback_handle, http_data_callback_t data_handle);
 /*
  * Update data to a web form.
  * The data should be encoded as any format.
  * Try:
- * http_put("http://httpbin.org/post", "Content-type: application/json", "{\"hello\": \"world\"}", http_callback_example);
+ * http_put("http://httpbin.org/post", "Content-type: application/json", "{\"hello\": \"world\"}", http_callback_example, NULL);
  */
-void ICACHE_FLASH_ATTR http_put(const char * url, const char * headers, const char * post_data, http_callback_t callback_handle);
+void ICACHE_FLASH_ATTR http_put(const char * url, const char * headers, const char * post_data, http_callback_t callback_handle, http_data_callback_t data_handle);
 
 /*
  * Output on the UART.
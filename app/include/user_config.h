@@ -76,9 +76,31 @@ extern void luaL_assertfail(const char *file, int line, const char *message);
 // maximum length of a filename
 #define FS_OBJ_NAME_LEN 31
 
-// maximum number of open files for SPIFFS
+// maximum number of open files for SPIFFS after boot, up to 32 (68
+// bytes of RAM each). Can be changed with file.maxopen().
 #define SPIFFS_MAX_OPEN_FILES 4
 
+// Number of 256 byte pages (276 bytes of RAM each) in the SPIFFS read
+// and write cache, up to 32. Small writes to a file are collected in up to
+// half of them, at most 4 adjacent pages, and written to flash together.
+// Can be changed with file.cache().
+#define SPIFFS_CACHE_PAGES 2
+
+// Bytes of the buffer each open file gets when it is read or written a line or
+// a few bytes at a time. It reads ahead, or collects writes until it is full
+// or the file is flushed. 0 turns buffering off.
+// #define VFS_FILE_BUFFER 256
+
+// Keep an index of file names in RAM with this many entries (6 bytes each),
+// so that opening or checking for a file does not scan the whole file system.
+// It holds up to 7/8 of that many files; lookups of any others still scan.
+// #define SPIFFS_NAME_INDEX_ENTRIES 128
+
+// Collect garbage in a background task, a block at a time while the system
+// is idle, to keep this many blocks free so that writes seldom stall for it.
+// Can be changed with file.gc().
+// #define SPIFFS_GC_FREE_BLOCKS 6
+
 // Uncomment this next line for fastest startup 
 // It reduces the format time dramatically
 // #define SPIFFS_MAX_FILESYSTEM_SIZE	32768
@@ -92,6 +114,26 @@ extern void luaL_assertfail(const char *file, int line, const char *message);
 
 // #define LUA_NUMBER_INTEGRAL
 
+// Float builds hold numbers which are whole and fit in 32 bits as integers,
+// so loop counters, array indexes and integer arithmetic avoid the soft float
+// library. Only numbers which need it are doubles.
+#define LUA_NUMBER_DUAL
+
+// Lua objects of up to 64 bytes (short strings, table nodes, closures and
+// upvalues) come from 512 byte pages of equal sized slots rather than from
+// the SDK heap, which keeps them from fragmenting it. See node.egc.slabinfo().
+#define LUA_SLAB_ALLOC
+
+// Adds node.memprofile(), which counts Lua heap allocations by size and by
+// the Lua source line which made them. Costs a test per allocation while
+// it is not running.
+// #define LUA_MEMPROFILE
+
+// Reserve this many bytes (a multiple of 4K) of the firmware image for the Lua
+// flash store: modules built with luac.cross -f and loaded by node.flashreload()
+// run in place, so require() only spends RAM on their closures and data
+// #define LUA_FLASH_STORE 0x10000
+
 #define READLINE_INTERVAL 80
 #define LUA_TASK_PRIO USER_TASK_PRIO_0
 #define LUA_PROCESS_LINE_SIG 2
@@ -16,6 +16,7 @@
 #define c_memcmp os_memcmp
 #define c_memcpy os_memcpy
 #define c_memset os_memset
+#define c_memmove os_memmove
 
 #define c_strcat os_strcat
 #define c_strchr os_strchr
@@ -33,6 +34,7 @@
 #define c_strpbrk strpbrk
 #define c_strcoll strcoll
 #define c_strrchr strrchr
+#define c_memchr memchr
 
 // const char *c_strstr(const char * __s1, const char * __s2);
 // char *c_strncat(char * __restrict /*s1*/, const char * __restrict /*s2*/, size_t n);
@@ -0,0 +1,517 @@
+/*
+ * Host implementation of the "FLASH" vfs realm.
+ *
+ * Files live in a directory on the local filesystem (the current directory
+ * unless hostfs_set_root() says otherwise), so vfs.c, the file module and
+ * luaL_loadfsfile run unmodified. Like SPIFFS the namespace is flat: a name
+ * is used as-is below the root directory.
+ *
+ * vfs.c passes descriptors around as int, so they are handed out from a
+ * static pool; the host binary is linked -no-pie to keep that pool below
+ * 2 GiB.
+ */
+
+#include "c_stdlib.h"
+#include "c_stdio.h"
+#include "c_string.h"
+#include "user_config.h"
+#include "vfs_int.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+
+#define MY_LDRV_ID "FLASH"
+#define HOSTFS_MAX_FILES  32
+#define HOSTFS_MAX_ITEMS  16
+#define HOSTFS_MAX_DIRS   4
+
+static const char *root = ".";
+// open files are limited like on SPIFFS, so that scripts run out of them alike
+static int max_open = SPIFFS_MAX_OPEN_FILES, open_count;
+static int is_current_drive = TRUE;
+static int last_errno;
+// reads and writes reaching the file system, which stand in for flash ones
+static uint32_t read_calls, read_bytes;
+static uint32_t write_calls, write_bytes;
+
+void hostfs_set_root( const char *dir ) {
+  root = dir;
+}
+
+void hostfs_get_reads( uint32_t *calls, uint32_t *bytes ) {
+  *calls = read_calls;
+  *bytes = read_bytes;
+}
+
+void hostfs_get_writes( uint32_t *calls, uint32_t *bytes ) {
+  *calls = write_calls;
+  *bytes = write_bytes;
+}
+
+static void host_path( char *buf, size_t size, const char *name ) {
+  snprintf( buf, size, "%s/%s", root, name );
+}
+
+// forward declarations
+static sint32_t myhost_vfs_close( const struct vfs_file *fd );
+static sint32_t myhost_vfs_read( const struct vfs_file *fd, void *ptr, size_t len );
+static sint32_t myhost_vfs_write( const struct vfs_file *fd, const void *ptr, size_t len );
+static sint32_t myhost_vfs_lseek( const struct vfs_file *fd, sint32_t off, int whence );
+static sint32_t myhost_vfs_eof( const struct vfs_file *fd );
+static sint32_t myhost_vfs_tell( const struct vfs_file *fd );
+static sint32_t myhost_vfs_flush( const struct vfs_file *fd );
+static uint32_t myhost_vfs_size( const struct vfs_file *fd );
+static sint32_t myhost_vfs_ferrno( const struct vfs_file *fd );
+
+static sint32_t  myhost_vfs_closedir( const struct vfs_dir *dd );
+static vfs_item *myhost_vfs_readdir( const struct vfs_dir *dd );
+
+static void       myhost_vfs_iclose( const struct vfs_item *di );
+static uint32_t   myhost_vfs_isize( const struct vfs_item *di );
+static const char *myhost_vfs_name( const struct vfs_item *di );
+
+static vfs_vol  *myhost_vfs_mount( const char *name, int num );
+static vfs_file *myhost_vfs_open( const char *name, const char *mode );
+static vfs_dir  *myhost_vfs_opendir( const char *name );
+static vfs_item *myhost_vfs_stat( const char *name );
+static sint32_t  myhost_vfs_remove( const char *name );
+static sint32_t  myhost_vfs_rename( const char *oldname, const char *newname );
+static sint32_t  myhost_vfs_fsinfo( uint32_t *total, uint32_t *used );
+static sint32_t  myhost_vfs_fscfg( uint32_t *phys_addr, uint32_t *phys_size );
+static sint32_t  myhost_vfs_gc( sint32_t free_blocks, sint32_t max_steps, vfs_gc_stats *stats );
+static sint32_t  myhost_vfs_cache( sint32_t pages, vfs_cache_stats *stats );
+static sint32_t  myhost_vfs_maxopen( sint32_t files );
+static sint32_t  myhost_vfs_format( void );
+static sint32_t  myhost_vfs_errno( void );
+static void      myhost_vfs_clearerr( void );
+
+// ---------------------------------------------------------------------------
+// function tables
+//
+static vfs_fs_fns myhost_fs_fns = {
+  .mount    = myhost_vfs_mount,
+  .open     = myhost_vfs_open,
+  .opendir  = myhost_vfs_opendir,
+  .stat     = myhost_vfs_stat,
+  .remove   = myhost_vfs_remove,
+  .rename   = myhost_vfs_rename,
+  .mkdir    = NULL,
+  .fsinfo   = myhost_vfs_fsinfo,
+  .fscfg    = myhost_vfs_fscfg,
+  .gc       = myhost_vfs_gc,
+  .cache    = myhost_vfs_cache,
+  .maxopen  = myhost_vfs_maxopen,
+  .format   = myhost_vfs_format,
+  .chdrive  = NULL,
+  .chdir    = NULL,
+  .ferrno   = myhost_vfs_errno,
+  .clearerr = myhost_vfs_clearerr
+};
+
+static vfs_file_fns myhost_file_fns = {
+  .close     = myhost_vfs_close,
+  .read      = myhost_vfs_read,
+  .write     = myhost_vfs_write,
+  .lseek     = myhost_vfs_lseek,
+  .eof       = myhost_vfs_eof,
+  .tell      = myhost_vfs_tell,
+  .flush     = myhost_vfs_flush,
+  .size      = myhost_vfs_size,
+  .ferrno    = myhost_vfs_ferrno
+};
+
+static vfs_item_fns myhost_item_fns = {
+  .close     = myhost_vfs_iclose,
+  .size      = myhost_vfs_isize,
+  .time      = NULL,
+  .name      = myhost_vfs_name,
+  .is_dir    = NULL,
+  .is_rdonly = NULL,
+  .is_hidden = NULL,
+  .is_sys    = NULL,
+  .is_arch   = NULL
+};
+
+static vfs_dir_fns myhost_dd_fns = {
+  .close     = myhost_vfs_closedir,
+  .readdir   = myhost_vfs_readdir
+};
+
+
+// ---------------------------------------------------------------------------
+// descriptor pools
+//
+struct myvfs_file {
+  struct vfs_file vfs_file;
+  FILE *fh;
+};
+
+struct myvfs_dir {
+  struct vfs_dir vfs_dir;
+  DIR *d;
+};
+
+struct myvfs_stat {
+  struct vfs_item vfs_item;
+  uint32_t size;
+  char name[FS_OBJ_NAME_LEN + 1];
+};
+
+static struct myvfs_file files[HOSTFS_MAX_FILES];
+static struct myvfs_dir  dirs[HOSTFS_MAX_DIRS];
+static struct myvfs_stat items[HOSTFS_MAX_ITEMS];
+
+#define POOL_GET(pool, field) ({ \
+    __typeof__(&pool[0]) p = NULL; \
+    for (int i = 0; i < sizeof(pool) / sizeof(pool[0]); i++) \
+      if (pool[i].field.fns == NULL) { p = &pool[i]; break; } \
+    p; })
+
+#define POOL_PUT(descr) \
+  (((struct vfs_file *)(descr))->fns = NULL)
+
+
+// ---------------------------------------------------------------------------
+// stat functions
+//
+#define GET_STAT_S(descr) \
+  const struct myvfs_stat *s = (const struct myvfs_stat *)descr;
+
+static void myhost_vfs_iclose( const struct vfs_item *di ) {
+  POOL_PUT( di );
+}
+
+static uint32_t myhost_vfs_isize( const struct vfs_item *di ) {
+  GET_STAT_S(di);
+
+  return s->size;
+}
+
+static const char *myhost_vfs_name( const struct vfs_item *di ) {
+  GET_STAT_S(di);
+
+  return s->name;
+}
+
+
+// ---------------------------------------------------------------------------
+// dir functions
+//
+#define GET_DIR_D(descr) \
+  const struct myvfs_dir *mydd = (const struct myvfs_dir *)descr; \
+  DIR *d = mydd->d;
+
+static sint32_t myhost_vfs_closedir( const struct vfs_dir *dd ) {
+  GET_DIR_D(dd);
+
+  closedir( d );
+  POOL_PUT( dd );
+  return VFS_RES_OK;
+}
+
+static vfs_item *myhost_vfs_readdir( const struct vfs_dir *dd ) {
+  GET_DIR_D(dd);
+  struct dirent *de;
+  struct stat st;
+  char path[PATH_MAX];
+
+  while ((de = readdir( d ))) {
+    host_path( path, sizeof( path ), de->d_name );
+    if (stat( path, &st ) != 0 || !S_ISREG(st.st_mode) ||
+        c_strlen( de->d_name ) > FS_OBJ_NAME_LEN)
+      continue;
+
+    struct myvfs_stat *s = POOL_GET(items, vfs_item);
+    if (!s)
+      return NULL;
+    s->vfs_item.fs_type = VFS_FS_SPIFFS;
+    s->vfs_item.fns     = &myhost_item_fns;
+    s->size = st.st_size;
+    c_strcpy( s->name, de->d_name );
+    return (vfs_item *)s;
+  }
+
+  return NULL;
+}
+
+
+// ---------------------------------------------------------------------------
+// file functions
+//
+#define GET_FILE_FH(descr) \
+  const struct myvfs_file *myfd = (const struct myvfs_file *)descr; \
+  FILE *fh = myfd->fh;
+
+static sint32_t myhost_vfs_close( const struct vfs_file *fd ) {
+  GET_FILE_FH(fd);
+
+  sint32_t res = fclose( fh ) == 0 ? VFS_RES_OK : VFS_RES_ERR;
+  POOL_PUT( fd );
+  open_count--;
+  return res;
+}
+
+static sint32_t myhost_vfs_read( const struct vfs_file *fd, void *ptr, size_t len ) {
+  GET_FILE_FH(fd);
+
+  size_t n = fread( ptr, 1, len, fh );
+  read_calls++;
+  read_bytes += n;
+  if (n == 0 && ferror( fh )) {
+    last_errno = errno;
+    return VFS_RES_ERR;
+  }
+  return n;
+}
+
+static sint32_t myhost_vfs_write( const struct vfs_file *fd, const void *ptr, size_t len ) {
+  GET_FILE_FH(fd);
+
+  size_t n = fwrite( ptr, 1, len, fh );
+  write_calls++;
+  write_bytes += n;
+  if (n < len && ferror( fh )) {
+    last_errno = errno;
+    return VFS_RES_ERR;
+  }
+  return n;
+}
+
+static sint32_t myhost_vfs_lseek( const struct vfs_file *fd, sint32_t off, int whence ) {
+  GET_FILE_FH(fd);
+  int host_whence;
+
+  switch (whence) {
+  default:
+  case VFS_SEEK_SET:
+    host_whence = SEEK_SET;
+    break;
+  case VFS_SEEK_CUR:
+    host_whence = SEEK_CUR;
+    break;
+  case VFS_SEEK_END:
+    host_whence = SEEK_END;
+    break;
+  }
+
+  if (fseek( fh, off, host_whence ) != 0) {
+    last_errno = errno;
+    return VFS_RES_ERR;
+  }
+  return ftell( fh );
+}
+
+static sint32_t myhost_vfs_eof( const struct vfs_file *fd ) {
+  GET_FILE_FH(fd);
+
+  // SPIFFS reports eof as soon as the position reaches the end, not only
+  // after a read has failed
+  int c = getc( fh );
+  if (c == EOF)
+    return 1;
+  ungetc( c, fh );
+  return 0;
+}
+
+static sint32_t myhost_vfs_tell( const struct vfs_file *fd ) {
+  GET_FILE_FH(fd);
+
+  return ftell( fh );
+}
+
+static sint32_t myhost_vfs_flush( const struct vfs_file *fd ) {
+  GET_FILE_FH(fd);
+
+  return fflush( fh ) == 0 ? VFS_RES_OK : VFS_RES_ERR;
+}
+
+static uint32_t myhost_vfs_size( const struct vfs_file *fd ) {
+  GET_FILE_FH(fd);
+  struct stat st;
+
+  fflush( fh );
+  return fstat( fileno( fh ), &st ) == 0 ? st.st_size : 0;
+}
+
+static sint32_t myhost_vfs_ferrno( const struct vfs_file *fd ) {
+  return last_errno;
+}
+
+
+// ---------------------------------------------------------------------------
+// filesystem functions
+//
+static vfs_file *myhost_vfs_open( const char *name, const char *mode ) {
+  struct myvfs_file *fd;
+  char path[PATH_MAX];
+
+  // the firmware accepts the same mode strings as fopen, minus "b"
+  host_path( path, sizeof( path ), name );
+  if (open_count < max_open && (fd = POOL_GET(files, vfs_file))) {
+    if ((fd->fh = fopen( path, mode ))) {
+      fd->vfs_file.fs_type = VFS_FS_SPIFFS;
+      fd->vfs_file.fns     = &myhost_file_fns;
+      open_count++;
+      return (vfs_file *)fd;
+    }
+    last_errno = errno;
+  }
+
+  return NULL;
+}
+
+static vfs_dir *myhost_vfs_opendir( const char *name ){
+  struct myvfs_dir *dd;
+
+  if ((dd = POOL_GET(dirs, vfs_dir))) {
+    if ((dd->d = opendir( root ))) {
+      dd->vfs_dir.fs_type = VFS_FS_SPIFFS;
+      dd->vfs_dir.fns     = &myhost_dd_fns;
+      return (vfs_dir *)dd;
+    }
+    last_errno = errno;
+  }
+
+  return NULL;
+}
+
+static vfs_item *myhost_vfs_stat( const char *name ) {
+  struct myvfs_stat *s;
+  struct stat st;
+  char path[PATH_MAX];
+
+  host_path( path, sizeof( path ), name );
+  if (c_strlen( name ) > FS_OBJ_NAME_LEN || stat( path, &st ) != 0 || !S_ISREG(st.st_mode))
+    return NULL;
+
+  if ((s = POOL_GET(items, vfs_item))) {
+    s->vfs_item.fs_type = VFS_FS_SPIFFS;
+    s->vfs_item.fns     = &myhost_item_fns;
+    s->size = st.st_size;
+    c_strcpy( s->name, name );
+    return (vfs_item *)s;
+  }
+
+  return NULL;
+}
+
+static sint32_t myhost_vfs_remove( const char *name ) {
+  char path[PATH_MAX];
+
+  host_path( path, sizeof( path ), name );
+  if (remove( path ) != 0) {
+    last_errno = errno;
+    return VFS_RES_ERR;
+  }
+  return VFS_RES_OK;
+}
+
+static sint32_t myhost_vfs_rename( const char *oldname, const char *newname ) {
+  char oldpath[PATH_MAX], newpath[PATH_MAX];
+
+  host_path( oldpath, sizeof( oldpath ), oldname );
+  host_path( newpath, sizeof( newpath ), newname );
+  if (rename( oldpath, newpath ) != 0) {
+    last_errno = errno;
+    return VFS_RES_ERR;
+  }
+  return VFS_RES_OK;
+}
+
+static sint32_t myhost_vfs_fsinfo( uint32_t *total, uint32_t *used ) {
+  struct statvfs sv;
+
+  if (statvfs( root, &sv ) != 0)
+    return VFS_RES_ERR;
+
+  // the file module rejects sizes beyond 2 GiB, which any host disk exceeds
+  uint64_t t = (uint64_t)sv.f_blocks * sv.f_frsize;
+  uint64_t f = (uint64_t)sv.f_bavail * sv.f_frsize;
+  *total = t > INT32_MAX ? INT32_MAX : t;
+  *used  = *total - (f > *total ? *total : f);
+  return VFS_RES_OK;
+}
+
+static sint32_t myhost_vfs_fscfg( uint32_t *phys_addr, uint32_t *phys_size ) {
+  *phys_addr = 0;
+  *phys_size = 0;
+  return VFS_RES_OK;
+}
+
+static sint32_t myhost_vfs_gc( sint32_t free_blocks, sint32_t max_steps, vfs_gc_stats *stats ) {
+  // the host file system collects its own garbage
+  if (stats)
+    c_memset( stats, 0, sizeof( *stats ) );
+  return VFS_RES_OK;
+}
+
+static sint32_t myhost_vfs_cache( sint32_t pages, vfs_cache_stats *stats ) {
+  // the host operating system does the caching
+  if (stats)
+    c_memset( stats, 0, sizeof( *stats ) );
+  return VFS_RES_OK;
+}
+
+static sint32_t myhost_vfs_maxopen( sint32_t files ) {
+  if (files > HOSTFS_MAX_FILES)
+    files = HOSTFS_MAX_FILES;
+  if (files > 0 && files != max_open) {
+    if (open_count > 0)
+      return VFS_RES_ERR;
+    max_open = files;
+  }
+  return max_open;
+}
+
+static vfs_vol *myhost_vfs_mount( const char *name, int num ) {
+  return (vfs_vol *)1;
+}
+
+static sint32_t myhost_vfs_format( void ) {
+  // never wipe a host directory on behalf of a script
+  return VFS_RES_ERR;
+}
+
+static sint32_t myhost_vfs_errno( void ) {
+  return last_errno;
+}
+
+static void myhost_vfs_clearerr( void ) {
+  last_errno = 0;
+}
+
+
+// ---------------------------------------------------------------------------
+// VFS interface functions
+//
+vfs_fs_fns *myspiffs_realm( const char *inname, char **outname, int set_current_drive ) {
+  if (inname[0] == '/') {
+    size_t idstr_len = c_strlen( MY_LDRV_ID );
+    // logical drive is specified, check if it's our id
+    if (0 == c_strncmp( &(inname[1]), MY_LDRV_ID, idstr_len )) {
+      *outname = (char *)&(inname[1 + idstr_len]);
+      if (*outname[0] == '/') {
+        // skip leading /
+        (*outname)++;
+      }
+
+      if (set_current_drive) is_current_drive = TRUE;
+      return &myhost_fs_fns;
+    }
+  } else {
+    // no logical drive in patchspec, are we current drive?
+    if (is_current_drive) {
+      *outname = (char *)inname;
+      return &myhost_fs_fns;
+    }
+  }
+
+  if (set_current_drive) is_current_drive = FALSE;
+  return NULL;
+}
+
+vfs_fs_fns *myfatfs_realm( const char *inname, char **outname, int set_current_drive ) {
+  return NULL;
+}
@@ -0,0 +1,6 @@
+#ifndef __c_stdint_h
+#define __c_stdint_h
+
+#include "c_types.h"
+
+#endif
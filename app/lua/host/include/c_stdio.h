@@ -0,0 +1,21 @@
+/*
+ * Host c_stdio.h: console output goes to stdout.
+ */
+#ifndef _C_STDIO_H_
+#define _C_STDIO_H_
+
+#include <stdio.h>
+#include "osapi.h"
+
+#define c_stdin  stdin
+#define c_stdout stdout
+#define c_stderr stderr
+
+#define c_puts(s) fputs((s), stdout)
+#define c_printf  printf
+#define c_sprintf sprintf
+#define c_vsprintf vsprintf
+
+#define dbg_printf printf
+
+#endif /* _C_STDIO_H_ */
@@ -0,0 +1,22 @@
+/*
+ * Host c_stdlib.h: the firmware heap functions map onto the C library.
+ */
+#ifndef _C_STDLIB_H_
+#define _C_STDLIB_H_
+
+#include <stdlib.h>
+
+#define c_free     free
+#define c_malloc   malloc
+#define c_zalloc(s) calloc(1, (s))
+#define c_realloc  realloc
+
+#define c_abs      abs
+#define c_atoi     atoi
+#define c_strtol   strtol
+#define c_strtoul  strtoul
+#define c_strtod   strtod
+#define c_getenv   getenv
+#define c_exit     exit
+
+#endif /* _C_STDLIB_H_ */
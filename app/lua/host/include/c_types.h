@@ -0,0 +1,47 @@
+/*
+ * Host replacement for the SDK c_types.h, used by the host build of the
+ * Lua VM in app/lua/host.
+ */
+#ifndef _HOST_C_TYPES_H_
+#define _HOST_C_TYPES_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef uint8_t  uint8;
+typedef int8_t   sint8;
+typedef uint16_t uint16;
+typedef int16_t  sint16;
+typedef uint32_t uint32;
+typedef int32_t  sint32;
+typedef uint64_t uint64;
+typedef int64_t  sint64;
+typedef uint8_t  u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef float    real32;
+typedef double   real64;
+
+// lwIP names, which the SDK headers pull in on the chip
+typedef uint8_t  u8_t;
+typedef uint16_t u16_t;
+typedef uint32_t u32_t;
+
+typedef int8_t  sint8_t;
+typedef int16_t sint16_t;
+typedef int32_t sint32_t;
+typedef int64_t sint64_t;
+
+typedef unsigned char BOOL;
+#define TRUE  true
+#define FALSE false
+
+#define LOCAL static
+#define __packed __attribute__((packed))
+
+#define ICACHE_FLASH_ATTR
+#define ICACHE_RODATA_ATTR
+#define STORE_ATTR __attribute__((aligned(4)))
+
+#endif
@@ -0,0 +1,20 @@
+/*
+ * Host flash_api.h: "flash" is ordinary memory, so aligned reads are plain
+ * array accesses.
+ */
+#ifndef __HOST_FLASH_API_H__
+#define __HOST_FLASH_API_H__
+
+#include "c_types.h"
+
+static inline uint8_t byte_of_aligned_array(const uint8_t *aligned_array, uint32_t index)
+{
+  return aligned_array[index];
+}
+
+static inline uint16_t word_of_aligned_array(const uint16_t *aligned_array, uint32_t index)
+{
+  return aligned_array[index];
+}
+
+#endif
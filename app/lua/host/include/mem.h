@@ -0,0 +1,11 @@
+#ifndef _HOST_MEM_H_
+#define _HOST_MEM_H_
+
+#include <stdlib.h>
+
+#define os_malloc(s)     malloc(s)
+#define os_zalloc(s)     calloc(1, (s))
+#define os_realloc(p, s) realloc((p), (s))
+#define os_free(p)       free(p)
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef _HOST_OSAPI_H_
+#define _HOST_OSAPI_H_
+
+#include <stdio.h>
+#include <string.h>
+#include "c_types.h"
+#include "user_config.h"
+
+/* user_config.h leaves NODE_DBG empty, turning its arguments into comma expressions */
+#undef NODE_DBG
+#define NODE_DBG(...) do {} while (0)
+
+#define os_printf  printf
+#define os_sprintf sprintf
+#define os_memcmp  memcmp
+#define os_memcpy  memcpy
+#define os_memset  memset
+#define os_strlen  strlen
+
+#endif
@@ -0,0 +1,32 @@
+/*
+ * Host platform.h: the subset of app/platform/platform.h that the host
+ * build of the Lua VM links against, implemented in host/platform.c.
+ */
+#ifndef __HOST_PLATFORM_H__
+#define __HOST_PLATFORM_H__
+
+#include "c_types.h"
+
+#define INTERNAL_FLASH_SECTOR_SIZE      4096
+
+// Error / status codes
+enum
+{
+  PLATFORM_ERR,
+  PLATFORM_OK,
+  PLATFORM_UNDERFLOW = -1
+};
+
+int platform_init( void );
+
+// *****************************************************************************
+// Internal flash erase/write functions
+
+uint32_t platform_flash_get_sector_of_address( uint32_t addr );
+uint32_t platform_flash_write( const void *from, uint32_t toaddr, uint32_t size );
+uint32_t platform_flash_read( void *to, uint32_t fromaddr, uint32_t size );
+uint32_t platform_flash_get_num_sectors(void);
+int platform_flash_erase_sector( uint32_t sector_id );
+uint32_t platform_flash_mapped2phys (uint32_t mapped_addr);
+
+#endif
@@ -0,0 +1,320 @@
+/*
+** Host driver for the firmware build of the Lua VM.
+**
+** Runs scripts against app/lua exactly as it is compiled for the ESP8266
+** (rotables, EGC, light functions, packed line info) with files served by
+** the host vfs realm, and adds a "bench" module that counts VM instructions
+** and heap traffic per call. The Lua flash store starts out empty on every
+** run; -f loads an image or compiled Lua files into it before the state is
+** created.
+**
+** See Copyright Notice in lua.h
+*/
+
+#include "c_stdio.h"
+#include "c_stdlib.h"
+#include "c_string.h"
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+#include "legc.h"
+#include "lflash.h"
+#include "lmem.h"
+#include "module.h"
+
+#include <time.h>
+
+extern void hostfs_set_root( const char *dir );
+extern void hostfs_get_reads( uint32_t *calls, uint32_t *bytes );
+extern void hostfs_get_writes( uint32_t *calls, uint32_t *bytes );
+
+static const char *progname = "lua.host";
+
+
+/* heap accounting: wraps the firmware's l_alloc, so EGC behaves as on the chip */
+
+typedef struct HostHeap {
+  lua_Alloc alloc;
+  void *ud;
+  size_t inuse;
+  size_t peak;
+  unsigned long long bytes;   /* bytes requested by allocations and growing reallocs */
+  unsigned long long allocs;  /* number of such requests */
+  size_t blocks;              /* blocks in use */
+} HostHeap;
+
+static HostHeap heap;
+static unsigned long long instructions;
+
+static void *host_alloc (void *ud, void *ptr, size_t osize, size_t nsize) {
+  HostHeap *h = (HostHeap *)ud;
+  void *nptr = h->alloc(h->ud, ptr, osize, nsize);
+  if (ptr == NULL)
+    osize = 0;
+  if (nsize == 0) {
+    h->inuse -= osize;
+    h->blocks -= ptr != NULL;
+  } else if (nptr != NULL) {
+    h->blocks += ptr == NULL;
+    if (nsize > osize) {
+      h->bytes += nsize - osize;
+      h->allocs++;
+    }
+    h->inuse += nsize - osize;
+    if (h->inuse > h->peak)
+      h->peak = h->inuse;
+  }
+  return nptr;
+}
+
+static void count_hook (lua_State *L, lua_Debug *ar) {
+  instructions++;
+}
+
+static double cpu_ms (void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+
+/* bench module */
+
+/* Calls the function on top of the stack with nargs arguments below it,
+** discarding results and rethrowing errors after the hook is cleared. */
+static void bench_call (lua_State *L, int base, int nargs, int counted) {
+  int i, status;
+  lua_pushvalue(L, base);
+  for (i = 1; i <= nargs; i++)
+    lua_pushvalue(L, base + i);
+  if (counted)
+    lua_sethook(L, count_hook, LUA_MASKCOUNT, 1);
+  status = lua_pcall(L, nargs, 0, 0);
+  if (counted)
+    lua_sethook(L, NULL, 0, 0);
+  if (status != 0)
+    lua_error(L);
+}
+
+/* instr, bytes, allocs, peak, ms = bench.run(fn, ...) */
+static int bench_run (lua_State *L) {
+  int nargs = lua_gettop(L) - 1;
+  unsigned long long bytes, allocs;
+  size_t base_inuse;
+  double t0;
+  luaL_checktype(L, 1, LUA_TFUNCTION);
+
+  /* counted pass: instructions and heap traffic */
+  lua_gc(L, LUA_GCCOLLECT, 0);
+  base_inuse = heap.peak = heap.inuse;
+  bytes = heap.bytes;
+  allocs = heap.allocs;
+  instructions = 0;
+  bench_call(L, 1, nargs, 1);
+  lua_pushnumber(L, (lua_Number)instructions);
+  lua_pushnumber(L, (lua_Number)(heap.bytes - bytes));
+  lua_pushnumber(L, (lua_Number)(heap.allocs - allocs));
+  lua_pushnumber(L, (lua_Number)(heap.peak - base_inuse));
+
+  /* timed pass, without the per-instruction hook */
+  lua_gc(L, LUA_GCCOLLECT, 0);
+  t0 = cpu_ms();
+  bench_call(L, 1, nargs, 0);
+  lua_pushnumber(L, cpu_ms() - t0);
+  return 5;
+}
+
+/* inuse, peak, bytes, allocs, blocks = bench.heap() */
+static int bench_heap (lua_State *L) {
+  lua_pushnumber(L, (lua_Number)heap.inuse);
+  lua_pushnumber(L, (lua_Number)heap.peak);
+  lua_pushnumber(L, (lua_Number)heap.bytes);
+  lua_pushnumber(L, (lua_Number)heap.allocs);
+  lua_pushnumber(L, (lua_Number)heap.blocks);
+  return 5;
+}
+
+/* ms = bench.clock() */
+static int bench_clock (lua_State *L) {
+  lua_pushnumber(L, cpu_ms());
+  return 1;
+}
+
+/* reads, bytes = bench.fsreads() */
+static int bench_fsreads (lua_State *L) {
+  uint32_t calls, bytes;
+  hostfs_get_reads(&calls, &bytes);
+  lua_pushnumber(L, (lua_Number)calls);
+  lua_pushnumber(L, (lua_Number)bytes);
+  return 2;
+}
+
+/* writes, bytes = bench.fswrites() */
+static int bench_fswrites (lua_State *L) {
+  uint32_t calls, bytes;
+  hostfs_get_writes(&calls, &bytes);
+  lua_pushnumber(L, (lua_Number)calls);
+  lua_pushnumber(L, (lua_Number)bytes);
+  return 2;
+}
+
+static const LUA_REG_TYPE bench_map[] = {
+  { LSTRKEY( "run" ),   LFUNCVAL( bench_run ) },
+  { LSTRKEY( "heap" ),  LFUNCVAL( bench_heap ) },
+  { LSTRKEY( "clock" ), LFUNCVAL( bench_clock ) },
+  { LSTRKEY( "fsreads" ), LFUNCVAL( bench_fsreads ) },
+  { LSTRKEY( "fswrites" ), LFUNCVAL( bench_fswrites ) },
+  { LNILKEY, LNILVAL }
+};
+
+NODEMCU_MODULE(BENCH, "bench", bench_map, NULL);
+
+
+/* node module, just what runs without the chip */
+
+#ifdef LUA_SLAB_ALLOC
+static const LUA_REG_TYPE node_egc_map[] = {
+  { LSTRKEY( "slabinfo" ), LFUNCVAL( luaL_slabinfo ) },
+  { LNILKEY, LNILVAL }
+};
+#endif
+
+static const LUA_REG_TYPE node_map[] = {
+  { LSTRKEY( "compile" ), LFUNCVAL( luaL_compilefsfile ) },
+#ifdef LUA_MEMPROFILE
+  { LSTRKEY( "memprofile" ), LFUNCVAL( luaM_memprofile ) },
+#endif
+#ifdef LUA_SLAB_ALLOC
+  { LSTRKEY( "egc" ), LROVAL( node_egc_map ) },
+#endif
+  { LNILKEY, LNILVAL }
+};
+
+NODEMCU_MODULE(NODE, "node", node_map, NULL);
+
+
+/* driver */
+
+static void usage (void) {
+  fprintf(stderr,
+  "usage: %s [options] [script [args]]\n"
+  "Available options are:\n"
+  "  -d dir   directory that stands in for the flash filesystem (default .)\n"
+  "  -e stat  execute string " LUA_QL("stat") "\n"
+  "  -f file  load a luac.cross -f image, or a compiled Lua file (repeat\n"
+  "           for more), into the Lua flash store\n"
+  "  -m limit set the EGC memory limit in bytes\n",
+  progname);
+  exit(EXIT_FAILURE);
+}
+
+static int traceback (lua_State *L) {
+  lua_getfield(L, LUA_GLOBALSINDEX, "debug");
+  if (!lua_istable(L, -1) && !lua_isrotable(L, -1)) {
+    lua_pop(L, 1);
+    return 1;
+  }
+  lua_getfield(L, -1, "traceback");
+  if (!lua_isfunction(L, -1) && !lua_islightfunction(L, -1)) {
+    lua_pop(L, 2);
+    return 1;
+  }
+  lua_pushvalue(L, 1);
+  lua_pushinteger(L, 2);
+  lua_call(L, 2, 1);
+  return 1;
+}
+
+static int docall (lua_State *L, int status, int narg) {
+  if (status == 0) {
+    int base = lua_gettop(L) - narg;
+    lua_pushcfunction(L, traceback);
+    lua_insert(L, base);
+    status = lua_pcall(L, narg, 0, base);
+    lua_remove(L, base);
+  }
+  if (status != 0) {
+    const char *msg = lua_tostring(L, -1);
+    fprintf(stderr, "%s: %s\n", progname, msg ? msg : "(error object is not a string)");
+    lua_pop(L, 1);
+  }
+  return status;
+}
+
+int main (int argc, char **argv) {
+  lua_State *L;
+  int i, status = 0, nflash = 0;
+  const char **flash = malloc(argc * sizeof(char *));  /* -f files */
+
+  if (argv[0] && argv[0][0]) progname = argv[0];
+
+  /* the filesystem and the flash store are set up before the state exists */
+  for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+    if (argv[i][1] == '\0' || argv[i][2] != '\0' || i + 1 >= argc)
+      usage();
+    if (argv[i][1] == 'd') {
+      hostfs_set_root(argv[++i]);
+    } else if (argv[i][1] == 'f') {
+      flash[nflash++] = argv[++i];
+    } else {
+      i++;
+    }
+  }
+  if (nflash > 0) {
+    int erased;
+    const char *err = luaN_reload(flash, nflash, &erased);
+    if (err) {
+      fprintf(stderr, "%s: flash store: %s\n", progname, err);
+      return EXIT_FAILURE;
+    }
+  }
+  free(flash);
+
+  L = luaL_newstate();
+  if (L == NULL) {
+    fprintf(stderr, "%s: cannot create state: not enough memory\n", progname);
+    return EXIT_FAILURE;
+  }
+  heap.alloc = lua_getallocf(L, &heap.ud);
+  lua_setallocf(L, host_alloc, &heap);
+  luaL_openlibs(L);
+
+  for (i = 1; i < argc && argv[i][0] == '-' && status == 0; i++) {
+    if (argv[i][1] == '\0' || argv[i][2] != '\0' || i + 1 >= argc)
+      usage();
+    switch (argv[i][1]) {
+      case 'd':
+      case 'f':
+        i++;  /* done above */
+        break;
+      case 'e':
+        i++;
+        status = docall(L, luaL_loadbuffer(L, argv[i], c_strlen(argv[i]), "=(command line)"), 0);
+        break;
+      case 'm':
+        legc_set_mode(L, EGC_ON_MEM_LIMIT | EGC_ON_ALLOC_FAILURE, atoi(argv[++i]));
+        break;
+      default:
+        usage();
+    }
+  }
+
+  if (status == 0 && i < argc) {
+    int narg = 0;
+    status = luaL_loadfsfile(L, argv[i]);
+    if (status == 0) {
+      luaL_checkstack(L, argc - i, "too many arguments to script");
+      while (++i < argc) {
+        lua_pushstring(L, argv[i]);
+        narg++;
+      }
+    }
+    status = docall(L, status, narg);
+  } else if (i == 1) {
+    usage();
+  }
+
+  lua_close(L);
+  return status == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
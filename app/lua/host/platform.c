@@ -0,0 +1,79 @@
+/*
+ * Host stand-ins for the platform layer.
+ *
+ * As on the chip, flash is memory-mapped: physical address 0 is the start of
+ * the executable and mapped addresses are physical ones plus that base. Only
+ * the sectors host.ld reserves between _host_flash_start and _host_flash_end
+ * (the Lua flash store) can be erased and written, with NOR semantics, so
+ * code that rewrites flash and then reads it in place behaves as on the chip.
+ */
+
+#include "platform.h"
+#include "c_stdlib.h"
+#include "c_string.h"
+
+extern char __executable_start[];
+extern char _host_flash_start[], _host_flash_end[];
+
+#define HOST_FLASH_SECTOR_SIZE  INTERNAL_FLASH_SECTOR_SIZE
+
+static uint8_t *writable( uint32_t addr, uint32_t size )
+{
+  uint8_t *p = (uint8_t *)__executable_start + addr;
+  if (p < (uint8_t *)_host_flash_start || p > (uint8_t *)_host_flash_end ||
+      size > (uint32_t)(_host_flash_end - (char *)p))
+    return NULL;
+  return p;
+}
+
+int platform_init( void )
+{
+  return PLATFORM_OK;
+}
+
+uint32_t platform_flash_mapped2phys( uint32_t mapped_addr )
+{
+  return mapped_addr - (uint32_t)__executable_start;
+}
+
+uint32_t platform_flash_get_sector_of_address( uint32_t addr )
+{
+  return addr / HOST_FLASH_SECTOR_SIZE;
+}
+
+uint32_t platform_flash_write( const void *from, uint32_t toaddr, uint32_t size )
+{
+  const uint8_t *src = from;
+  uint8_t *dst = writable( toaddr, size );
+  uint32_t i;
+
+  if (!dst)
+    return 0;
+  // NOR flash can only clear bits
+  for (i = 0; i < size; i++)
+    dst[i] &= src[i];
+  return size;
+}
+
+uint32_t platform_flash_read( void *to, uint32_t fromaddr, uint32_t size )
+{
+  if (fromaddr >= platform_flash_get_num_sectors() * HOST_FLASH_SECTOR_SIZE ||
+      size > platform_flash_get_num_sectors() * HOST_FLASH_SECTOR_SIZE - fromaddr)
+    return 0;
+  c_memcpy( to, __executable_start + fromaddr, size );
+  return size;
+}
+
+uint32_t platform_flash_get_num_sectors( void )
+{
+  return (_host_flash_end - __executable_start) / HOST_FLASH_SECTOR_SIZE;
+}
+
+int platform_flash_erase_sector( uint32_t sector_id )
+{
+  uint8_t *p = writable( sector_id * HOST_FLASH_SECTOR_SIZE, HOST_FLASH_SECTOR_SIZE );
+  if (!p)
+    return PLATFORM_ERR;
+  c_memset( p, 0xff, HOST_FLASH_SECTOR_SIZE );
+  return PLATFORM_OK;
+}
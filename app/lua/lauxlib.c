@@ -32,6 +32,12 @@
 #include "lobject.h"
 #include "lstate.h"
 #include "legc.h"
+#include "lundump.h"
+#if defined(LUA_SLAB_ALLOC) && !defined(LUA_CROSS_COMPILER)
+#include "lslab.h"
+#else
+#undef LUA_SLAB_ALLOC
+#endif
 
 #define FREELIST_REF	0	/* free list of references */
 
@@ -651,13 +657,37 @@ LUALIB_API int luaL_loadfile (lua_State *L, const char *filename) {
 
 #include C_HEADER_FCNTL
 
+/*
+** Files are read in blocks of LUAL_FSBUFFERSIZE from the heap, or of
+** LUAL_BUFFERSIZE from the C stack if the heap is short, as every file
+** system read has a high fixed cost. The header is probed in the first
+** block, so the file is read once from start to end.
+*/
 typedef struct LoadFSF {
   int extraline;
   int f;
-  char buff[LUAL_BUFFERSIZE];
+  const char *p;     /* next byte in buff */
+  size_t n;          /* bytes left in buff */
+  char *buff;
+  size_t size;
 } LoadFSF;
 
 
+static int fillFSF (LoadFSF *lf) {
+  sint32_t n = vfs_read(lf->f, lf->buff, lf->size);
+  lf->p = lf->buff;
+  lf->n = n > 0 ? n : 0;
+  return lf->n > 0;
+}
+
+
+static int getcFSF (LoadFSF *lf) {
+  if (lf->n == 0 && !fillFSF(lf)) return VFS_EOF;
+  lf->n--;
+  return (unsigned char)*lf->p++;
+}
+
+
 static const char *getFSF (lua_State *L, void *ud, size_t *size) {
   LoadFSF *lf = (LoadFSF *)ud;
   (void)L;
@@ -671,10 +701,10 @@ static const char *getFSF (lua_State *L, void *ud, size_t *size) {
     return "\n";
   }
 
-  if (vfs_eof(lf->f)) return NULL;
-  *size = vfs_read(lf->f, lf->buff, sizeof(lf->buff));
-
-  return (*size > 0) ? lf->buff : NULL;
+  if (lf->n == 0 && !fillFSF(lf)) return NULL;
+  *size = lf->n;
+  lf->n = 0;
+  return lf->p;
 }
 
 
@@ -688,10 +718,12 @@ static int errfsfile (lua_State *L, const char *what, int fnameindex) {
 
 LUALIB_API int luaL_loadfsfile (lua_State *L, const char *filename) {
   LoadFSF lf;
-  int status, readstatus;
+  char stackbuff[LUAL_BUFFERSIZE];
+  int status;
   int c;
   int fnameindex = lua_gettop(L) + 1;  /* index of filename on the stack */
   lf.extraline = 0;
+  lf.n = 0;
   if (filename == NULL) {
     return luaL_error(L, "filename is NULL");
   }
@@ -700,30 +732,131 @@ LUALIB_API int luaL_loadfsfile (lua_State *L, const char *filename) {
     lf.f = vfs_open(filename, "r");
     if (!lf.f) return errfsfile(L, "open", fnameindex);
   }
-  // if(fs_size(lf.f)>LUAL_BUFFERSIZE)
-  //   return luaL_error(L, "file is too big");
-  c = vfs_getc(lf.f);
+  lf.size = LUAL_FSBUFFERSIZE;
+  if ((lf.buff = (char *)c_malloc(lf.size)) == NULL) {
+    lf.buff = stackbuff;
+    lf.size = sizeof(stackbuff);
+  }
+  c = getcFSF(&lf);
   if (c == '#') {  /* Unix exec. file? */
     lf.extraline = 1;
-    while ((c = vfs_getc(lf.f)) != VFS_EOF && c != '\n') ;  /* skip first line */
-    if (c == '\n') c = vfs_getc(lf.f);
+    while ((c = getcFSF(&lf)) != VFS_EOF && c != '\n') ;  /* skip first line */
+    if (c == '\n') c = getcFSF(&lf);
   }
-  if (c == LUA_SIGNATURE[0] && filename) {  /* binary file? */
-    vfs_close(lf.f);
-    lf.f = vfs_open(filename, "r");  /* reopen in binary mode */
-    if (!lf.f) return errfsfile(L, "reopen", fnameindex);
-    /* skip eventual `#!...' */
-   while ((c = vfs_getc(lf.f)) != VFS_EOF && c != LUA_SIGNATURE[0]) ;
+  if (c == LUA_SIGNATURE[0]) {  /* binary file? */
     lf.extraline = 0;
   }
-  vfs_ungetc(c, lf.f);
+  if (c != VFS_EOF) {  /* put it back */
+    lf.p--;
+    lf.n++;
+  }
   status = lua_load(L, getFSF, &lf, lua_tostring(L, -1));
 
-  if (filename) vfs_close(lf.f);  /* close file (even in case of errors) */
+  vfs_close(lf.f);  /* close file (even in case of errors) */
+  if (lf.buff != stackbuff) c_free(lf.buff);
   lua_remove(L, fnameindex);
   return status;
 }
 
+
+/*
+** luaU_dump emits every header field, count and constant on its own, and
+** each file system write has a high fixed cost, so the dump is collected
+** in a page sized buffer and written a page at a time.
+*/
+typedef struct DumpFSF {
+  int f;
+  size_t n;
+  char buff[LUAL_BUFFERSIZE];
+} DumpFSF;
+
+
+static int flushFSF (DumpFSF *df) {
+  size_t n = df->n;
+  df->n = 0;
+  return n == 0 || vfs_write(df->f, df->buff, n) == n ? 0 : 1;
+}
+
+
+static int putFSF (lua_State *L, const void *p, size_t size, void *ud) {
+  DumpFSF *df = (DumpFSF *)ud;
+  const char *s = (const char *)p;
+  (void)L;
+  while (size > 0) {
+    size_t n = sizeof(df->buff) - df->n;
+    if (df->n == 0 && size >= sizeof(df->buff))  /* big writes bypass the buffer */
+      return vfs_write(df->f, s, size) == size ? 0 : 1;
+    if (n > size) n = size;
+    c_memcpy(df->buff + df->n, s, n);
+    df->n += n;
+    s += n;
+    size -= n;
+    if (df->n == sizeof(df->buff) && flushFSF(df))
+      return 1;
+  }
+  return 0;
+}
+
+
+/*
+** Writes the Lua function on top of the stack to filename as bytecode,
+** without debug information if strip is set. Returns 0, LUA_ERR_FSF_OPEN,
+** LUA_ERR_FSF_WRITE or a LUA_ERR_CC_* code from luaU_dump.
+*/
+LUALIB_API int luaL_dumpfsfile (lua_State *L, const char *filename, int strip) {
+  DumpFSF df;
+  int status;
+  const TValue *o = L->top - 1;
+  if (!isLfunction(o))
+    return luaL_error(L, "Lua function expected");
+  df.n = 0;
+  df.f = vfs_open(filename, "w+");
+  if (!df.f) return LUA_ERR_FSF_OPEN;
+  lua_lock(L);
+  status = luaU_dump(L, clvalue(o)->l.p, putFSF, &df, strip);
+  lua_unlock(L);
+  if (flushFSF(&df) || vfs_flush(df.f) != VFS_RES_OK)
+    status = LUA_ERR_FSF_WRITE;
+  if (vfs_close(df.f) != VFS_RES_OK)
+    status = LUA_ERR_FSF_WRITE;
+  return status;
+}
+
+
+/*
+** Lua: node.compile(filename), in the node module of the firmware and of
+** lua.host. Writes filename.lc, without debug information, for filename.lua.
+*/
+LUALIB_API int luaL_compilefsfile (lua_State *L) {
+  size_t len;
+  const char *fname = luaL_checklstring(L, 1, &len);
+  const char *output;
+  const char *basename = vfs_basename(fname);
+  int result;
+  luaL_argcheck(L, c_strlen(basename) <= FS_OBJ_NAME_LEN && c_strlen(fname) == len, 1, "filename invalid");
+  if (len < 4 || c_strcmp(fname + len - 4, ".lua") != 0)
+    return luaL_error(L, "not a .lua file");
+  lua_pushlstring(L, fname, len - 4);
+  lua_pushliteral(L, ".lc");
+  lua_concat(L, 2);
+  output = lua_tostring(L, -1);
+  if (luaL_loadfsfile(L, fname) != 0)
+    return lua_error(L);
+  result = luaL_dumpfsfile(L, output, 1);
+  switch (result) {
+    case 0:
+      return 0;
+    case LUA_ERR_CC_INTOVERFLOW:
+      return luaL_error(L, "value too big or small for target integer type");
+    case LUA_ERR_CC_NOTINTEGER:
+      return luaL_error(L, "target lua_Number is integral but fractional value found");
+    case LUA_ERR_FSF_OPEN:
+      return luaL_error(L, "cannot open/write to file");
+    default:
+      return luaL_error(L, "writing to file failed");
+  }
+}
+
 #endif
 
 typedef struct LoadS {
@@ -780,13 +913,79 @@ static int l_check_memlimit(lua_State *L, size_t needbytes) {
 }
 
 
+#ifdef LUA_SLAB_ALLOC
+/*
+** blocks of up to LSLAB_MAX bytes live in the slabs, larger ones on the
+** heap; osize is not trusted, a slab knows its slot size and the heap
+** is left to size its own blocks
+*/
+static void *l_realloc (void *ptr, size_t osize, size_t nsize) {
+  size_t ssize = lslab_size(ptr);
+  void *nptr;
+  (void)osize;
+  if (ssize == 0) {  /* NULL or a heap block */
+    if (nsize > LSLAB_MAX || (nptr = lslab_alloc(nsize)) == NULL)
+      return c_realloc(ptr, nsize);
+    if (ptr != NULL) {  /* moves into a slab, once the heap made it nsize */
+      void *hptr = c_realloc(ptr, nsize);
+      if (hptr == NULL) {
+        lslab_free(nptr);
+        return NULL;
+      }
+      c_memcpy(nptr, hptr, nsize);
+      c_free(hptr);
+    }
+    return nptr;
+  }
+  if (nsize <= ssize)
+    return ptr;
+  if ((nsize > LSLAB_MAX || (nptr = lslab_alloc(nsize)) == NULL) &&
+      (nptr = c_malloc(nsize)) == NULL)
+    return NULL;
+  c_memcpy(nptr, ptr, ssize);
+  lslab_free(ptr);
+  return nptr;
+}
+
+
+/*
+** Lua: node.egc.slabinfo(), in the node module of the firmware and of
+** lua.host. Returns an array with the occupancy of each size class.
+*/
+LUALIB_API int luaL_slabinfo (lua_State *L) {
+  int cls;
+  lua_createtable(L, LSLAB_CLASSES, 0);
+  for (cls = 0; cls < LSLAB_CLASSES; cls++) {
+    lslab_stats st;
+    lslab_get_stats(cls, &st);
+    lua_createtable(L, 0, 4);
+    lua_pushinteger(L, st.size);
+    lua_setfield(L, -2, "size");
+    lua_pushinteger(L, st.pages);
+    lua_setfield(L, -2, "pages");
+    lua_pushinteger(L, st.used);
+    lua_setfield(L, -2, "used");
+    lua_pushinteger(L, st.free);
+    lua_setfield(L, -2, "free");
+    lua_rawseti(L, -2, cls + 1);
+  }
+  return 1;
+}
+#else
+#define l_realloc(ptr,osize,nsize)  c_realloc(ptr, nsize)
+#endif
+
+
 static void *l_alloc (void *ud, void *ptr, size_t osize, size_t nsize) {
   lua_State *L = (lua_State *)ud;
   int mode = L == NULL ? 0 : G(L)->egcmode;
   void *nptr;
 
   if (nsize == 0) {
-    c_free(ptr);
+#ifdef LUA_SLAB_ALLOC
+    if (!lslab_free(ptr))
+#endif
+      c_free(ptr);
     return NULL;
   }
   if (L != NULL && (mode & EGC_ALWAYS)) /* always collect memory if requested */
@@ -798,10 +997,13 @@ static void *l_alloc (void *ud, void *ptr, size_t osize, size_t nsize) {
     if(G(L)->memlimit > 0 && (mode & EGC_ON_MEM_LIMIT) && l_check_memlimit(L, nsize - osize))
       return NULL;
   }
-  nptr = (void *)c_realloc(ptr, nsize);
+  nptr = l_realloc(ptr, osize, nsize);
   if (nptr == NULL && L != NULL && (mode & EGC_ON_ALLOC_FAILURE)) {
     luaC_fullgc(L); /* emergency full collection. */
-    nptr = (void *)c_realloc(ptr, nsize); /* try allocation again */
+#ifdef LUA_SLAB_ALLOC
+    lslab_trim(); /* and hand the spare slab pages back to the heap */
+#endif
+    nptr = l_realloc(ptr, osize, nsize); /* try allocation again */
   }
   return nptr;
 }
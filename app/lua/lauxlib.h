@@ -34,6 +34,10 @@ LUALIB_API void (luaL_setn) (lua_State *L, int t, int n);
 /* extra error code for `luaL_load' */
 #define LUA_ERRFILE     (LUA_ERRERR+1)
 
+/* results of `luaL_dumpfsfile', besides the LUA_ERR_CC_* ones of luaU_dump */
+#define LUA_ERR_FSF_WRITE  1	/* as luaU_dump returns when its writer fails */
+#define LUA_ERR_FSF_OPEN   2
+
 
 typedef struct luaL_Reg {
   const char *name;
@@ -86,6 +90,8 @@ LUALIB_API void (luaL_unref) (lua_State *L, int t, int ref);
 LUALIB_API int (luaL_loadfile) (lua_State *L, const char *filename);
 #else
 LUALIB_API int (luaL_loadfsfile) (lua_State *L, const char *filename);
+LUALIB_API int (luaL_dumpfsfile) (lua_State *L, const char *filename, int strip);
+LUALIB_API int (luaL_compilefsfile) (lua_State *L);
 #endif
 LUALIB_API int (luaL_loadbuffer) (lua_State *L, const char *buff, size_t sz,
                                   const char *name);
@@ -102,6 +108,10 @@ LUALIB_API const char *(luaL_findtable) (lua_State *L, int idx,
 
 LUALIB_API void luaL_assertfail(const char *file, int line, const char *message);
 
+#ifdef LUA_SLAB_ALLOC
+LUALIB_API int (luaL_slabinfo) (lua_State *L);
+#endif
+
 
 /*
 ** ===============================================================
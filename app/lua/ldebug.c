@@ -251,6 +251,8 @@ int luaG_getline (const Proto *f, int pc) {
 static int stripdebug (lua_State *L, Proto *f, int level) {
   int len = 0, sizepackedlineinfo;
   TString* dummy;
+  if (proto_is_readonly(f))
+    return 0;  /* debug info is in flash */
   switch (level) {
     case 3:
       sizepackedlineinfo = c_strlen(cast(char *, f->packedlineinfo))+1;
@@ -230,7 +230,7 @@ static StkId adjust_varargs (lua_State *L, Proto *p, int actual) {
       setobj2n(L, luaH_setnum(L, htab, i+1), L->top - 1 - nvar + i);
     unfixedstack(L);
     /* store counter in field `n' */
-    setnvalue(luaH_setstr(L, htab, luaS_newliteral(L, "n")), cast_num(nvar));
+    setivalue(luaH_setstr(L, htab, luaS_newliteral(L, "n")), nvar);
     L->top--; /* remove table from stack */
   }
 #endif
@@ -431,6 +431,7 @@ static int resume_error (lua_State *L, const char *msg) {
 
 
 LUA_API int lua_resume (lua_State *L, int nargs) {
+  lua_State *from;
   int status;
   lua_lock(L);
   if (L->status != LUA_YIELD && (L->status != 0 || L->ci != L->base_ci))
@@ -440,7 +441,10 @@ LUA_API int lua_resume (lua_State *L, int nargs) {
   luai_userstateresume(L, nargs);
   lua_assert(L->errfunc == 0);
   L->baseCcalls = ++L->nCcalls;
+  from = G(L)->running;
+  G(L)->running = L;
   status = luaD_rawrunprotected(L, resume, L->top - nargs);
+  G(L)->running = from;
   if (status != 0) {  /* error? */
     L->status = cast_byte(status);  /* mark thread as `dead' */
     luaD_seterrorobj(L, status, L->top);
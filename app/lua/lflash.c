@@ -0,0 +1,690 @@
+/*
+** Lua flash store: protos and strings executed in place from flash
+** See Copyright Notice in lua.h
+*/
+
+#define lflash_c
+#define LUA_CORE
+#define LUAC_CROSS_FILE
+
+#include "lua.h"
+
+#ifdef LUA_FLASH_STORE
+
+#include <setjmp.h>
+#include C_HEADER_STDLIB
+#include C_HEADER_STRING
+
+#include "lauxlib.h"
+#include "ldo.h"
+#include "lflash.h"
+#include "lfunc.h"
+#include "lgc.h"
+#include "lobject.h"
+#include "lstate.h"
+#include "lstring.h"
+#include "lundump.h"
+
+#include "platform.h"
+#include "vfs.h"
+
+#ifndef LUA_OPTIMIZE_DEBUG
+#error "the Lua flash store keeps packed line info, define LUA_OPTIMIZE_DEBUG"
+#endif
+
+#if LUA_FLASH_STORE % INTERNAL_FLASH_SECTOR_SIZE != 0
+#error "LUA_FLASH_STORE must be a multiple of the flash sector size"
+#endif
+
+/*
+** The store is reserved inside the firmware image: the linker script keeps
+** .lfs.reserved in irom0, so its contents are read through the flash cache
+** like any other constant and rewritten with the SPI flash API. Flashing a
+** new firmware leaves it zeroed, which reads as an empty store.
+*/
+char lua_flash_store[LUA_FLASH_STORE]
+  __attribute__((aligned(INTERNAL_FLASH_SECTOR_SIZE), section(".lfs.reserved")));
+
+/* the layout of the store, which is not the image format */
+#define FLASH_LAYOUT	2
+#define FLASH_SIGNATURE	(0x4c465300 | FLASH_LAYOUT)
+
+/*
+** A module is either a native Proto built from an image, or a compiled Lua
+** file copied as is (p NULL), which is undumped in direct mode: its code,
+** line info and string contents are used in place.
+*/
+typedef struct FlashModule {
+  TString *name;
+  Proto *p;
+  const char *chunk;
+  lu_int32 sizechunk;
+} FlashModule;
+
+/* written last, so an interrupted reload leaves an (erased) empty store */
+typedef struct FlashHeader {
+  lu_int32 signature;
+  lu_int32 size;  /* bytes in use, header included */
+  GCObject **strt;  /* string table of the store, chained through `next' */
+  lu_int32 strtsize;  /* a power of 2 */
+  lu_int32 nstrings;
+  FlashModule *modules;
+  lu_int32 nmodules;
+} FlashHeader;
+
+static const FlashHeader *fh;  /* NULL unless the store holds an image */
+
+
+void luaN_init (lua_State *L) {
+  const FlashHeader *h = cast(const FlashHeader *, lua_flash_store);
+  UNUSED(L);
+  fh = (h->signature == FLASH_SIGNATURE && h->size <= LUA_FLASH_STORE) ? h : NULL;
+}
+
+
+/*
+** Strings in the store are never created in RAM: luaS_newlstr looks here
+** whenever its own table misses, so flash strings stay unique and compare
+** by pointer like any other.
+*/
+TString *luaN_findstring (const char *str, size_t l, unsigned int h) {
+  GCObject *o;
+  if (fh == NULL)
+    return NULL;
+  for (o = fh->strt[lmod(h, fh->strtsize)]; o != NULL; o = o->gch.next) {
+    TString *ts = rawgco2ts(o);
+    if (ts->tsv.hash == h && ts->tsv.len == l &&
+        c_memcmp(str, getstr(ts), l) == 0)
+      return ts;
+  }
+  return NULL;
+}
+
+
+typedef struct LoadChunk {
+  const char *chunk;
+  size_t size;
+} LoadChunk;
+
+static const char *get_chunk (lua_State *L, void *ud, size_t *size) {
+  LoadChunk *lc = cast(LoadChunk *, ud);
+  if (L == NULL && size == NULL)  /* direct mode check */
+    return lc->chunk;
+  if (lc->size == 0)
+    return NULL;
+  *size = lc->size;
+  lc->size = 0;
+  return lc->chunk;
+}
+
+/* pushes a closure over the main function of module `name', if it is stored */
+int luaN_pushmodule (lua_State *L, const char *name) {
+  size_t l = c_strlen(name);
+  TString *ts = luaN_findstring(name, l, luaS_hash(name, l));
+  lu_int32 i;
+  if (ts == NULL)
+    return 0;
+  for (i = 0; i < fh->nmodules; i++) {
+    if (fh->modules[i].name == ts) {
+      Proto *p = fh->modules[i].p;
+      if (p != NULL) {
+        Closure *cl = luaF_newLclosure(L, p->nups, hvalue(gt(L)));
+        cl->l.p = p;
+        setclvalue(L, L->top, cl);
+        incr_top(L);
+      } else {
+        LoadChunk lc;
+        lc.chunk = fh->modules[i].chunk;
+        lc.size = fh->modules[i].sizechunk;
+        if (lua_load(L, get_chunk, &lc, getstr(ts)) != 0)
+          lua_error(L);
+      }
+      return 1;
+    }
+  }
+  return 0;
+}
+
+
+/* Lua: func = node.flashindex(name)
+**      nil, used, size, modules = node.flashindex() */
+int luaN_index (lua_State *L) {
+  const char *name = luaL_optstring(L, 1, NULL);
+  lu_int32 i, n = fh ? fh->nmodules : 0;
+  if (name != NULL && luaN_pushmodule(L, name))
+    return 1;
+  lua_pushnil(L);
+  lua_pushinteger(L, fh ? fh->size : 0);
+  lua_pushinteger(L, LUA_FLASH_STORE);
+  lua_createtable(L, n, 0);
+  for (i = 0; i < n; i++) {
+    TString *ts = fh->modules[i].name;
+    lua_pushlstring(L, getstr(ts), ts->tsv.len);
+    lua_rawseti(L, -2, i + 1);
+  }
+  return 4;
+}
+
+
+/*
+** Reloading the store. The image is read twice: a dry run validates it and
+** sizes the result before anything is erased, then the store is erased and
+** the native structures are streamed into it through a small write buffer.
+** Every object is emitted after the objects it points to, so each one is
+** complete when written and flash is only ever programmed once.
+*/
+
+#define LFS_INBUF	256
+#define LFS_OUTBUF	256
+
+typedef struct LoadState {
+  jmp_buf jmp;
+  const char *error;
+  const char *const *files;
+  int nfiles;
+  int fd;
+  int dryrun;
+  lu_byte in[LFS_INBUF];
+  lu_int32 inpos, inlen;
+  lu_int32 out[LFS_OUTBUF / sizeof(lu_int32)];
+  lu_int32 flushed;  /* store offset of out[0] */
+  lu_int32 used;  /* store offset of the next byte emitted */
+  lu_int32 phys;  /* physical flash address of the store */
+  lu_int32 nstrings;
+  TString **strings;  /* flash address of each string of the image */
+  GCObject **strt;  /* bucket heads, written once all strings are */
+  lu_int32 strtsize;
+  char *buf;  /* holds a string while it is hashed */
+  lu_int32 sizebuf;
+  Proto **pstack;  /* children of the functions being loaded */
+  lu_int32 npstack, sizepstack;
+  FlashModule *modules;
+} LoadState;
+
+static void error (LoadState *S, const char *why) {
+  S->error = why;
+  longjmp(S->jmp, 1);
+}
+
+static void *alloc (LoadState *S, void *block, size_t n) {
+  void *p = c_realloc(block, n ? n : 1);
+  if (p == NULL)
+    error(S, "not enough memory");
+  return p;
+}
+
+
+/* input */
+
+static void load_block (LoadState *S, void *b, lu_int32 n) {
+  lu_byte *p = cast(lu_byte *, b);
+  while (n > 0) {
+    lu_int32 k;
+    if (S->inpos == S->inlen) {
+      sint32_t got = vfs_read(S->fd, S->in, LFS_INBUF);
+      if (got <= 0)
+        error(S, "truncated image");
+      S->inpos = 0;
+      S->inlen = got;
+    }
+    k = S->inlen - S->inpos;
+    if (k > n) k = n;
+    c_memcpy(p, S->in + S->inpos, k);
+    S->inpos += k;
+    p += k;
+    n -= k;
+  }
+}
+
+static lu_byte load_byte (LoadState *S) {
+  lu_byte b;
+  load_block(S, &b, 1);
+  return b;
+}
+
+static lu_int32 load_u32 (LoadState *S) {
+  lu_byte b[4];
+  load_block(S, b, 4);
+  return b[0] | (b[1] << 8) | (b[2] << 16) | (cast(lu_int32, b[3]) << 24);
+}
+
+static int load_int (LoadState *S) {
+  lu_int32 x = load_u32(S);
+  if (x > MAX_INT)
+    error(S, "bad integer");
+  return cast_int(x);
+}
+
+static lua_Number load_number (LoadState *S) {
+  lu_byte b[8];
+  union { double d; lu_byte b[8]; } u;
+  int i, one = 1;
+  load_block(S, b, 8);
+  for (i = 0; i < 8; i++)  /* the image is little endian */
+    u.b[i] = *(char *)&one ? b[i] : b[7 - i];
+  return cast_num(u.d);
+}
+
+/* string index+1, 0 for none */
+static TString *load_ref (LoadState *S) {
+  lu_int32 i = load_u32(S);
+  if (i > S->nstrings)
+    error(S, "bad string reference");
+  return i ? S->strings[i - 1] : NULL;
+}
+
+
+/* output */
+
+static void *here (LoadState *S) {
+  return lua_flash_store + S->used;
+}
+
+static void flush (LoadState *S, lu_int32 n) {
+  if (!S->dryrun &&
+      platform_flash_write(S->out, S->phys + S->flushed, n) != n)
+    error(S, "flash write failed");
+  S->flushed += n;
+}
+
+static void emit (LoadState *S, const void *b, lu_int32 n) {
+  const lu_byte *p = cast(const lu_byte *, b);
+  if (n > LUA_FLASH_STORE - S->used)
+    error(S, "image too large for the flash store");
+  while (n > 0) {
+    lu_int32 pos = S->used - S->flushed;
+    lu_int32 k = LFS_OUTBUF - pos;
+    if (k > n) k = n;
+    if (!S->dryrun)
+      c_memcpy(cast(lu_byte *, S->out) + pos, p, k);
+    S->used += k;
+    p += k;
+    n -= k;
+    if (S->used - S->flushed == LFS_OUTBUF)
+      flush(S, LFS_OUTBUF);
+  }
+}
+
+static void emit_align (LoadState *S, lu_int32 a) {
+  static const lu_byte zero[8];
+  lu_int32 pad = (a - S->used % a) % a;
+  emit(S, zero, pad);
+}
+
+/* copies n bytes of the image to the store */
+static void copy (LoadState *S, lu_int32 n) {
+  while (n > 0) {
+    lu_byte b[32];
+    lu_int32 k = n < sizeof(b) ? n : sizeof(b);
+    load_block(S, b, k);
+    emit(S, b, k);
+    n -= k;
+  }
+}
+
+
+/* image contents */
+
+/* copies the rest of the input file to the store */
+static void copy_rest (LoadState *S) {
+  for (;;) {
+    sint32_t got;
+    if (S->inpos < S->inlen)
+      emit(S, S->in + S->inpos, S->inlen - S->inpos);
+    S->inpos = S->inlen = 0;
+    got = vfs_read(S->fd, S->in, LFS_INBUF);
+    if (got <= 0)
+      break;
+    S->inlen = got;
+  }
+}
+
+
+/* store contents */
+
+static void new_strt (LoadState *S, lu_int32 nstrings) {
+  S->nstrings = nstrings;
+  S->strings = alloc(S, S->strings, nstrings * sizeof(TString *));
+  for (S->strtsize = 1; S->strtsize < nstrings; S->strtsize <<= 1) ;
+  S->strt = alloc(S, S->strt, S->strtsize * sizeof(GCObject *));
+  c_memset(S->strt, 0, S->strtsize * sizeof(GCObject *));
+}
+
+/* s[l] is '\0' */
+static TString *emit_string (LoadState *S, const char *s, lu_int32 l) {
+  unsigned int h = luaS_hash(s, l);
+  TString ts, *p;
+  c_memset(&ts, 0, sizeof(ts));
+  ts.tsv.tt = LUA_TSTRING;
+  ts.tsv.marked = bitmask(FIXEDBIT);
+  ts.tsv.hash = h;
+  ts.tsv.len = l;
+  ts.tsv.next = S->strt[lmod(h, S->strtsize)];
+  emit_align(S, __alignof__(TString));
+  p = here(S);
+  S->strt[lmod(h, S->strtsize)] = obj2gco(p);
+  emit(S, &ts, sizeof(ts));
+  emit(S, s, l + 1);
+  return p;
+}
+
+static void emit_strt (LoadState *S, FlashHeader *h) {
+  emit_align(S, sizeof(GCObject *));
+  h->strt = here(S);
+  h->strtsize = S->strtsize;
+  h->nstrings = S->nstrings;
+  emit(S, S->strt, S->strtsize * sizeof(GCObject *));
+}
+
+/* the header goes last, over the erased placeholder at the start */
+static lu_int32 emit_header (LoadState *S, FlashHeader *h) {
+  emit_align(S, __alignof__(FlashModule));
+  h->modules = here(S);
+  emit(S, S->modules, h->nmodules * sizeof(FlashModule));
+  emit_align(S, sizeof(lu_int32));
+  if (S->used > S->flushed)
+    flush(S, S->used - S->flushed);
+  h->signature = FLASH_SIGNATURE;
+  h->size = S->used;
+  if (!S->dryrun &&
+      platform_flash_write(h, S->phys, sizeof(*h)) != sizeof(*h))
+    error(S, "flash write failed");
+  return S->used;
+}
+
+
+/* image contents */
+
+static void load_strings (LoadState *S) {
+  lu_int32 i;
+  for (i = 0; i < S->nstrings; i++) {
+    lu_int32 l = load_u32(S);
+    if (l >= S->sizebuf) {
+      S->buf = alloc(S, S->buf, l + 1);
+      S->sizebuf = l + 1;
+    }
+    load_block(S, S->buf, l);
+    S->buf[l] = '\0';
+    S->strings[i] = emit_string(S, S->buf, l);
+  }
+}
+
+static void push_proto (LoadState *S, Proto *p) {
+  if (S->npstack == S->sizepstack) {
+    S->sizepstack = S->sizepstack ? 2 * S->sizepstack : 16;
+    S->pstack = alloc(S, S->pstack, S->sizepstack * sizeof(Proto *));
+  }
+  S->pstack[S->npstack++] = p;
+}
+
+static Proto *load_function (LoadState *S, int depth) {
+  Proto f;
+  int i, base;
+  if (depth > LUAI_MAXCCALLS)
+    error(S, "functions nested too deeply");
+  c_memset(&f, 0, sizeof(f));
+  f.source = load_ref(S);
+  f.linedefined = load_int(S);
+  f.lastlinedefined = load_int(S);
+  f.nups = load_byte(S);
+  f.numparams = load_byte(S);
+  f.is_vararg = load_byte(S);
+  f.maxstacksize = load_byte(S);
+
+  f.sizecode = load_int(S);
+  emit_align(S, sizeof(Instruction));
+  f.code = here(S);
+  for (i = 0; i < f.sizecode; i++) {
+    Instruction in = load_u32(S);
+    emit(S, &in, sizeof(in));
+  }
+
+  f.sizek = load_int(S);
+  emit_align(S, __alignof__(TValue));
+  f.k = f.sizek ? here(S) : NULL;
+  for (i = 0; i < f.sizek; i++) {
+    TValue o;
+    c_memset(&o, 0, sizeof(o));
+    switch (load_byte(S)) {
+      case LUA_TNIL:
+        setnilvalue(&o);
+        break;
+      case LUA_TBOOLEAN:
+        setbvalue(&o, load_byte(S) != 0);
+        break;
+      case LUA_TNUMBER:
+        setnumvalue(&o, load_number(S));
+        break;
+      case LUA_TSTRING: {
+        TString *ts = load_ref(S);
+        if (ts == NULL)
+          error(S, "bad constant");
+        setsvalue(NULL, &o, ts);
+        break;
+      }
+      default:
+        error(S, "bad constant");
+    }
+    emit(S, &o, sizeof(o));
+  }
+
+  /* children go first; their addresses wait on pstack for the p array */
+  f.sizep = load_int(S);
+  base = S->npstack;
+  for (i = 0; i < f.sizep; i++)
+    push_proto(S, load_function(S, depth + 1));
+  emit_align(S, sizeof(Proto *));
+  f.p = f.sizep ? here(S) : NULL;
+  emit(S, S->pstack + base, f.sizep * sizeof(Proto *));
+  S->npstack = base;
+
+  i = load_int(S);
+  f.packedlineinfo = i ? here(S) : NULL;
+  if (i > 0) {
+    copy(S, i - 1);
+    if (load_byte(S) != 0)
+      error(S, "bad line info");
+    emit(S, "", 1);
+  }
+
+  f.sizelocvars = load_int(S);
+  emit_align(S, __alignof__(LocVar));
+  f.locvars = f.sizelocvars ? here(S) : NULL;
+  for (i = 0; i < f.sizelocvars; i++) {
+    LocVar lv;
+    lv.varname = load_ref(S);
+    lv.startpc = load_int(S);
+    lv.endpc = load_int(S);
+    emit(S, &lv, sizeof(lv));
+  }
+
+  f.sizeupvalues = load_int(S);
+  emit_align(S, sizeof(TString *));
+  f.upvalues = f.sizeupvalues ? here(S) : NULL;
+  for (i = 0; i < f.sizeupvalues; i++) {
+    TString *ts = load_ref(S);
+    emit(S, &ts, sizeof(ts));
+  }
+
+  f.tt = LUA_TPROTO;
+  f.marked = bitmask(FIXEDBIT);
+  proto_readonly(&f);
+  emit_align(S, __alignof__(Proto));
+  {
+    Proto *p = here(S);
+    emit(S, &f, sizeof(f));
+    return p;
+  }
+}
+
+/* the image, past its signature */
+static lu_int32 load_image (LoadState *S, FlashHeader *h) {
+  char reserved[3];
+  lu_int32 i;
+
+  if (load_byte(S) != LFS_VERSION)
+    error(S, "unsupported image version");
+  load_block(S, reserved, 3);
+
+  new_strt(S, load_u32(S));
+  h->nmodules = load_u32(S);
+  if (S->nstrings > LUA_FLASH_STORE / sizeof(TString) ||
+      h->nmodules > LUA_FLASH_STORE / sizeof(Proto))
+    error(S, "bad image header");
+  load_strings(S);
+  emit_strt(S, h);
+
+  S->modules = alloc(S, S->modules, h->nmodules * sizeof(FlashModule));
+  c_memset(S->modules, 0, h->nmodules * sizeof(FlashModule));
+  for (i = 0; i < h->nmodules; i++) {
+    S->modules[i].name = load_ref(S);
+    if (S->modules[i].name == NULL)
+      error(S, "bad module name");
+    S->modules[i].p = load_function(S, 0);
+  }
+  return emit_header(S, h);
+}
+
+
+/* compiled Lua files */
+
+static void open_file (LoadState *S, int i) {
+  if (S->fd)
+    vfs_close(S->fd);
+  S->inpos = S->inlen = 0;
+  S->fd = vfs_open(S->files[i], "r");
+  if (!S->fd)
+    error(S, "cannot open file");
+}
+
+/* the module of dir/name.lc is name */
+static const char *module_name (const char *file, lu_int32 *l) {
+  const char *s = c_strrchr(file, '/');
+  const char *e;
+  s = s ? s + 1 : file;
+  e = c_strrchr(s, '.');
+  *l = e ? e - s : c_strlen(s);
+  return s;
+}
+
+/*
+** Each file is copied as is, 4-byte aligned, as lundump's direct mode reads
+** code in place; only its name is added to the string table. The bytecode
+** has to be in this build's native format, like node.compile() writes it.
+*/
+static lu_int32 load_chunks (LoadState *S, FlashHeader *h) {
+  char hdr[LUAC_HEADERSIZE], native[LUAC_HEADERSIZE];
+  int i, j;
+
+  new_strt(S, S->nfiles);
+  for (i = 0; i < S->nfiles; i++) {
+    lu_int32 l, lj;
+    const char *name = module_name(S->files[i], &l);
+    for (j = 0; j < i; j++) {
+      const char *namej = module_name(S->files[j], &lj);
+      if (l == lj && c_memcmp(name, namej, l) == 0)
+        error(S, "module name used twice");
+    }
+    if (l >= S->sizebuf) {
+      S->buf = alloc(S, S->buf, l + 1);
+      S->sizebuf = l + 1;
+    }
+    c_memcpy(S->buf, name, l);
+    S->buf[l] = '\0';
+    S->strings[i] = emit_string(S, S->buf, l);
+  }
+  emit_strt(S, h);
+
+  h->nmodules = S->nfiles;
+  S->modules = alloc(S, S->modules, h->nmodules * sizeof(FlashModule));
+  c_memset(S->modules, 0, h->nmodules * sizeof(FlashModule));
+  luaU_header(native);
+  for (i = 0; i < S->nfiles; i++) {
+    lu_int32 start;
+    open_file(S, i);
+    load_block(S, hdr, LUAC_HEADERSIZE);
+    if (c_memcmp(hdr, native, LUAC_HEADERSIZE) != 0)
+      error(S, "not bytecode of this build");
+    emit_align(S, sizeof(Instruction));
+    start = S->used;
+    S->modules[i].name = S->strings[i];
+    S->modules[i].chunk = here(S);
+    emit(S, hdr, LUAC_HEADERSIZE);
+    copy_rest(S);
+    S->modules[i].sizechunk = S->used - start;
+  }
+  return emit_header(S, h);
+}
+
+/* one pass over the input; returns the bytes used in the store */
+static lu_int32 load_store (LoadState *S) {
+  FlashHeader h;
+  char sig[sizeof(LFS_SIGNATURE) - 1];
+
+  S->used = S->flushed = 0;
+  c_memset(&h, 0xff, sizeof(h));
+  emit(S, &h, sizeof(h));  /* left erased: programmed once the rest is */
+  c_memset(&h, 0, sizeof(h));
+
+  open_file(S, 0);
+  load_block(S, sig, sizeof(sig));
+  if (c_memcmp(sig, LFS_SIGNATURE, sizeof(sig)) == 0) {
+    if (S->nfiles != 1)
+      error(S, "an image is loaded on its own");
+    return load_image(S, &h);
+  }
+  if (c_memcmp(sig, LUA_SIGNATURE, sizeof(sig)) == 0)
+    return load_chunks(S, &h);
+  error(S, "not a flash image or compiled Lua file");
+  return 0;
+}
+
+/*
+** Replaces the contents of the store with the image in files[0], or with the
+** n compiled Lua files in `files'. Returns NULL on success or the reason for
+** failure. The store is only erased once
+** the image has been validated, and `erased' tells the caller whether that
+** happened: from then on the running Lua state may refer to objects that are
+** gone, so it has to be closed (on the chip: restart) before running more
+** Lua, whether or not the reload succeeded.
+*/
+const char *luaN_reload (const char *const *files, int n, int *erased) {
+  LoadState *S = c_malloc(sizeof(LoadState));
+  const char *status = NULL;
+  lu_int32 sector, last;
+  *erased = 0;
+  if (S == NULL)
+    return "not enough memory";
+  c_memset(S, 0, sizeof(*S));
+  S->phys = platform_flash_mapped2phys(cast(lu_int32, lua_flash_store));
+  S->files = files;
+  S->nfiles = n;
+  if (setjmp(S->jmp) == 0) {
+    if (n < 1)
+      error(S, "nothing to load");
+    S->dryrun = 1;
+    load_store(S);
+    S->dryrun = 0;
+    fh = NULL;  /* the old contents are gone from here on */
+    *erased = 1;
+    sector = platform_flash_get_sector_of_address(S->phys);
+    last = sector + LUA_FLASH_STORE / INTERNAL_FLASH_SECTOR_SIZE;
+    for (; sector < last; sector++)
+      if (platform_flash_erase_sector(sector) != PLATFORM_OK)
+        error(S, "flash erase failed");
+    load_store(S);
+  }
+  else
+    status = S->error;
+  if (S->fd)
+    vfs_close(S->fd);
+  c_free(S->strings);
+  c_free(S->strt);
+  c_free(S->buf);
+  c_free(S->pstack);
+  c_free(S->modules);
+  c_free(S);
+  return status;
+}
+
+#endif
@@ -0,0 +1,50 @@
+/*
+** Lua flash store: protos and strings executed in place from flash
+** See Copyright Notice in lua.h
+*/
+
+#ifndef lflash_h
+#define lflash_h
+
+#include "lobject.h"
+
+/*
+** Image format written by luac.cross -f and read by luaN_reload. All
+** integers are 32-bit little endian and numbers are little endian IEEE
+** doubles, so one image serves every target; the native layout is only
+** materialized when the image is loaded into the store.
+**
+**   header   LFS_SIGNATURE, version byte, 3 reserved bytes,
+**            u32 nstrings, u32 nmodules
+**   strings  nstrings * (u32 len, len bytes)
+**   modules  nmodules * (u32 name, function)
+**   function u32 source, u32 linedefined, u32 lastlinedefined,
+**            u8 nups, u8 numparams, u8 is_vararg, u8 maxstacksize,
+**            u32 sizecode, sizecode * u32 instruction,
+**            u32 sizek, sizek * (u8 type, value),
+**            u32 sizep, sizep * function,
+**            u32 sizelineinfo, sizelineinfo bytes of packed line info,
+**            u32 sizelocvars, sizelocvars * (u32 name, u32 startpc, u32 endpc),
+**            u32 sizeupvalues, sizeupvalues * u32 name
+**
+** Strings (module names included) are referred to as their index in the
+** string list plus one, 0 standing for none.
+**
+** luaN_reload also takes compiled Lua files in this build's native format,
+** which are stored as they are and undumped in direct mode when required.
+*/
+#define LFS_SIGNATURE	"\033LFS"
+#define LFS_VERSION	1
+
+#ifdef LUA_FLASH_STORE
+
+LUAI_FUNC void luaN_init (lua_State *L);
+LUAI_FUNC TString *luaN_findstring (const char *str, size_t l, unsigned int h);
+LUAI_FUNC int luaN_pushmodule (lua_State *L, const char *name);
+LUAI_FUNC const char *luaN_reload (const char *const *files, int n,
+                                  int *erased);
+LUAI_FUNC int luaN_index (lua_State *L);
+
+#endif
+
+#endif
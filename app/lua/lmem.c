@@ -10,9 +10,11 @@
 #define LUAC_CROSS_FILE
 
 #include "lua.h"
+#include C_HEADER_STRING
 
 #include "ldebug.h"
 #include "ldo.h"
+#include "lgc.h"
 #include "lmem.h"
 #include "lobject.h"
 #include "lstate.h"
@@ -69,12 +71,182 @@ void *luaM_toobig (lua_State *L) {
 
 
 
+#if defined(LUA_MEMPROFILE) && !defined(LUA_CROSS_COMPILER)
+/*
+** Allocation profile. While it runs, every allocation or resize is counted
+** as it is asked for, with its size, by size and by the line of the innermost
+** active Lua function, so that what a C function allocates counts against
+** the Lua line which called it. Sites are kept in a small open hash; their
+** source strings are kept alive by the same slots of a table anchored in the
+** registry, which is cleared with the counts.
+*/
+
+#define PROF_SIZES	9	/* up to 8, 16, .. 1024 bytes, and larger */
+#define PROF_SITES	64	/* a quarter is left free to keep probes short */
+#define PROF_NOLUA	(-1)	/* line of the site without a Lua function */
+
+typedef struct ProfSite {
+  TString *source;
+  int line;
+  lu_int32 allocs, bytes;
+} ProfSite;
+
+static struct {
+  ProfSite *sites;  /* NULL when not running */
+  int nsites;
+  lu_int32 allocs[PROF_SIZES], bytes[PROF_SIZES];
+  lu_int32 largest;
+  lu_int32 other_allocs, other_bytes;  /* sites beyond the table */
+  Table *sources;  /* registry[&prof], holds the source of sites[i] at i */
+} prof;
+
+
+static void prof_record (lua_State *L, size_t size) {
+  CallInfo *ci;
+  TString *source = NULL;
+  int line = PROF_NOLUA;
+  unsigned int h, b;
+  ProfSite *s;
+  for (b = 0; b < PROF_SIZES - 1 && size > (8u << b); b++) ;
+  prof.allocs[b]++;
+  prof.bytes[b] += size;
+  if (b == PROF_SIZES - 1 && size > prof.largest)
+    prof.largest = size;
+  for (ci = L->ci; ci > L->base_ci; ci--) {
+    if (isLua(ci)) {
+      Proto *p = ci_func(ci)->l.p;
+      int pc = pcRel(ci == L->ci ? L->savedpc : ci->savedpc, p);
+      source = p->source;
+      line = pc < 0 ? 0 : getline(p, pc);  /* not started yet */
+      break;
+    }
+  }
+  h = (IntPoint(source) ^ cast(unsigned int, line) * 0x9E3779B1u) % PROF_SITES;
+  for (s = prof.sites + h; s->allocs; s = prof.sites + h) {
+    if (s->source == source && s->line == line)
+      goto found;
+    h = (h + 1) % PROF_SITES;
+  }
+  if (prof.nsites >= PROF_SITES - PROF_SITES / 4) {
+    prof.other_allocs++;
+    prof.other_bytes += size;
+    return;
+  }
+  prof.nsites++;
+  s->source = source;
+  s->line = line;
+  if (source != NULL) {  /* no allocation here: the array is presized */
+    TValue *o = &prof.sources->array[h];
+    setsvalue(L, o, source);
+    luaC_barriert(L, prof.sources, o);
+  }
+found:
+  s->allocs++;
+  s->bytes += size;
+}
+
+
+static void prof_reset (ProfSite *sites) {
+  int i;
+  for (i = 0; i < PROF_SITES; i++)
+    setnilvalue(&prof.sources->array[i]);
+  c_memset(sites, 0, PROF_SITES * sizeof(ProfSite));
+  c_memset(prof.allocs, 0, sizeof(prof.allocs));
+  c_memset(prof.bytes, 0, sizeof(prof.bytes));
+  prof.nsites = 0;
+  prof.largest = prof.other_allocs = prof.other_bytes = 0;
+}
+
+
+static void prof_pushcounts (lua_State *L, lu_int32 allocs, lu_int32 bytes) {
+  lua_createtable(L, 0, 2);
+  lua_pushinteger(L, allocs);
+  lua_setfield(L, -2, "allocs");
+  lua_pushinteger(L, bytes);
+  lua_setfield(L, -2, "bytes");
+}
+
+
+static void prof_push (lua_State *L, ProfSite *sites) {
+  char buff[LUA_IDSIZE];
+  int i;
+  lua_createtable(L, PROF_SIZES, 0);
+  for (i = 0; i < PROF_SIZES; i++) {
+    prof_pushcounts(L, prof.allocs[i], prof.bytes[i]);
+    lua_pushinteger(L, i < PROF_SIZES - 1 ? 8 << i : prof.largest);
+    lua_setfield(L, -2, "size");
+    lua_rawseti(L, -2, i + 1);
+  }
+  lua_createtable(L, 0, prof.nsites);
+  for (i = 0; i < PROF_SITES; i++) {
+    ProfSite *s = sites + i;
+    if (s->allocs == 0)
+      continue;
+    if (s->line == PROF_NOLUA)
+      lua_pushliteral(L, "[C]");
+    else {
+      luaO_chunkid(buff, s->source ? getstr(s->source) : "=?", LUA_IDSIZE);
+      lua_pushfstring(L, "%s:%d", buff, s->line);
+    }
+    prof_pushcounts(L, s->allocs, s->bytes);
+    lua_rawset(L, -3);
+  }
+  if (prof.other_allocs) {
+    prof_pushcounts(L, prof.other_allocs, prof.other_bytes);
+    lua_setfield(L, -2, "[other]");
+  }
+}
+
+
+/* Lua: node.memprofile(true)     -- start, or reset the counts
+**      sizes, sites = node.memprofile()
+**      sizes, sites = node.memprofile(false)  -- stop */
+int luaM_memprofile (lua_State *L) {
+  ProfSite *sites = prof.sites;
+  int stop = !lua_isnoneornil(L, 1);
+  if (lua_toboolean(L, 1)) {
+    prof.sites = NULL;
+    if (sites == NULL) {  /* anchored first, so that nothing leaks if it fails */
+      lua_pushlightuserdata(L, &prof);
+      lua_createtable(L, PROF_SITES, 0);
+      prof.sources = hvalue(L->top - 1);
+      lua_rawset(L, LUA_REGISTRYINDEX);
+      sites = luaM_newvector(L, PROF_SITES, ProfSite);
+    }
+    prof_reset(sites);
+    prof.sites = sites;
+    return 0;
+  }
+  if (sites == NULL)
+    return 0;
+  prof.sites = NULL;  /* the snapshot itself is not counted */
+  prof_push(L, sites);
+  if (stop) {
+    luaM_freearray(L, sites, PROF_SITES, ProfSite);
+    lua_pushlightuserdata(L, &prof);
+    lua_pushnil(L);
+    lua_rawset(L, LUA_REGISTRYINDEX);
+    prof.sources = NULL;
+  }
+  else
+    prof.sites = sites;
+  return 2;
+}
+#define prof_running(nsize)	(prof.sites != NULL && (nsize) > 0)
+#else
+#define prof_running(nsize)	0
+#define prof_record(L,nsize)	((void)0)
+#endif
+
+
 /*
 ** generic allocation routine.
 */
 void *luaM_realloc_ (lua_State *L, void *block, size_t osize, size_t nsize) {
   global_State *g = G(L);
   lua_assert((osize == 0) == (block == NULL));
+  if (prof_running(nsize))  /* before the stack or CallInfo array can move */
+    prof_record(L, nsize);
   block = (*g->frealloc)(g->ud, block, osize, nsize);
   if (block == NULL && nsize > 0)
     luaD_throw(L, LUA_ERRMEM);
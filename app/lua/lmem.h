@@ -48,6 +48,9 @@ LUAI_FUNC void *luaM_toobig (lua_State *L);
 LUAI_FUNC void *luaM_growaux_ (lua_State *L, void *block, int *size,
                                size_t size_elem, int limit,
                                const char *errormsg);
+#if defined(LUA_MEMPROFILE) && !defined(LUA_CROSS_COMPILER)
+LUAI_FUNC int luaM_memprofile (lua_State *L);
+#endif
 
 #endif
 
@@ -25,6 +25,7 @@
 #include "lauxlib.h"
 #include "lualib.h"
 #include "lrotable.h"
+#include "lflash.h"
 
 /* prefix for open functions in C libraries */
 #define LUA_POF		"luaopen_"
@@ -458,6 +459,16 @@ static int loader_preload (lua_State *L) {
 }
 
 
+#ifdef LUA_FLASH_STORE
+static int loader_flash (lua_State *L) {
+  const char *name = luaL_checkstring(L, 1);
+  if (!luaN_pushmodule(L, name))  /* not found? */
+    lua_pushfstring(L, "\n\tno module " LUA_QS " in the flash store", name);
+  return 1;
+}
+#endif
+
+
 static const int sentinel_ = 0;
 #define sentinel	((void *)&sentinel_)
 
@@ -643,7 +654,11 @@ static const luaL_Reg ll_funcs[] = {
 
 
 static const lua_CFunction loaders[] =
-  {loader_preload, loader_Lua, loader_C, loader_Croot, NULL};
+  {loader_preload,
+#ifdef LUA_FLASH_STORE
+   loader_flash,
+#endif
+   loader_Lua, loader_C, loader_Croot, NULL};
 
 #if LUA_OPTIMIZE_MEMORY > 0
 #undef MIN_OPT_LEVEL
@@ -34,6 +34,15 @@
 #define LUA_TUPVAL	(LAST_TAG+2)
 #define LUA_TDEADKEY	(LAST_TAG+3)
 
+#ifdef LUA_NUMBER_DUAL
+/*
+** Tag of numbers held as int, see LUA_NUMBER_DUAL in luaconf.h. Only the
+** tt of a TValue carries it; ttype() masks it off so that the rest of the
+** core sees LUA_TNUMBER.
+*/
+#define LUA_TNUMINT	(LUA_TNUMBER|16)
+#endif
+
 
 /*
 ** Union of all collectable objects
@@ -83,6 +92,7 @@ typedef union {
   void *p;
   lua_Number n;
   int b;
+  int i;
 } Value;
 #endif // #if defined( LUA_PACK_VALUE ) && defined( ELUA_ENDIAN_BIG )
 
@@ -135,17 +145,17 @@ typedef TValuefields TValue;
 
 /* Macros to test type */
 #ifndef LUA_PACK_VALUE
-#define ttisnil(o)	(ttype(o) == LUA_TNIL)
+#define ttisnil(o)	((o)->tt == LUA_TNIL)
 #define ttisnumber(o)	(ttype(o) == LUA_TNUMBER)
-#define ttisstring(o)	(ttype(o) == LUA_TSTRING)
-#define ttistable(o)	(ttype(o) == LUA_TTABLE)
-#define ttisfunction(o)	(ttype(o) == LUA_TFUNCTION)
-#define ttisboolean(o)	(ttype(o) == LUA_TBOOLEAN)
-#define ttisuserdata(o)	(ttype(o) == LUA_TUSERDATA)
-#define ttisthread(o)	(ttype(o) == LUA_TTHREAD)
-#define ttislightuserdata(o)	(ttype(o) == LUA_TLIGHTUSERDATA)
-#define ttisrotable(o) (ttype(o) == LUA_TROTABLE)
-#define ttislightfunction(o)  (ttype(o) == LUA_TLIGHTFUNCTION)
+#define ttisstring(o)	((o)->tt == LUA_TSTRING)
+#define ttistable(o)	((o)->tt == LUA_TTABLE)
+#define ttisfunction(o)	((o)->tt == LUA_TFUNCTION)
+#define ttisboolean(o)	((o)->tt == LUA_TBOOLEAN)
+#define ttisuserdata(o)	((o)->tt == LUA_TUSERDATA)
+#define ttisthread(o)	((o)->tt == LUA_TTHREAD)
+#define ttislightuserdata(o)	((o)->tt == LUA_TLIGHTUSERDATA)
+#define ttisrotable(o) ((o)->tt == LUA_TROTABLE)
+#define ttislightfunction(o)  ((o)->tt == LUA_TLIGHTFUNCTION)
 #else // #ifndef LUA_PACK_VALUE
 #define ttisnil(o) (ttype_sig(o) == add_sig(LUA_TNIL))
 #define ttisnumber(o)  ((o)->_t.sig != LUA_NOTNUMBER_SIG)
@@ -161,7 +171,9 @@ typedef TValuefields TValue;
 #endif // #ifndef LUA_PACK_VALUE
 
 /* Macros to access values */
-#ifndef LUA_PACK_VALUE
+#if defined LUA_NUMBER_DUAL
+#define ttype(o)	((o)->tt & 15)
+#elif !defined LUA_PACK_VALUE
 #define ttype(o)	((o)->tt)
 #else // #ifndef LUA_PACK_VALUE
 #define ttype(o)	((o)->_t.sig == LUA_NOTNUMBER_SIG ? (o)->_t.tt : LUA_TNUMBER)
@@ -171,7 +183,16 @@ typedef TValuefields TValue;
 #define pvalue(o)	check_exp(ttislightuserdata(o), (o)->value.p)
 #define rvalue(o)	check_exp(ttisrotable(o), (o)->value.p)
 #define fvalue(o) check_exp(ttislightfunction(o), (o)->value.p)
+#ifdef LUA_NUMBER_DUAL
+#define ttisint(o)	((o)->tt == LUA_TNUMINT)
+#define ivalue(o)	check_exp(ttisint(o), (o)->value.i)
+#define nvalue(o)	check_exp(ttisnumber(o), \
+			  ttisint(o) ? cast_num((o)->value.i) : (o)->value.n)
+#else
+#define ttisint(o)	0
+#define ivalue(o)	cast_int(nvalue(o))
 #define nvalue(o)	check_exp(ttisnumber(o), (o)->value.n)
+#endif
 #define rawtsvalue(o)	check_exp(ttisstring(o), &(o)->value.gc->ts)
 #define tsvalue(o)	(&rawtsvalue(o)->tsv)
 #define rawuvalue(o)	check_exp(ttisuserdata(o), &(o)->value.gc->u)
@@ -209,6 +230,22 @@ typedef TValuefields TValue;
 #define setnvalue(obj,x) \
   { lua_Number i_x = (x); TValue *i_o=(obj); i_o->value.n=i_x; i_o->tt=LUA_TNUMBER; }
 
+#ifdef LUA_NUMBER_DUAL
+#define setivalue(obj,x) \
+  { int i_x = (x); TValue *i_o=(obj); i_o->value.i=i_x; i_o->tt=LUA_TNUMINT; }
+
+/* stores x as int if that holds it exactly, -0 stays a double */
+#define setnumvalue(obj,x) \
+  { lua_Number n_x = (x); TValue *n_o=(obj); int n_i; \
+    lua_number2int(n_i, n_x); \
+    if (luai_numeq(cast_num(n_i), n_x) && (n_i != 0 || 1/n_x > 0)) \
+      { n_o->value.i=n_i; n_o->tt=LUA_TNUMINT; } \
+    else { n_o->value.n=n_x; n_o->tt=LUA_TNUMBER; } }
+#else
+#define setivalue(obj,x)	setnvalue(obj, cast_num(x))
+#define setnumvalue(obj,x)	setnvalue(obj,x)
+#endif
+
 #define setpvalue(obj,x) \
   { void *i_x = (x); TValue *i_o=(obj); i_o->value.p=i_x; i_o->tt=LUA_TLIGHTUSERDATA; }
 
@@ -341,7 +378,7 @@ typedef TValuefields TValue;
 #define setsvalue2n	setsvalue
 
 #ifndef LUA_PACK_VALUE
-#define setttype(obj, tt) (ttype(obj) = (tt))
+#define setttype(obj, _tt) ((obj)->tt = (_tt))
 #else // #ifndef LUA_PACK_VALUE
 /* considering it used only in lgc to set LUA_TDEADKEY */
 /* we could define it this way */
@@ -362,6 +399,7 @@ typedef union TString {
   L_Umaxalign dummy;  /* ensures maximum alignment for strings */
   struct {
     CommonHeader;
+    lu_byte uninterned;  /* long string, not in the string table */
     unsigned int hash;
     size_t len;
   } tsv;
@@ -7,25 +7,71 @@
 #include "lauxlib.h"
 #include "lstring.h"
 #include "lobject.h"
+#include "lstate.h"
 #include "lapi.h"
 
 /* Local defines */
 #define LUAR_FINDFUNCTION     0
 #define LUAR_FINDVALUE        1
 
+/* Lookaside cache geometry: LUAR_CACHE_LINES must be a power of 2 */
+#ifndef LUAR_CACHE_LINES
+#define LUAR_CACHE_LINES      32
+#endif
+#ifndef LUAR_CACHE_SLOTS
+#define LUAR_CACHE_SLOTS      2
+#endif
+
 /* Externally defined read-only table array */
 extern const luaR_table lua_rotable[];
 
+/* 
+** Every keyed access to a rotable field (e.g. "gpio.write") would normally
+** do a linear scan of the entry list with a string compare per entry. 
+** String keys coming from the VM are interned TStrings, so a small
+** N-way lookaside cache keyed by (rotable, TString) lets repeated lookups
+** of the same field resolve with two pointer compares. A cached TString
+** is only guaranteed to stay at its address until it is collected, so
+** the cache is flushed by the collector at the start of every sweep 
+** (see atomic() in lgc.c) and when a state is opened or closed. 
+** The firmware only ever runs a single Lua state, so one cache is kept
+** per image rather than per global_State.
+*/
+typedef struct {
+  const luaR_entry *ptable;
+  const TString *key;
+  unsigned pos;
+} luaR_cacheline;
+
+static luaR_cacheline luaR_cache[LUAR_CACHE_LINES][LUAR_CACHE_SLOTS];
+
+#define luaR_cachehash(t, k) \
+  ((((size_t)(t) >> 3) ^ (k)->tsv.hash) & (LUAR_CACHE_LINES - 1))
+
+/* Remember that "key" lives at "pos" in "ptable", most recent first */
+static void luaR_cacheput(const luaR_entry *ptable, const TString *key, unsigned pos) {
+  luaR_cacheline *line = luaR_cache[luaR_cachehash(ptable, key)];
+  unsigned i;
+
+  for (i = LUAR_CACHE_SLOTS - 1; i > 0; i --)
+    line[i] = line[i - 1];
+  line[0].ptable = ptable;
+  line[0].key = key;
+  line[0].pos = pos;
+}
+
 /* Find a global "read only table" in the constant lua_rotable array */
 void* luaR_findglobal(const char *name, unsigned len) {
   unsigned i;
 
-  if (c_strlen(name) > LUA_MAX_ROTABLE_NAME)
+  if (len > LUA_MAX_ROTABLE_NAME)
     return NULL;
-  for (i=0; lua_rotable[i].name; i ++)
-    if (*lua_rotable[i].name != '\0' && c_strlen(lua_rotable[i].name) == len && !c_strncmp(lua_rotable[i].name, name, len)) {
+  for (i=0; lua_rotable[i].name; i ++) {
+    const char *rname = lua_rotable[i].name;
+    if (*rname == *name && !c_strncmp(rname, name, len) && rname[len] == '\0') {
       return (void*)(lua_rotable[i].pentries);
     }
+  }
   return NULL;
 }
 
@@ -37,7 +83,8 @@ static const TValue* luaR_auxfind(const luaR_entry *pentry, const char *strkey,
   if (pentry == NULL)
     return NULL;  
   while(pentry->key.type != LUA_TNIL) {
-    if ((strkey && (pentry->key.type == LUA_TSTRING) && (!c_strcmp(pentry->key.id.strkey, strkey))) || 
+    if ((strkey && (pentry->key.type == LUA_TSTRING) && 
+         *pentry->key.id.strkey == *strkey && (!c_strcmp(pentry->key.id.strkey, strkey))) || 
         (!strkey && (pentry->key.type == LUA_TNUMBER) && ((luaR_numkey)pentry->key.id.numkey == numkey))) {
       res = &pentry->value;
       break;
@@ -51,9 +98,9 @@ static const TValue* luaR_auxfind(const luaR_entry *pentry, const char *strkey,
 
 int luaR_findfunction(lua_State *L, const luaR_entry *ptable) {
   const TValue *res = NULL;
-  const char *key = luaL_checkstring(L, 2);
-    
-  res = luaR_auxfind(ptable, key, 0, NULL);  
+  
+  luaL_checkstring(L, 2);  /* also coerces a number key to a string in place */
+  res = luaR_findentrystr((void*)ptable, rawtsvalue(L->base + 1), NULL);
   if (res && ttislightfunction(res)) {
     luaA_pushobject(L, res);
     return 1;
@@ -69,6 +116,40 @@ const TValue* luaR_findentry(void *data, const char *strkey, luaR_numkey numkey,
   return luaR_auxfind((const luaR_entry*)data, strkey, numkey, ppos);
 }
 
+/* Same as luaR_findentry but for an interned string key, going through
+   the lookaside cache first */
+const TValue* luaR_findentrystr(void *data, const TString *key, unsigned *ppos) {
+  const luaR_entry *ptable = (const luaR_entry*)data;
+  luaR_cacheline *line;
+  const TValue *res;
+  char strkey[LUA_MAX_ROTABLE_NAME + 1];
+  unsigned i, pos;
+
+  if (ptable == NULL)
+    return NULL;
+  line = luaR_cache[luaR_cachehash(ptable, key)];
+  for (i = 0; i < LUAR_CACHE_SLOTS; i ++)
+    if (line[i].key == key && line[i].ptable == ptable) {
+      pos = line[i].pos;
+      if (ppos)
+        *ppos = pos;
+      return &ptable[pos].value;
+    }
+  /* Not cached: do the linear scan and remember the result */
+  luaR_getcstr(strkey, key, sizeof(strkey));
+  if ((res = luaR_auxfind(ptable, strkey, 0, &pos)) == NULL)
+    return NULL;
+  luaR_cacheput(ptable, key, pos);
+  if (ppos)
+    *ppos = pos;
+  return res;
+}
+
+/* Forget all cached lookups; must be called before any TString can be freed */
+void luaR_flushcache(void) {
+  c_memset(luaR_cache, 0, sizeof(luaR_cache));
+}
+
 /* Find the metatable of a given table */
 void* luaR_getmeta(void *data) {
 #ifdef LUA_META_ROTABLES
@@ -79,36 +160,65 @@ void* luaR_getmeta(void *data) {
 #endif
 }
 
+/*
+** The position of the numeric key returned by the last luaR_next call.
+** String keys handed out by luaR_next are put in the lookaside cache
+** instead, so either way the following call resumes from the returned
+** position without rescanning the table.
+*/
+static struct {
+  const luaR_entry *ptable;
+  luaR_numkey numkey;
+  unsigned pos;
+} luaR_nexthint;
+
+/* Position of the last entry, so that an unknown key ends the iteration */
+static unsigned luaR_lastpos(const luaR_entry *pentries) {
+  unsigned pos = 0;
+  while (pentries[pos].key.type != LUA_TNIL)
+    pos ++;
+  return pos - 1;
+}
+
 static void luaR_next_helper(lua_State *L, const luaR_entry *pentries, int pos, TValue *key, TValue *val) {
   setnilvalue(key);
   setnilvalue(val);
   if (pentries[pos].key.type != LUA_TNIL) {
     /* Found an entry */
-    if (pentries[pos].key.type == LUA_TSTRING)
-      setsvalue(L, key, luaS_newro(L, pentries[pos].key.id.strkey))
-    else
-      setnvalue(key, (lua_Number)pentries[pos].key.id.numkey)
-   setobj2s(L, val, &pentries[pos].value);
+    if (pentries[pos].key.type == LUA_TSTRING) {
+      TString *ts = luaS_newro(L, pentries[pos].key.id.strkey);
+      setsvalue(L, key, ts);
+      luaR_cacheput(pentries, ts, pos);
+    } else {
+      setivalue(key, pentries[pos].key.id.numkey);
+      luaR_nexthint.ptable = pentries;
+      luaR_nexthint.numkey = pentries[pos].key.id.numkey;
+      luaR_nexthint.pos = pos;
+    }
+    setobj2s(L, val, &pentries[pos].value);
   }
 }
 /* next (used for iteration) */
 void luaR_next(lua_State *L, void *data, TValue *key, TValue *val) {
   const luaR_entry* pentries = (const luaR_entry*)data;
-  char strkey[LUA_MAX_ROTABLE_NAME + 1], *pstrkey = NULL;
-  luaR_numkey numkey = 0;
+  luaR_numkey numkey;
   unsigned keypos;
   
   /* Special case: if key is nil, return the first element of the rotable */
   if (ttisnil(key)) 
     luaR_next_helper(L, pentries, 0, key, val);
   else if (ttisstring(key) || ttisnumber(key)) {
-    /* Find the previoud key again */  
+    /* Find the previous key again */  
     if (ttisstring(key)) {
-      luaR_getcstr(strkey, rawtsvalue(key), LUA_MAX_ROTABLE_NAME);          
-      pstrkey = strkey;
-    } else   
+      if (!luaR_findentrystr(data, rawtsvalue(key), &keypos))
+        keypos = luaR_lastpos(pentries);
+    } else {
       numkey = (luaR_numkey)nvalue(key);
-    luaR_findentry(data, pstrkey, numkey, &keypos);
+      if (luaR_nexthint.ptable == pentries && luaR_nexthint.numkey == numkey)
+        keypos = luaR_nexthint.pos;
+      else if (!luaR_findentry(data, NULL, numkey, &keypos))
+        keypos = luaR_lastpos(pentries);
+    }
     /* Advance to next key */
     keypos ++;    
     luaR_next_helper(L, pentries, keypos, key, val);
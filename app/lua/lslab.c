@@ -0,0 +1,184 @@
+// Lua slab allocator: small objects in pages of equal sized slots
+//
+// l_alloc serves requests of up to LSLAB_MAX bytes from here. Every size
+// class has its own pages, so strings, table nodes, closures and upvalues
+// which come and go do not leave holes between the larger blocks of the SDK
+// heap. A page which empties goes back to the heap, except for one spare per
+// class which is kept against churn at a page boundary.
+
+#include "lslab.h"
+#include "c_stdlib.h"
+#include "c_string.h"
+
+typedef struct Page Page;
+struct Page {
+  Page *next, *prev;    // pages of the class with free slots
+  void *free;           // free slots, linked through their first word
+  unsigned short used;  // slots handed out
+  unsigned char cls;    // size class
+};
+
+#define PAGE_HDR  ((sizeof(Page) + LSLAB_GRAIN - 1) & ~(LSLAB_GRAIN - 1))
+#define cls_size(cls)  (((cls) + 1) * LSLAB_GRAIN)
+#define cls_slots(cls) ((LSLAB_PAGE - PAGE_HDR) / cls_size(cls))
+
+static Page *partial[LSLAB_CLASSES];   // pages with free slots
+static Page *spare[LSLAB_CLASSES];     // empty page kept per class
+static unsigned npages[LSLAB_CLASSES];
+static unsigned nused[LSLAB_CLASSES];
+
+// all pages, sorted by address, to tell slab blocks from heap blocks
+static Page **pages;
+static unsigned npage, maxpage;
+
+
+// index of the last page starting at or below p
+static int page_index( const void *p ) {
+  int lo = 0, hi = (int)npage - 1;
+  while (lo < hi) {
+    int mid = (lo + hi + 1) / 2;
+    if ((const char *)pages[mid] <= (const char *)p)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+  return lo;
+}
+
+static Page *find_page( const void *p ) {
+  Page *pg;
+  if (npage == 0 || (const char *)p < (const char *)pages[0])
+    return NULL;
+  pg = pages[page_index( p )];
+  return (const char *)p < (const char *)pg + LSLAB_PAGE ? pg : NULL;
+}
+
+static void link_page( Page *pg ) {
+  Page **head = &partial[pg->cls];
+  pg->prev = NULL;
+  pg->next = *head;
+  if (*head)
+    (*head)->prev = pg;
+  *head = pg;
+}
+
+static void unlink_page( Page *pg ) {
+  if (pg->prev)
+    pg->prev->next = pg->next;
+  else
+    partial[pg->cls] = pg->next;
+  if (pg->next)
+    pg->next->prev = pg->prev;
+}
+
+static Page *new_page( int cls ) {
+  Page *pg;
+  char *slot;
+  unsigned i, n = cls_slots( cls ), size = cls_size( cls );
+  int at;
+
+  if (npage == maxpage) {
+    unsigned max = maxpage ? 2 * maxpage : 8;
+    Page **p = (Page **)c_realloc( pages, max * sizeof(Page *) );
+    if (!p)
+      return NULL;
+    pages = p;
+    maxpage = max;
+  }
+  if (!(pg = (Page *)c_malloc( LSLAB_PAGE )))
+    return NULL;
+
+  at = (npage && (const char *)pages[0] < (const char *)pg) ? page_index( pg ) + 1 : 0;
+  c_memmove( pages + at + 1, pages + at, (npage - at) * sizeof(Page *) );
+  pages[at] = pg;
+  npage++;
+
+  pg->used = 0;
+  pg->cls = cls;
+  slot = (char *)pg + PAGE_HDR;
+  pg->free = slot;
+  for (i = 1; i < n; i++, slot += size)
+    *(void **)slot = slot + size;
+  *(void **)slot = NULL;
+  npages[cls]++;
+  link_page( pg );
+  return pg;
+}
+
+static void release_page( Page *pg ) {
+  int at = page_index( pg );
+  unlink_page( pg );
+  c_memmove( pages + at, pages + at + 1, (npage - at - 1) * sizeof(Page *) );
+  npage--;
+  npages[pg->cls]--;
+  c_free( pg );
+}
+
+
+// a slot of at least size bytes, NULL if size is too large or there is no
+// memory for a new page
+void *lslab_alloc( size_t size ) {
+  int cls;
+  Page *pg;
+  void *p;
+
+  if (size == 0 || size > LSLAB_MAX)
+    return NULL;
+  cls = (size - 1) / LSLAB_GRAIN;
+  if (!(pg = partial[cls]) && !(pg = new_page( cls )))
+    return NULL;
+  p = pg->free;
+  pg->free = *(void **)p;
+  if (pg->used++ == 0 && spare[cls] == pg)
+    spare[cls] = NULL;
+  if (!pg->free)
+    unlink_page( pg );  // full
+  nused[cls]++;
+  return p;
+}
+
+// slot size of p, 0 if p is not from a slab
+size_t lslab_size( const void *p ) {
+  Page *pg = find_page( p );
+  return pg ? cls_size( pg->cls ) : 0;
+}
+
+// frees p if it is from a slab, else returns 0
+int lslab_free( void *p ) {
+  Page *pg = find_page( p );
+  int cls;
+
+  if (!pg)
+    return 0;
+  cls = pg->cls;
+  if (!pg->free)
+    link_page( pg );  // was full, a nearly full page is best used next
+  *(void **)p = pg->free;
+  pg->free = p;
+  nused[cls]--;
+  if (--pg->used == 0) {
+    if (spare[cls])
+      release_page( pg );
+    else
+      spare[cls] = pg;
+  }
+  return 1;
+}
+
+// returns the spare empty pages to the heap
+void lslab_trim( void ) {
+  int cls;
+  for (cls = 0; cls < LSLAB_CLASSES; cls++) {
+    if (spare[cls]) {
+      release_page( spare[cls] );
+      spare[cls] = NULL;
+    }
+  }
+}
+
+void lslab_get_stats( int cls, lslab_stats *stats ) {
+  stats->size = cls_size( cls );
+  stats->pages = npages[cls];
+  stats->used = nused[cls];
+  stats->free = npages[cls] * cls_slots( cls ) - nused[cls];
+}
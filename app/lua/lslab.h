@@ -0,0 +1,28 @@
+// Lua slab allocator: small objects in pages of equal sized slots
+
+#ifndef __LSLAB_H__
+#define __LSLAB_H__
+
+#include "c_stddef.h"
+
+#define LSLAB_GRAIN    8    // slot sizes are multiples of this
+#define LSLAB_MAX      64   // largest object kept in a slab
+#define LSLAB_CLASSES  (LSLAB_MAX / LSLAB_GRAIN)
+#define LSLAB_PAGE     512  // bytes taken from the heap for a page
+
+// occupancy of the pages of one size class
+struct lslab_stats {
+  unsigned size;        // slot size
+  unsigned pages;       // pages held
+  unsigned used;        // slots in use
+  unsigned free;        // slots free in those pages
+};
+typedef struct lslab_stats lslab_stats;
+
+void  *lslab_alloc( size_t size );
+size_t lslab_size( const void *p );
+int    lslab_free( void *p );
+void   lslab_trim( void );
+void   lslab_get_stats( int cls, lslab_stats *stats );
+
+#endif
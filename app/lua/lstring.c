@@ -13,6 +13,7 @@
 #include "lua.h"
 #include C_HEADER_STRING
 
+#include "lflash.h"
 #include "lmem.h"
 #include "lobject.h"
 #include "lstate.h"
@@ -66,6 +67,7 @@ static TString *newlstr (lua_State *L, const char *str, size_t l,
   ts->tsv.hash = h;
   ts->tsv.marked = luaC_white(G(L));
   ts->tsv.tt = LUA_TSTRING;
+  ts->tsv.uninterned = 0;
   if (!readonly) {
     c_memcpy(ts+1, str, l*sizeof(char));
     ((char *)(ts+1))[l] = '\0';  /* ending 0 */
@@ -81,13 +83,49 @@ static TString *newlstr (lua_State *L, const char *str, size_t l,
 }
 
 
-static TString *luaS_newlstr_helper (lua_State *L, const char *str, size_t l, int readonly) {
-  GCObject *o;
+/*
+** a long string is linked into the list of all objects, like a table, rather
+** than into the string table, so it is not looked up when it is created. Its
+** hash, which samples at most 32 characters, is still kept for table keys
+*/
+static TString *newlngstr (lua_State *L, const char *str, size_t l) {
+  TString *ts;
+  if (l+1 > (MAX_SIZET - sizeof(TString))/sizeof(char))
+    luaM_toobig(L);
+  ts = cast(TString *, luaM_malloc(L, (l+1)*sizeof(char)+sizeof(TString)));
+  ts->tsv.len = l;
+  ts->tsv.hash = luaS_hash(str, l);
+  ts->tsv.uninterned = 1;
+  c_memcpy(ts+1, str, l*sizeof(char));
+  ((char *)(ts+1))[l] = '\0';  /* ending 0 */
+  luaC_link(L, obj2gco(ts), LUA_TSTRING);
+  return ts;
+}
+
+
+int luaS_eqlngstr (TString *a, TString *b) {
+  size_t len = a->tsv.len;
+  return len == b->tsv.len && a->tsv.hash == b->tsv.hash &&
+         c_memcmp(getstr(a), getstr(b), len) == 0;
+}
+
+
+unsigned int luaS_hash (const char *str, size_t l) {
   unsigned int h = cast(unsigned int, l);  /* seed */
   size_t step = (l>>5)+1;  /* if string is too long, don't hash all its chars */
   size_t l1;
   for (l1=l; l1>=step; l1-=step)  /* compute hash */
     h = h ^ ((h<<5)+(h>>2)+cast(unsigned char, str[l1-1]));
+  return h;
+}
+
+
+static TString *luaS_newlstr_helper (lua_State *L, const char *str, size_t l, int readonly) {
+  GCObject *o;
+  unsigned int h = luaS_hash(str, l);
+#ifdef LUA_FLASH_STORE
+  TString *fts;
+#endif
   for (o = G(L)->strt.hash[lmod(h, G(L)->strt.size)];
        o != NULL;
        o = o->gch.next) {
@@ -98,6 +136,10 @@ static TString *luaS_newlstr_helper (lua_State *L, const char *str, size_t l, in
       return ts;
     }
   }
+#ifdef LUA_FLASH_STORE
+  if ((fts = luaN_findstring(str, l, h)) != NULL)
+    return fts;
+#endif
   return newlstr(L, str, l, h, readonly);  /* not found */
 }
 
@@ -117,11 +159,19 @@ TString *luaS_newlstr (lua_State *L, const char *str, size_t l) {
   // create it as a read-only string instead
   if(lua_is_ptr_in_ro_area(str) && l+1 > sizeof(char**) && l == c_strlen(str))
     return luaS_newlstr_helper(L, str, l, LUAS_READONLY_STRING);
+  else if (l > LUAI_MAXSHORTLEN)
+    return newlngstr(L, str, l);
   else
     return luaS_newlstr_helper(L, str, l, LUAS_REGULAR_STRING);
 }
 
 
+/* interned whatever its length, for the parser which compares names by address */
+TString *luaS_internlstr (lua_State *L, const char *str, size_t l) {
+  return luaS_newlstr_helper(L, str, l, LUAS_REGULAR_STRING);
+}
+
+
 LUAI_FUNC TString *luaS_newrolstr (lua_State *L, const char *str, size_t l) {
   if(l+1 > sizeof(char**) && l == c_strlen(str))
     return luaS_newlstr_helper(L, str, l, LUAS_READONLY_STRING);
@@ -22,13 +22,23 @@
 #define luaS_newliteral(L, s)  (luaS_newlstr(L, "" s, \
                                   (sizeof(s)/sizeof(char))-1))
 
-#define luaS_fix(s)	l_setbit((s)->tsv.marked, FIXEDBIT)
+/* strings from the flash store are fixed already and must not be written */
+#define luaS_fix(s)	{ TString *s_ = (s); \
+                          if (!testbit(s_->tsv.marked, FIXEDBIT)) \
+                            l_setbit(s_->tsv.marked, FIXEDBIT); }
 #define luaS_readonly(s) l_setbit((s)->tsv.marked, READONLYBIT)
 #define luaS_isreadonly(s) testbit((s)->marked, READONLYBIT)
 
+/* only strings longer than LUAI_MAXSHORTLEN can be equal but not the same */
+#define luaS_eqstr(a,b)	((a) == (b) || \
+                         ((a)->tsv.len > LUAI_MAXSHORTLEN && luaS_eqlngstr(a, b)))
+
+LUAI_FUNC unsigned int luaS_hash (const char *str, size_t l);
 LUAI_FUNC void luaS_resize (lua_State *L, int newsize);
 LUAI_FUNC Udata *luaS_newudata (lua_State *L, size_t s, Table *e);
 LUAI_FUNC TString *luaS_newlstr (lua_State *L, const char *str, size_t l);
 LUAI_FUNC TString *luaS_newrolstr (lua_State *L, const char *str, size_t l);
+LUAI_FUNC TString *luaS_internlstr (lua_State *L, const char *str, size_t l);
+LUAI_FUNC int luaS_eqlngstr (TString *a, TString *b);
 
 #endif
@@ -32,6 +32,7 @@
 #include "lmem.h"
 #include "lobject.h"
 #include "lstate.h"
+#include "lstring.h"
 #include "ltable.h"
 #include "lrotable.h"
 
@@ -62,6 +63,8 @@
 
 #define hashpointer(t,p)	hashmod(t, IntPoint(p))
 
+#define hashint(t,i)	hashmod(t, cast(unsigned int, (i)))
+
 
 /*
 ** number of ints inside a lua_Number
@@ -84,6 +87,11 @@ static const Node dummynode_ = {
 static Node *hashnum (const Table *t, lua_Number n) {
   unsigned int a[numints];
   int i;
+#ifdef LUA_NUMBER_DUAL
+  lua_number2int(i, n);
+  if (luai_numeq(cast_num(i), n))  /* same node as the int key */
+    return hashint(t, i);
+#endif
   if (luai_numeq(n, 0))  /* avoid problems with -0 */
     return gnode(t, 0);
   c_memcpy(a, &n, sizeof(a));
@@ -100,6 +108,8 @@ static Node *hashnum (const Table *t, lua_Number n) {
 static Node *mainposition (const Table *t, const TValue *key) {
   switch (ttype(key)) {
     case LUA_TNUMBER:
+      if (ttisint(key))
+        return hashint(t, ivalue(key));
       return hashnum(t, nvalue(key));
     case LUA_TSTRING:
       return hashstr(t, rawtsvalue(key));
@@ -120,7 +130,9 @@ static Node *mainposition (const Table *t, const TValue *key) {
 ** the array part of the table, -1 otherwise.
 */
 static int arrayindex (const TValue *key) {
-  if (ttisnumber(key)) {
+  if (ttisint(key))
+    return ivalue(key);
+  else if (ttisnumber(key)) {
     lua_Number n = nvalue(key);
     int k;
     lua_number2int(k, n);
@@ -165,7 +177,7 @@ int luaH_next (lua_State *L, Table *t, StkId key) {
   int i = findindex(L, t, key);  /* find original element */
   for (i++; i < t->sizearray; i++) {  /* try first array part */
     if (!ttisnil(&t->array[i])) {  /* a non-nil value? */
-      setnvalue(key, cast_num(i+1));
+      setivalue(key, i+1);
       setobj2s(L, key+1, &t->array[i]);
       return 1;
     }
@@ -370,12 +382,10 @@ static int move_node (lua_State *L, Table *t, Node *node) {
 
 
 static int move_number (lua_State *L, Table *t, Node *node) {
-  int key;
-  lua_Number n = nvalue(key2tval(node));
-  lua_number2int(key, n);
-  if (luai_numeq(cast_num(key), nvalue(key2tval(node)))) {/* index is int? */
+  int key = arrayindex(key2tval(node));
+  if (key != -1) {/* index is int? */
     /* (1 <= key && key <= t->sizearray) */
-    if (cast(unsigned int, key-1) < cast(unsigned int, t->sizearray)) {
+    if (cast(unsigned int, key) - 1 < cast(unsigned int, t->sizearray)) {
       setobjt2t(L, &t->array[key-1], gval(node));
       setnilvalue(gkey(node));
       setnilvalue(gval(node));
@@ -526,6 +536,19 @@ void luaH_free (lua_State *L, Table *t) {
 */
 static TValue *newkey (lua_State *L, Table *t, const TValue *key) {
   Node *mp = mainposition(t, key);
+#ifdef LUA_NUMBER_DUAL
+  TValue k;
+  if (ttisnumber(key) && !ttisint(key)) {
+    /* whole numbers are int keys, so that luaH_getnum compares ints */
+    int i;
+    lua_Number n = nvalue(key);
+    lua_number2int(i, n);
+    if (luai_numeq(cast_num(i), n)) {
+      setivalue(&k, i);
+      key = &k;
+    }
+  }
+#endif
   if (!ttisnil(gval(mp)) || mp == dummynode) {
     Node *othern;
     Node *n = getfreepos(t);  /* get a free place */
@@ -562,9 +585,17 @@ static TValue *newkey (lua_State *L, Table *t, const TValue *key) {
 */
 const TValue *luaH_getnum (Table *t, int key) {
   /* (1 <= key && key <= t->sizearray) */
-  if (cast(unsigned int, key-1) < cast(unsigned int, t->sizearray))
+  if (cast(unsigned int, key) - 1 < cast(unsigned int, t->sizearray))
     return &t->array[key-1];
   else {
+#ifdef LUA_NUMBER_DUAL
+    Node *n = hashint(t, key);
+    do {  /* check whether `key' is somewhere in the chain */
+      if (ttisint(gkey(n)) && ivalue(gkey(n)) == key)
+        return gval(n);  /* that's it */
+      else n = gnext(n);
+    } while (n);
+#else
     lua_Number nk = cast_num(key);
     Node *n = hashnum(t, nk);
     do {  /* check whether `key' is somewhere in the chain */
@@ -572,6 +603,7 @@ const TValue *luaH_getnum (Table *t, int key) {
         return gval(n);  /* that's it */
       else n = gnext(n);
     } while (n);
+#endif
     return luaO_nilobject;
   }
 }
@@ -589,7 +621,7 @@ const TValue *luaH_getnum_ro (void *t, int key) {
 const TValue *luaH_getstr (Table *t, TString *key) {
   Node *n = hashstr(t, key);
   do {  /* check whether `key' is somewhere in the chain */
-    if (ttisstring(gkey(n)) && rawtsvalue(gkey(n)) == key)
+    if (ttisstring(gkey(n)) && luaS_eqstr(rawtsvalue(gkey(n)), key))
       return gval(n);  /* that's it */
     else n = gnext(n);
   } while (n);
@@ -598,12 +630,7 @@ const TValue *luaH_getstr (Table *t, TString *key) {
 
 /* same thing for rotables */
 const TValue *luaH_getstr_ro (void *t, TString *key) {
-  char keyname[LUA_MAX_ROTABLE_NAME + 1];
-  const TValue *res;  
-  if (!t)
-    return luaO_nilobject;
-  luaR_getcstr(keyname, key, LUA_MAX_ROTABLE_NAME);   
-  res = luaR_findentry(t, keyname, 0, NULL);
+  const TValue *res = luaR_findentrystr(t, key, NULL);
   return res ? res : luaO_nilobject;
 }
 
@@ -617,6 +644,8 @@ const TValue *luaH_get (Table *t, const TValue *key) {
     case LUA_TSTRING: return luaH_getstr(t, rawtsvalue(key));
     case LUA_TNUMBER: {
       int k;
+      if (ttisint(key))
+        return luaH_getnum(t, ivalue(key));
       lua_Number n = nvalue(key);
       lua_number2int(k, n);
       if (luai_numeq(cast_num(k), nvalue(key))) /* index is int? */
@@ -675,7 +704,7 @@ TValue *luaH_setnum (lua_State *L, Table *t, int key) {
     return cast(TValue *, p);
   else {
     TValue k;
-    setnvalue(&k, cast_num(key));
+    setivalue(&k, key);
     return newkey(L, t, &k);
   }
 }
@@ -0,0 +1,214 @@
+/*
+** write Lua flash store images (luac -f)
+** See Copyright Notice in lua.h
+*/
+
+#define LUAC_CROSS_FILE
+
+#include "luac_cross.h"
+#include C_HEADER_STDLIB
+#include C_HEADER_STRING
+
+#define luac_c
+#define LUA_CORE
+
+#include "lua.h"
+
+#include "ldo.h"
+#include "lflash.h"
+#include "lobject.h"
+#include "lstate.h"
+#include "lundump.h"
+
+typedef struct {
+ lua_State* L;
+ lua_Writer writer;
+ void* data;
+ int strip;
+ int status;
+ int index;				/* stack slot of the string -> index table */
+ TString** strings;			/* in image order */
+ int nstrings,sizestrings;
+} DumpState;
+
+static void DumpBlock(const void* b, size_t size, DumpState* D)
+{
+ if (D->status==0)
+ {
+  lua_unlock(D->L);
+  D->status=(*D->writer)(D->L,b,size,D->data);
+  lua_lock(D->L);
+ }
+}
+
+static void DumpByte(int x, DumpState* D)
+{
+ unsigned char b=(unsigned char)x;
+ DumpBlock(&b,1,D);
+}
+
+static void DumpU32(lu_int32 x, DumpState* D)
+{
+ unsigned char b[4];
+ b[0]=(unsigned char)x; b[1]=(unsigned char)(x>>8);
+ b[2]=(unsigned char)(x>>16); b[3]=(unsigned char)(x>>24);
+ DumpBlock(b,4,D);
+}
+
+static void DumpNumber(lua_Number x, DumpState* D)
+{
+ union { double d; unsigned char b[8]; } u;
+ unsigned char b[8];
+ int i,one=1;
+ u.d=(double)x;
+ for (i=0; i<8; i++)			/* images are little endian */
+  b[i]=*(char*)&one ? u.b[i] : u.b[7-i];
+ DumpBlock(b,8,D);
+}
+
+/* looks s up in the string table; adds it if add is set. Returns index+1 */
+static int StringRef(TString* s, int add, DumpState* D)
+{
+ lua_State* L=D->L;
+ int i;
+ if (s==NULL) return 0;
+ setsvalue2s(L,L->top,s); incr_top(L);
+ lua_rawget(L,D->index);
+ i=lua_tointeger(L,-1);
+ lua_pop(L,1);
+ if (i==0 && add)
+ {
+  if (D->nstrings==D->sizestrings)
+  {
+   D->sizestrings=D->sizestrings ? 2*D->sizestrings : 64;
+   D->strings=realloc(D->strings,D->sizestrings*sizeof(TString*));
+   if (D->strings==NULL) luaD_throw(L,LUA_ERRMEM);
+  }
+  D->strings[D->nstrings]=s;
+  i=++D->nstrings;
+  setsvalue2s(L,L->top,s); incr_top(L);
+  lua_pushinteger(L,i);
+  lua_rawset(L,D->index);
+ }
+ return i;
+}
+
+static void CollectStrings(const Proto* f, DumpState* D)
+{
+ int i;
+ if (!D->strip) StringRef(f->source,1,D);
+ for (i=0; i<f->sizek; i++)
+  if (ttisstring(&f->k[i])) StringRef(rawtsvalue(&f->k[i]),1,D);
+ for (i=0; i<f->sizep; i++) CollectStrings(f->p[i],D);
+ if (D->strip) return;
+ for (i=0; i<f->sizelocvars; i++) StringRef(f->locvars[i].varname,1,D);
+ for (i=0; i<f->sizeupvalues; i++) StringRef(f->upvalues[i],1,D);
+}
+
+static void DumpRef(TString* s, DumpState* D)
+{
+ DumpU32(StringRef(s,0,D),D);
+}
+
+static void DumpFunction(const Proto* f, DumpState* D)
+{
+ int i,n;
+ DumpRef(D->strip ? NULL : f->source,D);
+ DumpU32(f->linedefined,D);
+ DumpU32(f->lastlinedefined,D);
+ DumpByte(f->nups,D);
+ DumpByte(f->numparams,D);
+ DumpByte(f->is_vararg,D);
+ DumpByte(f->maxstacksize,D);
+ DumpU32(f->sizecode,D);
+ for (i=0; i<f->sizecode; i++) DumpU32(f->code[i],D);
+ DumpU32(f->sizek,D);
+ for (i=0; i<f->sizek; i++)
+ {
+  const TValue* o=&f->k[i];
+  DumpByte(ttype(o),D);
+  switch (ttype(o))
+  {
+   case LUA_TNIL:
+	break;
+   case LUA_TBOOLEAN:
+	DumpByte(bvalue(o),D);
+	break;
+   case LUA_TNUMBER:
+	DumpNumber(nvalue(o),D);
+	break;
+   case LUA_TSTRING:
+	DumpRef(rawtsvalue(o),D);
+	break;
+   default:
+	lua_assert(0);			/* cannot happen */
+	break;
+  }
+ }
+ DumpU32(f->sizep,D);
+ for (i=0; i<f->sizep; i++) DumpFunction(f->p[i],D);
+#ifdef LUA_OPTIMIZE_DEBUG
+ n=(D->strip || f->packedlineinfo==NULL) ? 0 : strlen((char*)f->packedlineinfo)+1;
+ DumpU32(n,D);
+ DumpBlock(f->packedlineinfo,n,D);
+#else
+ DumpU32(0,D);				/* the store only keeps packed line info */
+#endif
+ n=D->strip ? 0 : f->sizelocvars;
+ DumpU32(n,D);
+ for (i=0; i<n; i++)
+ {
+  DumpRef(f->locvars[i].varname,D);
+  DumpU32(f->locvars[i].startpc,D);
+  DumpU32(f->locvars[i].endpc,D);
+ }
+ n=D->strip ? 0 : f->sizeupvalues;
+ DumpU32(n,D);
+ for (i=0; i<n; i++) DumpRef(f->upvalues[i],D);
+}
+
+/*
+** dump the main functions f[0..n-1] of the modules named names[0..n-1]
+** as one flash store image
+*/
+int luaU_dumpflash (lua_State* L, const Proto** f, const char** names, int n, lua_Writer w, void* data, int strip)
+{
+ DumpState D;
+ int i;
+ D.L=L;
+ D.writer=w;
+ D.data=data;
+ D.strip=strip;
+ D.status=0;
+ D.strings=NULL;
+ D.nstrings=D.sizestrings=0;
+ lua_newtable(L);
+ D.index=lua_gettop(L);
+ for (i=0; i<n; i++)
+ {
+  lua_pushstring(L,names[i]);		/* anchored by the index table */
+  StringRef(rawtsvalue(L->top-1),1,&D);
+  lua_pop(L,1);
+ }
+ for (i=0; i<n; i++) CollectStrings(f[i],&D);
+ DumpBlock(LFS_SIGNATURE,sizeof(LFS_SIGNATURE)-1,&D);
+ DumpByte(LFS_VERSION,&D);
+ DumpByte(0,&D); DumpByte(0,&D); DumpByte(0,&D);
+ DumpU32(D.nstrings,&D);
+ DumpU32(n,&D);
+ for (i=0; i<D.nstrings; i++)
+ {
+  DumpU32(D.strings[i]->tsv.len,&D);
+  DumpBlock(getstr(D.strings[i]),D.strings[i]->tsv.len,&D);
+ }
+ for (i=0; i<n; i++)
+ {
+  lua_pushstring(L,names[i]);
+  DumpRef(rawtsvalue(L->top-1),&D);
+  lua_pop(L,1);
+  DumpFunction(f[i],&D);
+ }
+ free(D.strings);
+ lua_pop(L,1);
+ return D.status;
+}
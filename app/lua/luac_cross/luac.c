@@ -11,6 +11,7 @@
 #include C_HEADER_STDIO
 #include C_HEADER_STDLIB
 #include C_HEADER_STRING
+#include C_HEADER_TIME
 
 #define luac_c
 #define LUA_CORE
@@ -32,11 +33,22 @@
 static int listing=0;			/* list bytecodes? */
 static int dumping=1;			/* dump bytecodes? */
 static int stripping=0;			/* strip debug information? */
+static int stats=0;			/* report compile statistics? */
+static int flash=0;			/* write a flash store image? */
 static char Output[]={ OUTPUT };	/* default output file name */
 static const char* output=Output;	/* actual output file name */
 static const char* progname=PROGNAME;	/* actual program name */
 static DumpTargetInfo target;
 
+typedef struct {
+ lua_Alloc f;
+ void *ud;
+ size_t now, peak;			/* heap in use by the state */
+ size_t source, dumped;			/* bytes read and written */
+} Stats;
+
+static Stats counters;
+
 static void fatal(const char* message)
 {
  fprintf(stderr,"%s: %s\n",progname,message);
@@ -59,10 +71,12 @@ static void usage(const char* message)
  "usage: %s [options] [filenames].\n"
  "Available options are:\n"
  "  -        process stdin\n"
+ "  -f       write a flash store image of the files, one module per file\n"
  "  -l       list\n"
  "  -o name  output to file " LUA_QL("name") " (default is \"%s\")\n"
  "  -p       parse only\n"
  "  -s       strip debug information\n"
+ "  -t       print statistics (source and bytecode size, peak heap, cpu ms) to stderr\n"
  "  -v       show version information\n"
  "  -cci bits       cross-compile with given integer size\n"
  "  -ccn type bits  cross-compile with given lua_Number type and size\n"
@@ -91,6 +105,8 @@ static int doargs(int argc, char* argv[])
   }
   else if (IS("-"))			/* end of options; use stdin */
    break;
+  else if (IS("-f"))			/* flash store image */
+   flash=1;
   else if (IS("-l"))			/* list */
    ++listing;
   else if (IS("-o"))			/* output file */
@@ -103,6 +119,8 @@ static int doargs(int argc, char* argv[])
    dumping=0;
   else if (IS("-s"))			/* strip debug information */
    stripping=1;
+  else if (IS("-t"))			/* compile statistics */
+   stats=1;
   else if (IS("-v"))			/* show version */
    ++version;
   else if (IS("-cci")) /* target integer size */
@@ -181,9 +199,81 @@ static const Proto* combine(lua_State* L, int n)
 static int writer(lua_State* L, const void* p, size_t size, void* u)
 {
  UNUSED(L);
+ counters.dumped+=size;
  return (fwrite(p,size,1,(FILE*)u)!=1) && (size!=0);
 }
 
+static void* stats_alloc(void* ud, void* ptr, size_t osize, size_t nsize)
+{
+ Stats* s=(Stats*)ud;
+ void* nptr=s->f(s->ud,ptr,osize,nsize);
+ if (nptr!=NULL || nsize==0)
+ {
+  s->now+=nsize-osize;
+  if (s->now>s->peak) s->peak=s->now;
+ }
+ return nptr;
+}
+
+/* module name: file name without directory and extension */
+static const char* modname(lua_State* L, const char* filename)
+{
+ const char* b=filename;
+ const char* s;
+ const char* e;
+ for (s=filename; *s; s++)
+  if (*s=='/' || *s=='\\') b=s+1;
+ e=strrchr(b,'.');
+ if (e==NULL || e==b) e=b+strlen(b);
+ lua_pushlstring(L,b,e-b);
+ return lua_tostring(L,-1);
+}
+
+static void dumpflash(lua_State* L, int argc, char** argv)
+{
+ const Proto** f=luaM_newvector(L,argc,const Proto*);
+ const char** names=luaM_newvector(L,argc,const char*);
+ FILE* D;
+ int i,j,result;
+ for (i=0; i<argc; i++)
+ {
+  if (IS("-")) fatal(LUA_QL("-f") " needs named input files");
+  f[i]=toproto(L,i-argc);
+ }
+ luaL_checkstack(L,argc,"too many input files");
+ for (i=0; i<argc; i++)			/* names stay on the stack */
+ {
+  names[i]=modname(L,argv[i]);
+  for (j=0; j<i; j++)
+   if (strcmp(names[i],names[j])==0)
+   {
+    fprintf(stderr,"%s: module " LUA_QS " given twice\n",progname,names[i]);
+    exit(EXIT_FAILURE);
+   }
+ }
+ D=(output==NULL) ? stdout : fopen(output,"wb");
+ if (D==NULL) cannot("open");
+ lua_lock(L);
+ result=luaU_dumpflash(L,f,names,argc,writer,D,stripping);
+ lua_unlock(L);
+ if (result!=0) cannot("write");
+ if (ferror(D)) cannot("write");
+ if (fclose(D)) cannot("close");
+ luaM_freearray(L,f,argc,const Proto*);
+ luaM_freearray(L,names,argc,const char*);
+}
+
+static size_t filesize(const char* filename)
+{
+ FILE* f;
+ long size;
+ if (filename==NULL || (f=fopen(filename,"rb"))==NULL) return 0;
+ fseek(f,0,SEEK_END);
+ size=ftell(f);
+ fclose(f);
+ return size<0 ? 0 : (size_t)size;
+}
+
 struct Smain {
  int argc;
  char** argv;
@@ -200,8 +290,15 @@ static int pmain(lua_State* L)
  for (i=0; i<argc; i++)
  {
   const char* filename=IS("-") ? NULL : argv[i];
+  counters.source+=filesize(filename);
   if (luaL_loadfile(L,filename)!=0) fatal(lua_tostring(L,-1));
  }
+ if (flash)
+ {
+  if (listing) for (i=0; i<argc; i++) luaU_print(toproto(L,i-argc),listing>1);
+  if (dumping) dumpflash(L,argc,argv);
+  return 0;
+ }
  f=combine(L,argc);
  if (listing) luaU_print(f,listing>1);
  if (dumping)
@@ -223,6 +320,7 @@ int main(int argc, char* argv[])
 {
  lua_State* L;
  struct Smain s;
+ clock_t start;
  
  int test=1;
  target.little_endian=*(char*)&test;
@@ -237,9 +335,20 @@ int main(int argc, char* argv[])
  if (argc<=0) usage("no input files given");
  L=lua_open();
  if (L==NULL) fatal("not enough memory for state");
+ if (stats)
+ {
+  counters.f=lua_getallocf(L,&counters.ud);
+  counters.now=counters.peak=lua_gc(L,LUA_GCCOUNT,0)*1024+lua_gc(L,LUA_GCCOUNTB,0);
+  lua_setallocf(L,stats_alloc,&counters);
+ }
  s.argc=argc;
  s.argv=argv;
+ start=clock();
  if (lua_cpcall(L,pmain,&s)!=0) fatal(lua_tostring(L,-1));
+ if (stats)
+  fprintf(stderr,"%s\t%lu\t%lu\t%lu\t%.3f\n",argc==1 ? argv[0] : "(" PROGNAME ")",
+   (unsigned long)counters.source,(unsigned long)counters.dumped,(unsigned long)counters.peak,
+   (double)(clock()-start)*1000.0/CLOCKS_PER_SEC);
  lua_close(L);
  return EXIT_SUCCESS;
 }
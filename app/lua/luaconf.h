@@ -240,6 +240,15 @@
 #define LUA_IDSIZE	60
 
 
+/*
+@@ LUAI_MAXSHORTLEN is the longest string which is interned.
+** Longer strings, such as received packets or file contents, are not
+** looked up in or added to the string table; they compare by contents.
+** Strings read by the parser are always interned.
+*/
+#define LUAI_MAXSHORTLEN	40
+
+
 /*
 ** {==================================================================
 ** Stand-alone configuration
@@ -558,6 +567,12 @@ extern int readline4lua(const char *prompt, char *buffer, int length);
 */
 #define LUAL_BUFFERSIZE		256
 
+/*
+@@ LUAL_FSBUFFERSIZE is the size of the blocks in which luaL_loadfsfile
+** reads files, from a heap buffer.
+*/
+#define LUAL_FSBUFFERSIZE	1024
+
 /* }================================================================== */
 
 
@@ -591,6 +606,19 @@ extern int readline4lua(const char *prompt, char *buffer, int length);
 #define LUA_NUMBER	double
 #endif
 
+/* LUA_NUMBER_DUAL keeps lua_Number double but stores whole numbers which
+   fit in an int as int tagged values (LUA_TNUMINT, see lobject.h).  They
+   behave exactly as the doubles they stand for: lua_type() reports
+   LUA_TNUMBER and results which an int cannot hold, like 2^31 or -0, are
+   doubles.  The VM adds, subtracts, multiplies, compares, counts for loops
+   and indexes tables with them on the integer ALU.  It needs an unpacked
+   TValue, so it is left out of LUA_NUMBER_INTEGRAL and LUA_PACK_VALUE
+   builds. */
+#if defined LUA_NUMBER_DUAL && \
+    (defined LUA_NUMBER_INTEGRAL || defined LUA_PACK_VALUE)
+#undef LUA_NUMBER_DUAL
+#endif
+
 /*
 @@ LUAI_UACNUMBER is the result of an 'usual argument conversion'
 @* over a number.
@@ -618,6 +646,7 @@ extern int readline4lua(const char *prompt, char *buffer, int length);
 #define LUA_NUMBER_FMT		"%.14g"
 #endif // #if defined LUA_NUMBER_INTEGRAL
 #define lua_number2str(s,n)	c_sprintf((s), LUA_NUMBER_FMT, (n))
+#define lua_int2str(s,i)	c_sprintf((s), "%d", (i))
 #define LUAI_MAXNUMBER2STR	32 /* 16 digits, sign, point, and \0 */
 #if defined LUA_NUMBER_INTEGRAL
   #if !defined LUA_INTEGRAL_LONGLONG
@@ -898,6 +927,13 @@ union luai_Cast { double l_d; long l_l; };
 #define LUA_META_ROTABLES 
 #endif
 
+/* The flash store (lflash.c) only exists on the target; luac.cross writes
+   the images it is loaded from whatever the setting.
+*/
+#if defined(LUA_FLASH_STORE) && defined(LUA_CROSS_COMPILER)
+#undef LUA_FLASH_STORE
+#endif
+
 #if LUA_OPTIMIZE_MEMORY == 2 && defined(LUA_USE_POPEN)
 #error "Pipes not supported in aggresive optimization mode (LUA_OPTIMIZE_MEMORY=2)"
 #endif
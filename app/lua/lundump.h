@@ -43,6 +43,9 @@ LUAI_FUNC int luaU_dump (lua_State* L, const Proto* f, lua_Writer w, void* data,
 #ifdef luac_c
 /* print one chunk; from print.c */
 LUAI_FUNC void luaU_print (const Proto* f, int full);
+
+/* write a Lua flash store image (luac -f) */
+LUAI_FUNC int luaU_dumpflash (lua_State* L, const Proto** f, const char** names, int n, lua_Writer w, void* data, int strip);
 #endif
 
 /* for header of binary files -- this is Lua 5.1 */
@@ -51,11 +51,70 @@ LUA_NUMBER luai_ipow(LUA_NUMBER a, LUA_NUMBER b) {
 }
 #endif
 
+#ifdef LUA_NUMBER_DUAL
+/*
+** arithmetic on ints: stores the result in *r and returns 1 if it is the
+** exact result of the lua_Number operation, or returns 0 so that the caller
+** falls back to lua_Number (overflow, -0, modulo by zero, division and pow)
+*/
+static int arith_int (TMS op, int a, int b, int *r) {
+  switch (op) {
+    case TM_ADD:
+      *r = cast_int(cast(unsigned int, a) + cast(unsigned int, b));
+      return ((a ^ *r) & (b ^ *r)) >= 0;
+    case TM_SUB:
+      *r = cast_int(cast(unsigned int, a) - cast(unsigned int, b));
+      return ((a ^ b) & (a ^ *r)) >= 0;
+    case TM_MUL: {
+      long long p = (long long)a * b;
+      *r = cast_int(p);
+      return p == *r && (p != 0 || (a | b) >= 0);
+    }
+    case TM_MOD:
+      if (b == 0 || b == -1)
+        return 0;
+      *r = a % b;
+      if (*r != 0 && (*r ^ b) < 0) *r += b;  /* result takes the sign of b */
+      return 1;
+    case TM_UNM:
+      *r = cast_int(0u - cast(unsigned int, a));
+      return (a ^ *r) < 0;
+    default:
+      return 0;
+  }
+}
+
+
+/*
+** sets up an int for loop when the initial value and the step are ints and
+** the limit is in int range; a fractional limit is rounded to the last
+** value the loop can reach
+*/
+static int forprep_int (StkId ra) {
+  int init, limit, step;
+  if (!ttisint(ra) || !ttisint(ra+2))
+    return 0;
+  step = ivalue(ra+2);
+  if (!ttisint(ra+1)) {
+    lua_Number n = nvalue(ra+1);
+    n = step > 0 ? floor(n) : -floor(-n);
+    lua_number2int(limit, n);
+    if (!luai_numeq(cast_num(limit), n))
+      return 0;
+    setivalue(ra+1, limit);
+  }
+  if (!arith_int(TM_SUB, ivalue(ra), step, &init))
+    return 0;
+  setivalue(ra, init);
+  return 1;
+}
+#endif
+
 const TValue *luaV_tonumber (const TValue *obj, TValue *n) {
   lua_Number num;
   if (ttisnumber(obj)) return obj;
   if (ttisstring(obj) && luaO_str2d(svalue(obj), &num)) {
-    setnvalue(n, num);
+    setnumvalue(n, num);
     return n;
   }
   else
@@ -69,8 +128,12 @@ int luaV_tostring (lua_State *L, StkId obj) {
   else {
     char s[LUAI_MAXNUMBER2STR];
     ptrdiff_t objr = savestack(L, obj);
-    lua_Number n = nvalue(obj);
-    lua_number2str(s, n);
+    if (ttisint(obj))
+      lua_int2str(s, ivalue(obj));
+    else {
+      lua_Number n = nvalue(obj);
+      lua_number2str(s, n);
+    }
     setsvalue2s(L, restorestack(L, objr), luaS_new(L, s));
     return 1;
   }
@@ -259,6 +322,8 @@ int luaV_lessthan (lua_State *L, const TValue *l, const TValue *r) {
   int res;
   if (ttype(l) != ttype(r))
     return luaG_ordererror(L, l, r);
+  else if (ttisint(l) && ttisint(r))
+    return ivalue(l) < ivalue(r);
   else if (ttisnumber(l))
     return luai_numlt(nvalue(l), nvalue(r));
   else if (ttisstring(l))
@@ -273,6 +338,8 @@ static int lessequal (lua_State *L, const TValue *l, const TValue *r) {
   int res;
   if (ttype(l) != ttype(r))
     return luaG_ordererror(L, l, r);
+  else if (ttisint(l) && ttisint(r))
+    return ivalue(l) <= ivalue(r);
   else if (ttisnumber(l))
     return luai_numle(nvalue(l), nvalue(r));
   else if (ttisstring(l))
@@ -296,6 +363,7 @@ int luaV_equalval (lua_State *L, const TValue *t1, const TValue *t2) {
     case LUA_TROTABLE:
     case LUA_TLIGHTFUNCTION:
       return pvalue(t1) == pvalue(t2);
+    case LUA_TSTRING: return luaS_eqstr(rawtsvalue(t1), rawtsvalue(t2));
     case LUA_TUSERDATA: {
       if (uvalue(t1) == uvalue(t2)) return 1;
       tm = get_compTM(L, uvalue(t1)->metatable, uvalue(t2)->metatable,
@@ -370,13 +438,13 @@ static void Arith (lua_State *L, StkId ra, const TValue *rb,
       (c = luaV_tonumber(rc, &tempc)) != NULL) {
     lua_Number nb = nvalue(b), nc = nvalue(c);
     switch (op) {
-      case TM_ADD: setnvalue(ra, luai_numadd(nb, nc)); break;
-      case TM_SUB: setnvalue(ra, luai_numsub(nb, nc)); break;
-      case TM_MUL: setnvalue(ra, luai_nummul(nb, nc)); break;
-      case TM_DIV: setnvalue(ra, luai_lnumdiv(nb, nc)); break;
-      case TM_MOD: setnvalue(ra, luai_lnummod(nb, nc)); break;
-      case TM_POW: setnvalue(ra, luai_numpow(nb, nc)); break;
-      case TM_UNM: setnvalue(ra, luai_numunm(nb)); break;
+      case TM_ADD: setnumvalue(ra, luai_numadd(nb, nc)); break;
+      case TM_SUB: setnumvalue(ra, luai_numsub(nb, nc)); break;
+      case TM_MUL: setnumvalue(ra, luai_nummul(nb, nc)); break;
+      case TM_DIV: setnumvalue(ra, luai_lnumdiv(nb, nc)); break;
+      case TM_MOD: setnumvalue(ra, luai_lnummod(nb, nc)); break;
+      case TM_POW: setnumvalue(ra, luai_numpow(nb, nc)); break;
+      case TM_UNM: setnumvalue(ra, luai_numunm(nb)); break;
       default: lua_assert(0); break;
     }
   }
@@ -414,6 +482,29 @@ static void Arith (lua_State *L, StkId ra, const TValue *rb,
 #define Protect(x)	{ L->savedpc = pc; {x;}; base = L->base; }
 
 
+#ifdef LUA_NUMBER_DUAL
+/* ints stay ints where the result fits, see arith_int */
+#define arith_op(op,tm) { \
+        TValue *rb = RKB(i); \
+        TValue *rc = RKC(i); \
+        int ir; \
+        if (ttisint(rb) && ttisint(rc) && \
+            arith_int(tm, ivalue(rb), ivalue(rc), &ir)) { \
+          setivalue(ra, ir); \
+        } \
+        else if (ttisnumber(rb) && ttisnumber(rc)) { \
+          lua_Number nb = nvalue(rb), nc = nvalue(rc); \
+          if (tm == TM_POW) { /* 2^8 and the like become ints */ \
+            setnumvalue(ra, op(nb, nc)); \
+          } \
+          else { \
+            setnvalue(ra, op(nb, nc)); \
+          } \
+        } \
+        else \
+          Protect(Arith(L, ra, rb, rc, tm)); \
+      }
+#else
 #define arith_op(op,tm) { \
         TValue *rb = RKB(i); \
         TValue *rc = RKC(i); \
@@ -424,6 +515,7 @@ static void Arith (lua_State *L, StkId ra, const TValue *rb,
         else \
           Protect(Arith(L, ra, rb, rc, tm)); \
       }
+#endif
 
 
 
@@ -552,6 +644,13 @@ void luaV_execute (lua_State *L, int nexeccalls) {
       }
       case OP_UNM: {
         TValue *rb = RB(i);
+#ifdef LUA_NUMBER_DUAL
+        int ir;
+        if (ttisint(rb) && arith_int(TM_UNM, ivalue(rb), 0, &ir)) {
+          setivalue(ra, ir);
+        }
+        else
+#endif
         if (ttisnumber(rb)) {
           lua_Number nb = nvalue(rb);
           setnvalue(ra, luai_numunm(nb));
@@ -571,11 +670,11 @@ void luaV_execute (lua_State *L, int nexeccalls) {
         switch (ttype(rb)) {
           case LUA_TTABLE: 
           case LUA_TROTABLE: {
-            setnvalue(ra, ttistable(rb) ? cast_num(luaH_getn(hvalue(rb))) : cast_num(luaH_getn_ro(rvalue(rb))));
+            setivalue(ra, ttistable(rb) ? luaH_getn(hvalue(rb)) : luaH_getn_ro(rvalue(rb)));
             break;
           }
           case LUA_TSTRING: {
-            setnvalue(ra, cast_num(tsvalue(rb)->len));
+            setivalue(ra, tsvalue(rb)->len);
             break;
           }
           default: {  /* try metamethod */
@@ -602,7 +701,11 @@ void luaV_execute (lua_State *L, int nexeccalls) {
       case OP_EQ: {
         TValue *rb = RKB(i);
         TValue *rc = RKC(i);
-        Protect(
+        if (ttisint(rb) && ttisint(rc)) {
+          if ((ivalue(rb) == ivalue(rc)) == GETARG_A(i))
+            dojump(L, pc, GETARG_sBx(*pc));
+        }
+        else Protect(
           if (equalobj(L, rb, rc) == GETARG_A(i))
             dojump(L, pc, GETARG_sBx(*pc));
         )
@@ -610,16 +713,28 @@ void luaV_execute (lua_State *L, int nexeccalls) {
         continue;
       }
       case OP_LT: {
-        Protect(
-          if (luaV_lessthan(L, RKB(i), RKC(i)) == GETARG_A(i))
+        TValue *rb = RKB(i);
+        TValue *rc = RKC(i);
+        if (ttisint(rb) && ttisint(rc)) {
+          if ((ivalue(rb) < ivalue(rc)) == GETARG_A(i))
+            dojump(L, pc, GETARG_sBx(*pc));
+        }
+        else Protect(
+          if (luaV_lessthan(L, rb, rc) == GETARG_A(i))
             dojump(L, pc, GETARG_sBx(*pc));
         )
         pc++;
         continue;
       }
       case OP_LE: {
-        Protect(
-          if (lessequal(L, RKB(i), RKC(i)) == GETARG_A(i))
+        TValue *rb = RKB(i);
+        TValue *rc = RKC(i);
+        if (ttisint(rb) && ttisint(rc)) {
+          if ((ivalue(rb) <= ivalue(rc)) == GETARG_A(i))
+            dojump(L, pc, GETARG_sBx(*pc));
+        }
+        else Protect(
+          if (lessequal(L, rb, rc) == GETARG_A(i))
             dojump(L, pc, GETARG_sBx(*pc));
         )
         pc++;
@@ -709,6 +824,19 @@ void luaV_execute (lua_State *L, int nexeccalls) {
         }
       }
       case OP_FORLOOP: {
+#ifdef LUA_NUMBER_DUAL
+        if (ttisint(ra)) {  /* limit and step are ints too, see forprep_int */
+          int step = ivalue(ra+2);
+          int idx;
+          if (arith_int(TM_ADD, ivalue(ra), step, &idx) &&
+              (0 < step ? idx <= ivalue(ra+1) : ivalue(ra+1) <= idx)) {
+            dojump(L, pc, GETARG_sBx(i));  /* jump back */
+            setivalue(ra, idx);  /* update internal index... */
+            setivalue(ra+3, idx);  /* ...and external index */
+          }
+          continue;
+        }
+#endif
         lua_Number step = nvalue(ra+2);
         lua_Number idx = luai_numadd(nvalue(ra), step); /* increment index */
         lua_Number limit = nvalue(ra+1);
@@ -731,6 +859,12 @@ void luaV_execute (lua_State *L, int nexeccalls) {
           luaG_runerror(L, LUA_QL("for") " limit must be a number");
         else if (!tonumber(pstep, ra+2))
           luaG_runerror(L, LUA_QL("for") " step must be a number");
+#ifdef LUA_NUMBER_DUAL
+        if (forprep_int(ra)) {
+          dojump(L, pc, GETARG_sBx(i));
+          continue;
+        }
+#endif
         setnvalue(ra, luai_numsub(nvalue(ra), nvalue(pstep)));
         dojump(L, pc, GETARG_sBx(i));
         continue;
@@ -2,15 +2,12 @@
 
 #include "module.h"
 #include "lauxlib.h"
-#include "lmem.h"
 #include "platform.h"
 
 #include "c_types.h"
 #include "vfs.h"
 #include "c_string.h"
 
-#include <alloca.h>
-
 #define FILE_READ_CHUNK 1024
 
 static int file_fd = 0;
@@ -123,9 +120,16 @@ static int file_close( lua_State* L )
   file_fd_ref = LUA_NOREF;
 
   if(ud->fd){
-      vfs_close(ud->fd);
+      // buffered writes go to the file system here and may fail
+      sint32_t res = vfs_close(ud->fd);
       // mark as closed
       ud->fd = 0;
+      if (res == VFS_RES_OK) {
+        lua_pushboolean(L, 1);
+      } else {
+        lua_pushnil(L);
+      }
+      return 1;
   }
   return 0;  
 }
@@ -134,8 +138,10 @@ static int file_obj_free( lua_State *L )
 {
   file_fd_ud *ud = (file_fd_ud *)luaL_checkudata(L, 1, "file.obj");
   if (ud->fd) {
-    // close file if it's still open
-    vfs_close(ud->fd);
+    // close file if it's still open, nobody is left to tell if its last writes fail
+    if (vfs_close(ud->fd) != VFS_RES_OK) {
+      NODE_ERR( "file: writes lost on collecting an unclosed file\n" );
+    }
     ud->fd = 0;
   }
 
@@ -170,6 +176,69 @@ static int file_fscfg (lua_State *L)
   return 2;
 }
 
+// Lua: gc(freeblocks [, steps])
+static int file_gc( lua_State *L )
+{
+  int free_blocks = luaL_checkinteger( L, 1 );
+  int max_steps = luaL_optinteger( L, 2, -1 );
+  luaL_argcheck( L, free_blocks >= 0, 1, "must be >= 0" );
+  luaL_argcheck( L, max_steps == -1 || max_steps > 0, 2, "must be > 0" );
+
+  if (vfs_gc( free_blocks, max_steps, NULL ) != VFS_RES_OK)
+    return luaL_error( L, "not supported" );
+  return 0;
+}
+
+// Lua: steps, pages, maxus = gcstats()
+static int file_gcstats( lua_State *L )
+{
+  vfs_gc_stats stats;
+
+  if (vfs_gc( -1, -1, &stats ) != VFS_RES_OK)
+    return luaL_error( L, "not supported" );
+  lua_pushinteger( L, stats.steps );
+  lua_pushinteger( L, stats.reclaimed );
+  lua_pushinteger( L, stats.max_us );
+  return 3;
+}
+
+// Lua: cache(pages)
+static int file_cache( lua_State *L )
+{
+  int pages = luaL_checkinteger( L, 1 );
+  luaL_argcheck( L, pages >= 0, 1, "must be >= 0" );
+
+  if (vfs_cache( pages, NULL ) != VFS_RES_OK)
+    return luaL_error( L, "files open or out of memory" );
+  return 0;
+}
+
+// Lua: hits, misses, evictions, pages = cachestats()
+static int file_cachestats( lua_State *L )
+{
+  vfs_cache_stats stats;
+
+  if (vfs_cache( -1, &stats ) != VFS_RES_OK)
+    return luaL_error( L, "not supported" );
+  lua_pushinteger( L, stats.hits );
+  lua_pushinteger( L, stats.misses );
+  lua_pushinteger( L, stats.evictions );
+  lua_pushinteger( L, stats.pages );
+  return 4;
+}
+
+// Lua: limit = maxopen([files])
+static int file_maxopen( lua_State *L )
+{
+  int files = luaL_optinteger( L, 1, 0 );
+  luaL_argcheck( L, files >= 0, 1, "must be >= 0" );
+
+  if ((files = vfs_maxopen( files )) == VFS_RES_ERR)
+    return luaL_error( L, "files open or out of memory" );
+  lua_pushinteger( L, files );
+  return 1;
+}
+
 // Lua: open(filename, mode)
 static int file_open( lua_State* L )
 {
@@ -317,15 +386,11 @@ static int file_rename( lua_State* L )
   return 1;
 }
 
-// g_read()
+// g_read(), through the VFS read-ahead buffer
 static int file_g_read( lua_State* L, int n, int16_t end_char, int fd )
 {
-  static char *heap_mem = NULL;
-  // free leftover memory
-  if (heap_mem) {
-    luaM_free(L, heap_mem);
-    heap_mem = NULL;
-  }
+  luaL_Buffer b;
+  int got = 0;
 
   if(n <= 0)
     n = FILE_READ_CHUNK;
@@ -337,44 +402,33 @@ static int file_g_read( lua_State* L, int n, int16_t end_char, int fd )
   if(!fd)
     return luaL_error(L, "open a file first");
 
-  char *p;
-  int i;
-
-  if (n > LUAL_BUFFERSIZE) {
-    // get buffer from heap
-    p = heap_mem = luaM_malloc(L, n);
-  } else {
-    // small chunks go onto the stack
-    p = alloca(n);
+  if (end_char == EOF && n > LUAL_BUFFERSIZE) {
+    // big reads in one piece, into memory the collector frees
+    char *p = (char *)lua_newuserdata(L, n);
+    got = vfs_read(fd, p, n);
+    if (got <= 0)
+      return 0;
+    lua_pushlstring(L, p, got);
+    return 1;
   }
 
-  n = vfs_read(fd, p, n);
-  // bypass search if no end character provided
-  if (n > 0 && end_char != EOF) {
-    for (i = 0; i < n; ++i)
-      if (p[i] == end_char)
-      {
-        ++i;
-        break;
-      }
-  } else {
-    i = n;
+  luaL_buffinit(L, &b);
+  while (got < n) {
+    char *p = luaL_prepbuffer(&b);
+    int len = n - got < LUAL_BUFFERSIZE ? n - got : LUAL_BUFFERSIZE;
+
+    len = end_char == EOF ? vfs_read(fd, p, len) : vfs_read_until(fd, p, len, end_char);
+    if (len <= 0)
+      break;
+    luaL_addsize(&b, len);
+    got += len;
+    if (end_char != EOF && p[len - 1] == end_char)
+      break;
   }
 
-  if (i == 0 || n == VFS_RES_ERR) {
-    if (heap_mem) {
-      luaM_free(L, heap_mem);
-      heap_mem = NULL;
-    }
+  if (got == 0)
     return 0;
-  }
-
-  vfs_lseek(fd, -(n - i), VFS_SEEK_CUR);
-  lua_pushlstring(L, p, i);
-  if (heap_mem) {
-    luaM_free(L, heap_mem);
-    heap_mem = NULL;
-  }
+  luaL_pushresult(&b);
   return 1;
 }
 
@@ -476,6 +530,7 @@ typedef struct {
   vfs_vol *vol;
 } volume_type;
 
+#ifdef BUILD_FATFS
 // Lua: vol = file.mount("/SD0")
 static int file_mount( lua_State *L )
 {
@@ -503,6 +558,7 @@ static int file_chdir( lua_State *L )
   lua_pushboolean( L, 0 <= vfs_chdir( path ) );
   return 1;
 }
+#endif
 
 static int file_vol_umount( lua_State *L )
 {
@@ -553,6 +609,11 @@ static const LUA_REG_TYPE file_map[] = {
 #ifdef BUILD_SPIFFS
   { LSTRKEY( "format" ),    LFUNCVAL( file_format ) },
   { LSTRKEY( "fscfg" ),     LFUNCVAL( file_fscfg ) },
+  { LSTRKEY( "gc" ),        LFUNCVAL( file_gc ) },
+  { LSTRKEY( "gcstats" ),   LFUNCVAL( file_gcstats ) },
+  { LSTRKEY( "cache" ),     LFUNCVAL( file_cache ) },
+  { LSTRKEY( "cachestats" ),LFUNCVAL( file_cachestats ) },
+  { LSTRKEY( "maxopen" ),   LFUNCVAL( file_maxopen ) },
 #endif
   { LSTRKEY( "remove" ),    LFUNCVAL( file_remove ) },
   { LSTRKEY( "seek" ),      LFUNCVAL( file_seek ) },
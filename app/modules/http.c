@@ -10,6 +10,35 @@
 #include "httpclient.h"
 
 static int http_callback_registry  = LUA_NOREF;
+static int http_data_registry      = LUA_NOREF;
+
+static void http_data_callback( char * data, int len )
+{
+  if (http_data_registry != LUA_NOREF)
+  {
+    lua_State *L = lua_getstate();
+
+    lua_rawgeti(L, LUA_REGISTRYINDEX, http_data_registry);
+    lua_pushlstring(L, data, len);
+    lua_call(L, 1, 0);
+  }
+}
+
+// Registers the optional streaming callback found at stack index "idx"
+static http_data_callback_t http_register_data_callback( lua_State *L, int idx )
+{
+  if (http_data_registry != LUA_NOREF)
+  {
+    luaL_unref(L, LUA_REGISTRYINDEX, http_data_registry);
+    http_data_registry = LUA_NOREF;
+  }
+  if (lua_type(L, idx) == LUA_TFUNCTION || lua_type(L, idx) == LUA_TLIGHTFUNCTION) {
+    lua_pushvalue(L, idx);  // copy argument (func) to the top of stack
+    http_data_registry = luaL_ref(L, LUA_REGISTRYINDEX);
+    return http_data_callback;
+  }
+  return NULL;
+}
 
 static void http_callback( char * response, int http_status, char * full_response )
 {
@@ -23,11 +52,17 @@ static void http_callback( char * response, int http_status, char * full_respons
     dbg_printf( "response=%s<EOF>\n", response );
   }
 #endif
-  if (http_callback_registry != LUA_NOREF)
+  lua_State *L = lua_getstate();
+  // Taken over before the call, as the callback may start the next request
+  // and register its own functions
+  int callback_ref = http_callback_registry;
+  int data_ref = http_data_registry;
+  http_callback_registry = LUA_NOREF;
+  http_data_registry = LUA_NOREF;
+
+  if (callback_ref != LUA_NOREF)
   {
-    lua_State *L = lua_getstate();
-
-    lua_rawgeti(L, LUA_REGISTRYINDEX, http_callback_registry);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, callback_ref);
 
     lua_pushnumber(L, http_status);
     if ( http_status != HTTP_STATUS_GENERIC_ERROR && response)
@@ -40,12 +75,15 @@ static void http_callback( char * response, int http_status, char * full_respons
     }
     lua_call(L, 2, 0); // With 2 arguments and 0 result
 
-    luaL_unref(L, LUA_REGISTRYINDEX, http_callback_registry);
-    http_callback_registry = LUA_NOREF;
+    luaL_unref(L, LUA_REGISTRYINDEX, callback_ref);
+  }
+  if (data_ref != LUA_NOREF)
+  {
+    luaL_unref(L, LUA_REGISTRYINDEX, data_ref);
   }
 }
 
-// Lua: http.request( url, method, header, body, function(status, reponse) end )
+// Lua: http.request( url, method, header, body, function(status, reponse) end [, function(data) end] )
 static int http_lapi_request( lua_State *L )
 {
   int length;
@@ -76,11 +114,11 @@ static int http_lapi_request( lua_State *L )
     http_callback_registry = luaL_ref(L, LUA_REGISTRYINDEX);
   }
 
-  http_request(url, method, headers, body, http_callback, 0);
+  http_request(url, method, headers, body, http_callback, http_register_data_callback(L, 6), 0);
   return 0;
 }
 
-// Lua: http.post( url, header, body, function(status, reponse) end )
+// Lua: http.post( url, header, body, function(status, reponse) end [, function(data) end] )
 static int http_lapi_post( lua_State *L )
 {
   int length;
@@ -110,11 +148,11 @@ static int http_lapi_post( lua_State *L )
     http_callback_registry = luaL_ref(L, LUA_REGISTRYINDEX);
   }
 
-  http_post(url, headers, body, http_callback);
+  http_post(url, headers, body, http_callback, http_register_data_callback(L, 5));
   return 0;
 }
 
-// Lua: http.put( url, header, body, function(status, reponse) end )
+// Lua: http.put( url, header, body, function(status, reponse) end [, function(data) end] )
 static int http_lapi_put( lua_State *L )
 {
   int length;
@@ -144,11 +182,11 @@ static int http_lapi_put( lua_State *L )
     http_callback_registry = luaL_ref(L, LUA_REGISTRYINDEX);
   }
 
-  http_put(url, headers, body, http_callback);
+  http_put(url, headers, body, http_callback, http_register_data_callback(L, 5));
   return 0;
 }
 
-// Lua: http.delete( url, header, body, function(status, reponse) end )
+// Lua: http.delete( url, header, body, function(status, reponse) end [, function(data) end] )
 static int http_lapi_delete( lua_State *L )
 {
   int length;
@@ -178,11 +216,11 @@ static int http_lapi_delete( lua_State *L )
     http_callback_registry = luaL_ref(L, LUA_REGISTRYINDEX);
   }
 
-  http_delete(url, headers, body, http_callback);
+  http_delete(url, headers, body, http_callback, http_register_data_callback(L, 5));
   return 0;
 }
 
-// Lua: http.get( url, header, function(status, reponse) end )
+// Lua: http.get( url, header, function(status, reponse) end [, function(data) end] )
 static int http_lapi_get( lua_State *L )
 {
   int length;
@@ -207,7 +245,7 @@ static int http_lapi_get( lua_State *L )
     http_callback_registry = luaL_ref(L, LUA_REGISTRYINDEX);
   }
 
-  http_get(url, headers, http_callback);
+  http_get(url, headers, http_callback, http_register_data_callback(L, 4));
   return 0;
 }
 
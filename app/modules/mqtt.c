@@ -18,12 +18,19 @@
 #include "user_interface.h"
 
 #define MQTT_BUF_SIZE 1024
+#define MQTT_ACK_BUF_SIZE 8   // room for any acknowledgement or ping
 #define MQTT_DEFAULT_KEEPALIVE 60
 #define MQTT_MAX_CLIENT_LEN   64
 #define MQTT_MAX_USER_LEN     64
 #define MQTT_MAX_PASS_LEN     64
 #define MQTT_SEND_TIMEOUT			5
 #define MQTT_CONNECT_TIMEOUT  5
+// Packets queued back to back are coalesced into one send of up to this size:
+// one segment, which espconn_send() always finds room for in the send buffer.
+// A TLS send goes out as a single record, which also has to fit, with its
+// header and MAC, in the SDK's SSL_BUFFER_SIZE fragment buffer.
+#define MQTT_BATCH_SIZE       TCP_MSS
+#define MQTT_SECURE_BATCH_SIZE 1024
 
 typedef enum {
   MQTT_INIT,
@@ -42,6 +49,32 @@ typedef struct mqtt_event_data_t
   uint16_t data_offset;
 } mqtt_event_data_t;
 
+enum {
+  MQTT_RX_HEADER,   // collecting the fixed header
+  MQTT_RX_PACKET,   // buffering a packet of up to MQTT_BUF_SIZE bytes
+  MQTT_RX_TOPIC,    // buffering the variable header of a large PUBLISH
+  MQTT_RX_STREAM,   // passing the payload of a large PUBLISH to "data"
+  MQTT_RX_ID,       // finding the message id of a PUBLISH too large to deliver
+  MQTT_RX_SKIP      // discarding an oversized packet
+};
+
+// Reassembly of packets that span TCP segments
+typedef struct mqtt_rx_t
+{
+  uint8_t state;
+  uint8_t header_len;
+  uint8_t fixed_len;
+  uint8_t header[7];      // fixed header, then the topic length of a large PUBLISH
+  uint8_t *buffer;
+  uint16_t buffer_len;
+  uint16_t buffer_size;
+  uint32_t remaining;     // bytes of the current packet still to come
+  uint32_t offset;        // payload bytes of a large PUBLISH delivered so far,
+                          // or topic and id bytes still to come in MQTT_RX_ID
+  uint32_t total;         // payload length of a large PUBLISH
+  uint16_t msg_id;        // of a PUBLISH acknowledged without being delivered
+} mqtt_rx_t;
+
 typedef struct mqtt_state_t
 {
   uint16_t port;
@@ -50,7 +83,8 @@ typedef struct mqtt_state_t
   uint16_t message_length;
   uint16_t message_length_read;
   mqtt_connection_t mqtt_connection;
-  msg_queue_t* pending_msg_q;
+  msg_queue_list_t pending_msg_q;
+  mqtt_rx_t rx;
 } mqtt_state_t;
 
 typedef struct lmqtt_userdata
@@ -64,10 +98,14 @@ typedef struct lmqtt_userdata
   int cb_suback_ref;
   int cb_unsuback_ref;
   int cb_puback_ref;
+  int cb_queuefull_ref;
+  int cb_data_ref;
   mqtt_state_t  mqtt_state;
   mqtt_connect_info_t connect_info;
   uint16_t keep_alive_tick;
   uint32_t event_timeout;
+  uint8_t *send_batch;  // coalesced packets, kept until the sent callback
+  uint16_t sent_count;  // queue entries covered by the last send
 #ifdef CLIENT_SSL_ENABLE
   uint8_t secure;
 #endif
@@ -222,6 +260,23 @@ static void mqtt_connack_fail(lmqtt_userdata * mud, int reason_code)
   lua_call(L, 2, 0);
 }
 
+// QoS 0 publishes, acks and pings are finished once they are on the wire.
+static bool mqtt_done_on_send(msg_queue_t *node)
+{
+  return (node->msg_type == MQTT_MSG_TYPE_PUBLISH && node->publish_qos == 0) ||
+         node->msg_type == MQTT_MSG_TYPE_PUBACK ||
+         node->msg_type == MQTT_MSG_TYPE_PUBCOMP ||
+         node->msg_type == MQTT_MSG_TYPE_PINGREQ;
+}
+
+static void mqtt_batch_release(lmqtt_userdata *mud)
+{
+  if(mud->send_batch){
+    c_free(mud->send_batch);
+    mud->send_batch = NULL;
+  }
+}
+
 static sint8 mqtt_send_if_possible(struct espconn *pesp_conn)
 {
   if(pesp_conn == NULL)
@@ -237,17 +292,50 @@ static sint8 mqtt_send_if_possible(struct espconn *pesp_conn)
   if (mud->event_timeout == 0) {
     msg_queue_t *pending_msg = msg_peek(&(mud->mqtt_state.pending_msg_q));
     if (pending_msg) {
+      uint8_t *data = pending_msg->msg.data;
+      uint16_t length = pending_msg->msg.length;
+      uint16_t count = 1;
+      msg_queue_t *last = pending_msg;
+      uint16_t limit = MQTT_BATCH_SIZE;
+#ifdef CLIENT_SSL_ENABLE
+      if (mud->secure)
+        limit = MQTT_SECURE_BATCH_SIZE;
+#endif
+      // Packets that complete on transmission can be followed by more packets
+      // in the same send; anything awaiting a broker reply ends the batch.
+      while (mqtt_done_on_send(last) && last->next &&
+             length + last->next->msg.length <= limit) {
+        last = last->next;
+        length += last->msg.length;
+        count++;
+      }
+      mqtt_batch_release(mud);
+      if (count > 1) {
+        mud->send_batch = (uint8_t *)c_malloc(length);
+        if (mud->send_batch) {
+          msg_queue_t *node = pending_msg;
+          data = mud->send_batch;
+          for (length = 0; node != last->next; node = node->next) {
+            c_memcpy(data + length, node->msg.data, node->msg.length);
+            length += node->msg.length;
+          }
+        } else {
+          length = pending_msg->msg.length;
+          count = 1;
+        }
+      }
+      mud->sent_count = count;
       mud->event_timeout = MQTT_SEND_TIMEOUT;
-      NODE_DBG("Sent: %d\n", pending_msg->msg.length);
+      NODE_DBG("Sent: %d in %d packets\n", length, count);
 #ifdef CLIENT_SSL_ENABLE
       if( mud->secure )
       {
-        espconn_status = espconn_secure_send( pesp_conn, pending_msg->msg.data, pending_msg->msg.length );
+        espconn_status = espconn_secure_send( pesp_conn, data, length );
       }
       else
 #endif
       {
-        espconn_status = espconn_send( pesp_conn, pending_msg->msg.data, pending_msg->msg.length );
+        espconn_status = espconn_send( pesp_conn, data, length );
       }
       mud->keep_alive_tick = 0;
     }
@@ -256,31 +344,78 @@ static sint8 mqtt_send_if_possible(struct espconn *pesp_conn)
   return espconn_status;
 }
 
-static void mqtt_socket_received(void *arg, char *pdata, unsigned short len)
+static void mqtt_rx_reset(lmqtt_userdata *mud)
 {
-  NODE_DBG("enter mqtt_socket_received.\n");
+  mqtt_rx_t *rx = &mud->mqtt_state.rx;
+  if(rx->buffer)
+    c_free(rx->buffer);
+  c_memset(rx, 0, sizeof(*rx));
+}
 
-  uint8_t msg_type;
-  uint8_t msg_qos;
-  uint16_t msg_id;
-  int length = (int)len;
-  // uint8_t in_buffer[MQTT_BUF_SIZE];
-  uint8_t *in_buffer = (uint8_t *)pdata;
+// Returns the fixed header length of the packet in buf and stores its
+// remaining length; 0 if more bytes are needed, -1 if it is malformed.
+static int mqtt_fixed_header(const uint8_t *buf, int len, uint32_t *remaining)
+{
+  uint32_t value = 0;
+  int i;
+  for(i = 1; i < len && i <= 4; ++i)
+  {
+    value |= (uint32_t)(buf[i] & 0x7f) << (7 * (i - 1));
+    if((buf[i] & 0x80) == 0)
+    {
+      *remaining = value;
+      return i + 1;
+    }
+  }
+  return (i > 4) ? -1 : 0;
+}
 
-  struct espconn *pesp_conn = arg;
-  if(pesp_conn == NULL)
-    return;
-  lmqtt_userdata *mud = (lmqtt_userdata *)pesp_conn->reverse;
-  if(mud == NULL)
+static void mqtt_ack_publish(lmqtt_userdata *mud, int msg_qos, uint16_t msg_id)
+{
+  uint8_t temp_buffer[MQTT_ACK_BUF_SIZE];
+  mqtt_msg_init(&mud->mqtt_state.mqtt_connection, temp_buffer, MQTT_ACK_BUF_SIZE);
+  mqtt_message_t *temp_msg;
+  if(msg_qos == 1){
+    temp_msg = mqtt_msg_puback(&mud->mqtt_state.mqtt_connection, msg_id);
+    msg_enqueue(&(mud->mqtt_state.pending_msg_q), temp_msg,
+              msg_id, MQTT_MSG_TYPE_PUBACK, (int)mqtt_get_qos(temp_msg->data) );
+  }
+  else if(msg_qos == 2){
+    temp_msg = mqtt_msg_pubrec(&mud->mqtt_state.mqtt_connection, msg_id);
+    msg_enqueue(&(mud->mqtt_state.pending_msg_q), temp_msg,
+              msg_id, MQTT_MSG_TYPE_PUBREC, (int)mqtt_get_qos(temp_msg->data) );
+  }
+  if(msg_qos == 1 || msg_qos == 2){
+    NODE_DBG("MQTT: Queue response QoS: %d\r\n", msg_qos);
+  }
+}
+
+// Passes one piece of a large PUBLISH payload to the "data" callback.
+static void mqtt_deliver_chunk(lmqtt_userdata *mud, const uint8_t *data, uint32_t len, uint32_t offset)
+{
+  mqtt_rx_t *rx = &mud->mqtt_state.rx;
+  if(mud->cb_data_ref == LUA_NOREF || mud->self_ref == LUA_NOREF)
     return;
+  lua_State *L = lua_getstate();
+  lua_rawgeti(L, LUA_REGISTRYINDEX, mud->cb_data_ref);
+  lua_rawgeti(L, LUA_REGISTRYINDEX, mud->self_ref);  // pass the userdata to callback func in lua
+  lua_pushlstring(L, (const char *)rx->buffer + 2, (rx->buffer[0] << 8) | rx->buffer[1]);
+  lua_pushlstring(L, (const char *)data, len);
+  lua_pushinteger(L, offset);
+  lua_pushinteger(L, rx->total);
+  lua_call(L, 5, 0);
+}
 
-READPACKET:
-  if(length > MQTT_BUF_SIZE || length <= 0)
-          return;
+// Handles one complete packet.
+static void mqtt_handle_packet(lmqtt_userdata *mud, uint8_t *in_buffer, int length)
+{
+  uint8_t msg_type;
+  uint8_t msg_qos;
+  uint16_t msg_id;
+  struct espconn *pesp_conn = mud->pesp_conn;
 
-  // c_memcpy(in_buffer, pdata, length);
-  uint8_t temp_buffer[MQTT_BUF_SIZE];
-  mqtt_msg_init(&mud->mqtt_state.mqtt_connection, temp_buffer, MQTT_BUF_SIZE);
+  uint8_t temp_buffer[MQTT_ACK_BUF_SIZE];
+  mqtt_msg_init(&mud->mqtt_state.mqtt_connection, temp_buffer, MQTT_ACK_BUF_SIZE);
   mqtt_message_t *temp_msg = NULL;
 
   lua_State *L = lua_getstate();
@@ -360,7 +495,8 @@ READPACKET:
         case MQTT_MSG_TYPE_SUBACK:
           if(pending_msg && pending_msg->msg_type == MQTT_MSG_TYPE_SUBSCRIBE && pending_msg->msg_id == msg_id){
             NODE_DBG("MQTT: Subscribe successful\r\n");
-            msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
+            msg_drop(&(mud->mqtt_state.pending_msg_q));
+            mud->event_timeout = 0;  // answered, the next packet can go
             if (mud->cb_suback_ref == LUA_NOREF)
               break;
             if (mud->self_ref == LUA_NOREF)
@@ -373,7 +509,8 @@ READPACKET:
         case MQTT_MSG_TYPE_UNSUBACK:
           if(pending_msg && pending_msg->msg_type == MQTT_MSG_TYPE_UNSUBSCRIBE && pending_msg->msg_id == msg_id){
             NODE_DBG("MQTT: UnSubscribe successful\r\n");
-            msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
+            msg_drop(&(mud->mqtt_state.pending_msg_q));
+            mud->event_timeout = 0;
 
             if (mud->cb_unsuback_ref == LUA_NOREF)
               break;
@@ -385,25 +522,14 @@ READPACKET:
           }
           break;
         case MQTT_MSG_TYPE_PUBLISH:
-          if(msg_qos == 1){
-            temp_msg = mqtt_msg_puback(&mud->mqtt_state.mqtt_connection, msg_id);
-            msg_enqueue(&(mud->mqtt_state.pending_msg_q), temp_msg,
-                      msg_id, MQTT_MSG_TYPE_PUBACK, (int)mqtt_get_qos(temp_msg->data) );
-          }
-          else if(msg_qos == 2){
-            temp_msg = mqtt_msg_pubrec(&mud->mqtt_state.mqtt_connection, msg_id);
-            msg_enqueue(&(mud->mqtt_state.pending_msg_q), temp_msg,
-                      msg_id, MQTT_MSG_TYPE_PUBREC, (int)mqtt_get_qos(temp_msg->data) );
-          }
-          if(msg_qos == 1 || msg_qos == 2){
-            NODE_DBG("MQTT: Queue response QoS: %d\r\n", msg_qos);
-          }
+          mqtt_ack_publish(mud, msg_qos, msg_id);
           deliver_publish(mud, in_buffer, mud->mqtt_state.message_length);
           break;
         case MQTT_MSG_TYPE_PUBACK:
           if(pending_msg && pending_msg->msg_type == MQTT_MSG_TYPE_PUBLISH && pending_msg->msg_id == msg_id){
             NODE_DBG("MQTT: Publish with QoS = 1 successful\r\n");
-            msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
+            msg_drop(&(mud->mqtt_state.pending_msg_q));
+            mud->event_timeout = 0;
             if(mud->cb_puback_ref == LUA_NOREF)
               break;
             if(mud->self_ref == LUA_NOREF)
@@ -418,7 +544,8 @@ READPACKET:
           if(pending_msg && pending_msg->msg_type == MQTT_MSG_TYPE_PUBLISH && pending_msg->msg_id == msg_id){
             NODE_DBG("MQTT: Publish  with QoS = 2 Received PUBREC\r\n");
             // Note: actually, should not destroy the msg until PUBCOMP is received.
-            msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
+            msg_drop(&(mud->mqtt_state.pending_msg_q));
+            mud->event_timeout = 0;
             temp_msg = mqtt_msg_pubrel(&mud->mqtt_state.mqtt_connection, msg_id);
             msg_enqueue(&(mud->mqtt_state.pending_msg_q), temp_msg,
                       msg_id, MQTT_MSG_TYPE_PUBREL, (int)mqtt_get_qos(temp_msg->data) );
@@ -427,7 +554,8 @@ READPACKET:
           break;
         case MQTT_MSG_TYPE_PUBREL:
           if(pending_msg && pending_msg->msg_type == MQTT_MSG_TYPE_PUBREC && pending_msg->msg_id == msg_id){
-            msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
+            msg_drop(&(mud->mqtt_state.pending_msg_q));
+            mud->event_timeout = 0;
             temp_msg = mqtt_msg_pubcomp(&mud->mqtt_state.mqtt_connection, msg_id);
             msg_enqueue(&(mud->mqtt_state.pending_msg_q), temp_msg,
                       msg_id, MQTT_MSG_TYPE_PUBCOMP, (int)mqtt_get_qos(temp_msg->data) );
@@ -437,7 +565,8 @@ READPACKET:
         case MQTT_MSG_TYPE_PUBCOMP:
           if(pending_msg && pending_msg->msg_type == MQTT_MSG_TYPE_PUBREL && pending_msg->msg_id == msg_id){
             NODE_DBG("MQTT: Publish  with QoS = 2 successful\r\n");
-            msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
+            msg_drop(&(mud->mqtt_state.pending_msg_q));
+            mud->event_timeout = 0;
             if(mud->cb_puback_ref == LUA_NOREF)
               break;
             if(mud->self_ref == LUA_NOREF)
@@ -459,24 +588,208 @@ READPACKET:
           NODE_DBG("MQTT: PINGRESP received\r\n");
           break;
       }
-      // NOTE: this is done down here and not in the switch case above
-      // because the PSOCK_READBUF_LEN() won't work inside a switch
-      // statement due to the way protothreads resume.
-      if(msg_type == MQTT_MSG_TYPE_PUBLISH)
-      {
+      break;
+  }
+}
+
+static void mqtt_rx_finish(lmqtt_userdata *mud)
+{
+  mqtt_rx_t *rx = &mud->mqtt_state.rx;
+  uint8_t state = rx->state;
+  uint8_t *buffer = rx->buffer;
+  uint16_t buffer_len = rx->buffer_len;
+  int msg_qos = mqtt_get_qos(rx->header);
+  uint16_t msg_id = rx->msg_id;
+
+  // detach first, the handlers may call back into Lua and close the client
+  rx->buffer = NULL;
+  mqtt_rx_reset(mud);
+
+  if(state == MQTT_RX_PACKET) {
+    mqtt_handle_packet(mud, buffer, buffer_len);
+  } else if(state == MQTT_RX_STREAM && msg_qos > 0) {
+    mqtt_ack_publish(mud, msg_qos, (buffer[buffer_len - 2] << 8) | buffer[buffer_len - 1]);
+  } else if(state == MQTT_RX_ID) {
+    mqtt_ack_publish(mud, msg_qos, msg_id);
+  }
+  if(buffer)
+    c_free(buffer);
+}
+
+// Consumes the start of a large PUBLISH up to the end of its topic and
+// message id; returns the number of bytes used.
+static int mqtt_rx_topic(lmqtt_userdata *mud, const uint8_t *in, int length)
+{
+  mqtt_rx_t *rx = &mud->mqtt_state.rx;
+  int n = 1;
+
+  if(rx->buffer == NULL) {
+    // the first two bytes give the topic length
+    rx->header[rx->header_len++] = *in;
+    if(rx->header_len < rx->fixed_len + 2)
+      return n;
+    uint32_t size = 2 + ((rx->header[rx->fixed_len] << 8) | rx->header[rx->fixed_len + 1]);
+    if(mqtt_get_qos(rx->header) > 0)
+      size += 2;
+    if(size > MQTT_BUF_SIZE || size > rx->remaining ||
+       (rx->buffer = (uint8_t *)c_malloc(size)) == NULL) {
+      NODE_DBG("MQTT: dropping PUBLISH\r\n");
+      if(mqtt_get_qos(rx->header) > 0 && size - 2 < rx->remaining) {
+        // still acknowledged, or the broker would keep sending it again
+        rx->offset = size - 2;
+        rx->state = MQTT_RX_ID;
+      } else {
+        rx->state = MQTT_RX_SKIP;
+      }
+      return n;
+    }
+    c_memcpy(rx->buffer, rx->header + rx->fixed_len, 2);
+    rx->buffer_len = 2;
+    rx->buffer_size = size;
+  } else {
+    n = rx->buffer_size - rx->buffer_len;
+    if(n > length)
+      n = length;
+    c_memcpy(rx->buffer + rx->buffer_len, in, n);
+    rx->buffer_len += n;
+  }
+  if(rx->buffer_len == rx->buffer_size) {
+    rx->state = MQTT_RX_STREAM;
+    rx->offset = 0;
+    rx->total = rx->remaining - n;
+  }
+  return n;
+}
+
+// Skips the topic of a PUBLISH that is not delivered, keeping the message id
+// which follows it; returns the number of bytes used.
+static int mqtt_rx_id(mqtt_rx_t *rx, const uint8_t *in, int length)
+{
+  if(rx->offset > 2) {
+    if((uint32_t)length > rx->offset - 2)
+      length = rx->offset - 2;
+    rx->offset -= length;
+    return length;
+  }
+  if(rx->offset > 0) {
+    rx->msg_id = (rx->msg_id << 8) | *in;
+    rx->offset--;
+    return 1;
+  }
+  return length;
+}
+
+static void mqtt_socket_received(void *arg, char *pdata, unsigned short len)
+{
+  NODE_DBG("enter mqtt_socket_received.\n");
+
+  uint8_t *in_buffer = (uint8_t *)pdata;
+  int length = (int)len;
+  uint32_t remaining;
+  int n;
 
-        length = mud->mqtt_state.message_length_read;
+  struct espconn *pesp_conn = arg;
+  if(pesp_conn == NULL)
+    return;
+  lmqtt_userdata *mud = (lmqtt_userdata *)pesp_conn->reverse;
+  if(mud == NULL)
+    return;
+  mqtt_rx_t *rx = &mud->mqtt_state.rx;
 
-        if(mud->mqtt_state.message_length < mud->mqtt_state.message_length_read)
+  // A callback may close the client, stop once it has.
+  while(length > 0 && mud->connected && mud->pesp_conn == pesp_conn)
+  {
+    if(rx->state == MQTT_RX_HEADER)
+    {
+      if(rx->header_len == 0)
+      {
+        // fast path: the whole packet is in this segment
+        n = mqtt_fixed_header(in_buffer, length, &remaining);
+        if(n > 0 && remaining <= MQTT_BUF_SIZE - n && n + remaining <= length)
         {
-            length -= mud->mqtt_state.message_length;
-            in_buffer += mud->mqtt_state.message_length;
+          mqtt_handle_packet(mud, in_buffer, n + remaining);
+          in_buffer += n + remaining;
+          length -= n + remaining;
+          continue;
+        }
+      }
 
-            NODE_DBG("Get another published message\r\n");
-            goto READPACKET;
+      rx->header[rx->header_len++] = *in_buffer++;
+      length--;
+      n = mqtt_fixed_header(rx->header, rx->header_len, &remaining);
+      if(n == 0)
+        continue;
+      if(n < 0)
+      {
+        NODE_DBG("MQTT: Invalid packet\r\n");
+        mqtt_rx_reset(mud);
+#ifdef CLIENT_SSL_ENABLE
+        if(mud->secure)
+        {
+          espconn_secure_disconnect(pesp_conn);
+        }
+        else
+#endif
+        {
+          espconn_disconnect(pesp_conn);
         }
+        return;
       }
-      break;
+
+      rx->fixed_len = n;
+      rx->remaining = remaining;
+      if(remaining <= MQTT_BUF_SIZE - n &&
+         (rx->buffer = (uint8_t *)c_malloc(n + remaining)) != NULL)
+      {
+        c_memcpy(rx->buffer, rx->header, n);
+        rx->buffer_len = n;
+        rx->buffer_size = n + remaining;
+        rx->state = MQTT_RX_PACKET;
+      }
+      else if(mqtt_get_type(rx->header) == MQTT_MSG_TYPE_PUBLISH)
+      {
+        rx->state = MQTT_RX_TOPIC;
+      }
+      else
+      {
+        NODE_DBG("MQTT: dropping packet of %d bytes\r\n", remaining);
+        rx->state = MQTT_RX_SKIP;
+      }
+    }
+    else
+    {
+      n = (uint32_t)length < rx->remaining ? length : (int)rx->remaining;
+      switch(rx->state)
+      {
+        case MQTT_RX_PACKET:
+          c_memcpy(rx->buffer + rx->buffer_len, in_buffer, n);
+          rx->buffer_len += n;
+          break;
+        case MQTT_RX_TOPIC:
+          n = mqtt_rx_topic(mud, in_buffer, n);
+          break;
+        case MQTT_RX_ID:
+          n = mqtt_rx_id(rx, in_buffer, n);
+          break;
+        case MQTT_RX_STREAM:
+          rx->offset += n;
+          rx->remaining -= n;
+          mqtt_deliver_chunk(mud, in_buffer, n, rx->offset - n);
+          in_buffer += n;
+          length -= n;
+          n = 0;
+          break;
+        default:
+          break;
+      }
+      in_buffer += n;
+      length -= n;
+      rx->remaining -= n;
+    }
+
+    if(rx->state != MQTT_RX_HEADER && rx->remaining == 0 &&
+       mud->connected && mud->pesp_conn == pesp_conn)
+      mqtt_rx_finish(mud);
   }
 
   mqtt_send_if_possible(pesp_conn);
@@ -506,25 +819,35 @@ static void mqtt_socket_sent(void *arg)
     return;
   }
   NODE_DBG("sent1, queue size: %d\n", msg_size(&(mud->mqtt_state.pending_msg_q)));
-  uint8_t try_send = 1;
-  // qos = 0, publish and forgot.
-  msg_queue_t *node = msg_peek(&(mud->mqtt_state.pending_msg_q));
-  if(node && node->msg_type == MQTT_MSG_TYPE_PUBLISH && node->publish_qos == 0) {
-    msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
-    if(mud->cb_puback_ref != LUA_NOREF && mud->self_ref != LUA_NOREF) {
-      lua_State *L = lua_getstate();
+  uint8_t try_send = 0;
+  int published = 0;
+  // Release the packets of the last send that need no reply; a packet that
+  // awaits a reply stays at the head of the queue.
+  while(mud->sent_count > 0) {
+    msg_queue_t *node = msg_peek(&(mud->mqtt_state.pending_msg_q));
+    if(!node || !mqtt_done_on_send(node))
+      break;
+    if(node->msg_type == MQTT_MSG_TYPE_PUBLISH)
+      published++;  // qos = 0, publish and forgot.
+    msg_drop(&(mud->mqtt_state.pending_msg_q));
+    mud->sent_count--;
+    try_send = 1;
+  }
+  if(mud->sent_count > 0) {
+    // The packet that ended the send waits for its reply, which sends the
+    // next ones, or for the timeout; it must not go out again before that.
+    mud->event_timeout = MQTT_SEND_TIMEOUT;
+    try_send = 0;
+  }
+  mud->sent_count = 0;
+  mqtt_batch_release(mud);
+  if(mud->cb_puback_ref != LUA_NOREF && mud->self_ref != LUA_NOREF) {
+    lua_State *L = lua_getstate();
+    while(published-- > 0) {
       lua_rawgeti(L, LUA_REGISTRYINDEX, mud->cb_puback_ref);
       lua_rawgeti(L, LUA_REGISTRYINDEX, mud->self_ref);  // pass the userdata to callback func in lua
       lua_call(L, 1, 0);
     }
-  } else if(node && node->msg_type == MQTT_MSG_TYPE_PUBACK) {
-    msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
-  } else if(node && node->msg_type == MQTT_MSG_TYPE_PUBCOMP) {
-    msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
-  } else if(node && node->msg_type == MQTT_MSG_TYPE_PINGREQ) {
-    msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
-  } else {
-    try_send = 0;
   }
   if (try_send) {
     mqtt_send_if_possible(mud->pesp_conn);
@@ -543,6 +866,7 @@ static void mqtt_socket_connected(void *arg)
   if(mud == NULL)
     return;
   mud->connected = true;
+  mqtt_rx_reset(mud);
   espconn_regist_recvcb(pesp_conn, mqtt_socket_received);
   espconn_regist_sentcb(pesp_conn, mqtt_socket_sent);
   espconn_regist_disconcb(pesp_conn, mqtt_socket_disconnected);
@@ -592,10 +916,14 @@ void mqtt_socket_timer(void *arg)
       return;
     } else {
       NODE_DBG("event timeout. \n");
-      if(mud->connState == MQTT_DATA)
-        msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
-      // should remove the head of the queue and re-send with DUP = 1
-      // Not implemented yet.
+      if(mud->connState == MQTT_DATA){
+        msg_queue_t *pending_msg = msg_peek(&(mud->mqtt_state.pending_msg_q));
+        if(pending_msg && pending_msg->msg_type == MQTT_MSG_TYPE_PUBLISH && pending_msg->publish_qos > 0)
+          pending_msg->msg.data[0] |= 0x08;  // sent again below, with DUP = 1
+        else
+          msg_drop(&(mud->mqtt_state.pending_msg_q));
+      }
+      mud->sent_count = 0;
     }
   }
 
@@ -663,7 +991,21 @@ void mqtt_socket_timer(void *arg)
   NODE_DBG("leave mqtt_socket_timer.\n");
 }
 
-// Lua: mqtt.Client(clientid, keepalive, user, pass, clean_session)
+// Called by the pending queue when a publish/subscribe is refused, so that
+// the application can back off until its earlier messages are acknowledged.
+static void mqtt_queue_full(msg_queue_list_t *q, void *arg)
+{
+  lmqtt_userdata *mud = (lmqtt_userdata *)arg;
+  if(mud == NULL || mud->cb_queuefull_ref == LUA_NOREF || mud->self_ref == LUA_NOREF)
+    return;
+  lua_State *L = lua_getstate();
+  lua_rawgeti(L, LUA_REGISTRYINDEX, mud->cb_queuefull_ref);
+  lua_rawgeti(L, LUA_REGISTRYINDEX, mud->self_ref);  // pass the userdata to callback func in lua
+  lua_pushinteger(L, msg_size(q));
+  lua_call(L, 2, 0);
+}
+
+// Lua: mqtt.Client(clientid, keepalive, user, pass, clean_session, max_queue)
 static int mqtt_socket_client( lua_State* L )
 {
   NODE_DBG("enter mqtt_socket_client.\n");
@@ -680,6 +1022,7 @@ static int mqtt_socket_client( lua_State* L )
   int keepalive = 0;
   int stack = 1;
   int clean_session = 1;
+  int max_queue = 0;
   int top = lua_gettop(L);
 
   // create a object
@@ -695,6 +1038,8 @@ static int mqtt_socket_client( lua_State* L )
   mud->cb_suback_ref = LUA_NOREF;
   mud->cb_unsuback_ref = LUA_NOREF;
   mud->cb_puback_ref = LUA_NOREF;
+  mud->cb_queuefull_ref = LUA_NOREF;
+  mud->cb_data_ref = LUA_NOREF;
 
   mud->connState = MQTT_INIT;
 
@@ -744,6 +1089,16 @@ static int mqtt_socket_client( lua_State* L )
     clean_session = 1;
   }
 
+  if(lua_isnumber( L, stack ))
+  {
+    max_queue = luaL_checkinteger( L, stack);
+    stack++;
+  }
+
+  if(max_queue < 0 || max_queue > 0xffff){
+    max_queue = 0;
+  }
+
   // TODO: check the zalloc result.
   mud->connect_info.client_id = (uint8_t *)c_zalloc(idl+1);
   mud->connect_info.username = (uint8_t *)c_zalloc(unl + 1);
@@ -778,7 +1133,7 @@ static int mqtt_socket_client( lua_State* L )
   mud->connect_info.will_retain = 0;
   mud->connect_info.keepalive = keepalive;
 
-  mud->mqtt_state.pending_msg_q = NULL;
+  msg_queue_init(&(mud->mqtt_state.pending_msg_q), max_queue, mqtt_queue_full, mud);
   mud->mqtt_state.auto_reconnect = 0;
   mud->mqtt_state.port = 1883;
   mud->mqtt_state.connect_info = &mud->connect_info;
@@ -813,9 +1168,10 @@ static int mqtt_delete( lua_State* L )
     c_free(mud->pesp_conn);
     mud->pesp_conn = NULL;    // for socket, it will free this when disconnected
   }
-  while(mud->mqtt_state.pending_msg_q) {
-    msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
-  }
+  msg_queue_free(&(mud->mqtt_state.pending_msg_q));
+  mqtt_batch_release(mud);
+  mqtt_rx_reset(mud);
+  mud->sent_count = 0;
 
   // ---- alloc-ed in mqtt_socket_lwt()
   if(mud->connect_info.will_topic){
@@ -859,6 +1215,10 @@ static int mqtt_delete( lua_State* L )
   mud->cb_unsuback_ref = LUA_NOREF;
   luaL_unref(L, LUA_REGISTRYINDEX, mud->cb_puback_ref);
   mud->cb_puback_ref = LUA_NOREF;
+  luaL_unref(L, LUA_REGISTRYINDEX, mud->cb_queuefull_ref);
+  mud->cb_queuefull_ref = LUA_NOREF;
+  luaL_unref(L, LUA_REGISTRYINDEX, mud->cb_data_ref);
+  mud->cb_data_ref = LUA_NOREF;
   lua_gc(L, LUA_GCSTOP, 0);
   luaL_unref(L, LUA_REGISTRYINDEX, mud->self_ref);
   mud->self_ref = LUA_NOREF;
@@ -1151,9 +1511,10 @@ static int mqtt_socket_close( lua_State* L )
   }
   mud->connected = 0;
 
-  while (mud->mqtt_state.pending_msg_q) {
-    msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
-  }
+  msg_queue_free(&(mud->mqtt_state.pending_msg_q));
+  mqtt_batch_release(mud);
+  mqtt_rx_reset(mud);
+  mud->sent_count = 0;
 
   NODE_DBG("leave mqtt_socket_close.\n");
 
@@ -1195,6 +1556,12 @@ static int mqtt_socket_on( lua_State* L )
   }else if( sl == 7 && c_strcmp(method, "message") == 0){
     luaL_unref(L, LUA_REGISTRYINDEX, mud->cb_message_ref);
     mud->cb_message_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  }else if( sl == 4 && c_strcmp(method, "data") == 0){
+    luaL_unref(L, LUA_REGISTRYINDEX, mud->cb_data_ref);
+    mud->cb_data_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  }else if( sl == 9 && c_strcmp(method, "queuefull") == 0){
+    luaL_unref(L, LUA_REGISTRYINDEX, mud->cb_queuefull_ref);
+    mud->cb_queuefull_ref = luaL_ref(L, LUA_REGISTRYINDEX);
   }else{
     lua_pop(L, 1);
     return luaL_error( L, "method not supported" );
@@ -1298,7 +1665,9 @@ static int mqtt_socket_unsubscribe( lua_State* L ) {
   msg_queue_t *node = msg_enqueue( &(mud->mqtt_state.pending_msg_q), temp_msg,
                                    msg_id, MQTT_MSG_TYPE_UNSUBSCRIBE, (int)mqtt_get_qos(temp_msg->data) );
 
-  NODE_DBG("topic: %s - id: %d - qos: %d, length: %d\n", topic, node->msg_id, node->publish_qos, node->msg.length);
+  if(node) {
+    NODE_DBG("topic: %s - id: %d - qos: %d, length: %d\n", topic, node->msg_id, node->publish_qos, node->msg.length);
+  }
   NODE_DBG("msg_size: %d, event_timeout: %d\n", msg_size(&(mud->mqtt_state.pending_msg_q)), mud->event_timeout);
 
   sint8 espconn_status = ESPCONN_IF;
@@ -1413,7 +1782,9 @@ static int mqtt_socket_subscribe( lua_State* L ) {
   msg_queue_t *node = msg_enqueue( &(mud->mqtt_state.pending_msg_q), temp_msg,
                                    msg_id, MQTT_MSG_TYPE_SUBSCRIBE, (int)mqtt_get_qos(temp_msg->data) );
 
-  NODE_DBG("topic: %s - id: %d - qos: %d, length: %d\n", topic, node->msg_id, node->publish_qos, node->msg.length);
+  if(node) {
+    NODE_DBG("topic: %s - id: %d - qos: %d, length: %d\n", topic, node->msg_id, node->publish_qos, node->msg.length);
+  }
   NODE_DBG("msg_size: %d, event_timeout: %d\n", msg_size(&(mud->mqtt_state.pending_msg_q)), mud->event_timeout);
 
   sint8 espconn_status = ESPCONN_IF;
@@ -1459,7 +1830,8 @@ static int mqtt_socket_publish( lua_State* L )
     return luaL_error( L, "not connected" );
   }
 
-  const char *topic = luaL_checklstring( L, stack, &l );
+  size_t tl;
+  const char *topic = luaL_checklstring( L, stack, &tl );
   stack ++;
   if (topic == NULL){
     return luaL_error( L, "need topic" );
@@ -1472,12 +1844,12 @@ static int mqtt_socket_publish( lua_State* L )
   uint8_t retain = luaL_checkinteger( L, stack);
   stack ++;
 
-  uint8_t temp_buffer[MQTT_BUF_SIZE];
-  mqtt_msg_init(&mud->mqtt_state.mqtt_connection, temp_buffer, MQTT_BUF_SIZE);
-  mqtt_message_t *temp_msg = mqtt_msg_publish(&mud->mqtt_state.mqtt_connection,
-                       topic, payload, l,
-                       qos, retain,
-                       &msg_id);
+  // Serialise straight into the queue entry instead of a stack buffer.
+  // Fixed header (3) + topic length (2) + topic + message id (2) + payload.
+  size_t size = 3 + 2 + tl + (qos ? 2 : 0) + l;
+  if (size > 3 + 16383){
+    return luaL_error( L, "message too long" );
+  }
 
   if (lua_type(L, stack) == LUA_TFUNCTION || lua_type(L, stack) == LUA_TLIGHTFUNCTION){
     lua_pushvalue(L, stack);  // copy argument (func) to the top of stack
@@ -1485,8 +1857,16 @@ static int mqtt_socket_publish( lua_State* L )
     mud->cb_puback_ref = luaL_ref(L, LUA_REGISTRYINDEX);
   }
 
-  msg_queue_t *node = msg_enqueue(&(mud->mqtt_state.pending_msg_q), temp_msg,
+  msg_queue_t *node = msg_reserve(&(mud->mqtt_state.pending_msg_q), size, MQTT_MSG_TYPE_PUBLISH);
+  if(node){
+    mqtt_msg_init(&mud->mqtt_state.mqtt_connection, node->msg.data, size);
+    mqtt_message_t *temp_msg = mqtt_msg_publish(&mud->mqtt_state.mqtt_connection,
+                         topic, payload, l,
+                         qos, retain,
+                         &msg_id);
+    node = msg_commit(&(mud->mqtt_state.pending_msg_q), node, temp_msg,
                       msg_id, MQTT_MSG_TYPE_PUBLISH, (int)qos );
+  }
 
   sint8 espconn_status = ESPCONN_OK;
 
@@ -5,6 +5,7 @@
 
 #include "ldebug.h"
 #include "ldo.h"
+#include "lflash.h"
 #include "lfunc.h"
 #include "lmem.h"
 #include "lobject.h"
@@ -19,6 +20,7 @@
 #include "lrodefs.h"
 
 #include "c_types.h"
+#include "c_stdio.h"
 #include "c_string.h"
 #include "driver/uart.h"
 #include "user_interface.h"
@@ -222,84 +224,6 @@ static int node_output( lua_State* L )
   return 0;
 }
 
-static int writer(lua_State* L, const void* p, size_t size, void* u)
-{
-  UNUSED(L);
-  int file_fd = *( (int *)u );
-  if (!file_fd)
-    return 1;
-  NODE_DBG("get fd:%d,size:%d\n", file_fd, size);
-
-  if (size != 0 && (size != vfs_write(file_fd, (const char *)p, size)) )
-    return 1;
-  NODE_DBG("write fd:%d,size:%d\n", file_fd, size);
-  return 0;
-}
-
-#define toproto(L,i) (clvalue(L->top+(i))->l.p)
-// Lua: compile(filename) -- compile lua file into lua bytecode, and save to .lc
-static int node_compile( lua_State* L )
-{
-  Proto* f;
-  int file_fd = 0;
-  size_t len;
-  const char *fname = luaL_checklstring( L, 1, &len );
-  const char *basename = vfs_basename( fname );
-  luaL_argcheck(L, c_strlen(basename) <= FS_OBJ_NAME_LEN && c_strlen(fname) == len, 1, "filename invalid");
-
-  char *output = luaM_malloc( L, len+1 );
-  c_strcpy(output, fname);
-  // check here that filename end with ".lua".
-  if (len < 4 || (c_strcmp( output + len - 4, ".lua") != 0) ) {
-    luaM_free( L, output );
-    return luaL_error(L, "not a .lua file");
-  }
-
-  output[c_strlen(output) - 2] = 'c';
-  output[c_strlen(output) - 1] = '\0';
-  NODE_DBG(output);
-  NODE_DBG("\n");
-  if (luaL_loadfsfile(L, fname) != 0) {
-    luaM_free( L, output );
-    return luaL_error(L, lua_tostring(L, -1));
-  }
-
-  f = toproto(L, -1);
-
-  int stripping = 1;      /* strip debug information? */
-
-  file_fd = vfs_open(output, "w+");
-  if (!file_fd)
-  {
-    luaM_free( L, output );
-    return luaL_error(L, "cannot open/write to file");
-  }
-
-  lua_lock(L);
-  int result = luaU_dump(L, f, writer, &file_fd, stripping);
-  lua_unlock(L);
-
-  if (vfs_flush(file_fd) != VFS_RES_OK) {
-    // overwrite Lua error, like writer() does in case of a file io error
-    result = 1;
-  }
-  vfs_close(file_fd);
-  file_fd = 0;
-  luaM_free( L, output );
-
-  if (result == LUA_ERR_CC_INTOVERFLOW) {
-    return luaL_error(L, "value too big or small for target integer type");
-  }
-  if (result == LUA_ERR_CC_NOTINTEGER) {
-    return luaL_error(L, "target lua_Number is integral but fractional value found");
-  }
-  if (result == 1) {    // result status generated by writer() or fs_flush() fail
-    return luaL_error(L, "writing to file failed");
-  }
-
-  return 0;
-}
-
 // Task callback handler for node.task.post()
 static task_handle_t do_node_task_handle;
 static void do_node_task (task_param_t task_fn_ref, uint8_t prio)
@@ -439,6 +363,34 @@ static int node_stripdebug (lua_State *L) {
 }
 #endif
 
+#ifdef LUA_FLASH_STORE
+// Lua: node.flashreload(imagefile)
+//      node.flashreload(lcfile, ...)
+// Loads an image built by luac.cross -f, or compiled Lua files, into the Lua
+// flash store and restarts. Returns an error message if the input is rejected;
+// failures after the store has been erased are printed and restart the node
+// with an empty store.
+static int node_flashreload( lua_State* L )
+{
+  int i, erased, n = lua_gettop( L );
+  const char **files;
+  const char *err;
+  luaL_checkstring( L, 1 );
+  files = (const char **)lua_newuserdata( L, n * sizeof(const char *) );
+  for (i = 0; i < n; i++)
+    files[i] = luaL_checkstring( L, i + 1 );
+  err = luaN_reload( files, n, &erased );
+  if (err == NULL || erased) {
+    if (err)
+      c_printf( "flashreload: %s\n", err );
+    system_restart();
+    return 0;
+  }
+  lua_pushstring( L, err );
+  return 1;
+}
+#endif
+
 // Lua: node.egc.setmode( mode, [param])
 // where the mode is one of the node.egc constants  NOT_ACTIVE , ON_ALLOC_FAILURE,
 // ON_MEM_LIMIT, ALWAYS.  In the case of ON_MEM_LIMIT an integer parameter is reqired
@@ -453,6 +405,7 @@ static int node_egc_setmode(lua_State* L) {
   legc_set_mode( L, mode, limit );
   return 0;
 }
+
 //
 // Lua: osprint(true/false)
 // Allows you to turn on the native Espressif SDK printing
@@ -471,6 +424,9 @@ static int node_osprint( lua_State* L )
 
 static const LUA_REG_TYPE node_egc_map[] = {
   { LSTRKEY( "setmode" ),           LFUNCVAL( node_egc_setmode ) },
+#ifdef LUA_SLAB_ALLOC
+  { LSTRKEY( "slabinfo" ),          LFUNCVAL( luaL_slabinfo ) },
+#endif
   { LSTRKEY( "NOT_ACTIVE" ),        LNUMVAL( EGC_NOT_ACTIVE ) },
   { LSTRKEY( "ON_ALLOC_FAILURE" ),  LNUMVAL( EGC_ON_ALLOC_FAILURE ) },
   { LSTRKEY( "ON_MEM_LIMIT" ),      LNUMVAL( EGC_ON_MEM_LIMIT ) },
@@ -498,7 +454,7 @@ static const LUA_REG_TYPE node_map[] =
   { LSTRKEY( "output" ), LFUNCVAL( node_output ) },
 // Moved to adc module, use adc.readvdd33()
 // { LSTRKEY( "readvdd33" ), LFUNCVAL( node_readvdd33) },
-  { LSTRKEY( "compile" ), LFUNCVAL( node_compile) },
+  { LSTRKEY( "compile" ), LFUNCVAL( luaL_compilefsfile ) },
   { LSTRKEY( "CPU80MHZ" ), LNUMVAL( CPU80MHZ ) },
   { LSTRKEY( "CPU160MHZ" ), LNUMVAL( CPU160MHZ ) },
   { LSTRKEY( "setcpufreq" ), LFUNCVAL( node_setcpufreq) },
@@ -506,6 +462,13 @@ static const LUA_REG_TYPE node_map[] =
   { LSTRKEY( "restore" ), LFUNCVAL( node_restore) },
 #ifdef LUA_OPTIMIZE_DEBUG
   { LSTRKEY( "stripdebug" ), LFUNCVAL( node_stripdebug ) },
+#endif
+#ifdef LUA_FLASH_STORE
+  { LSTRKEY( "flashreload" ), LFUNCVAL( node_flashreload ) },
+  { LSTRKEY( "flashindex" ), LFUNCVAL( luaN_index ) },
+#endif
+#ifdef LUA_MEMPROFILE
+  { LSTRKEY( "memprofile" ), LFUNCVAL( luaM_memprofile ) },
 #endif
   { LSTRKEY( "egc" ),  LROVAL( node_egc_map ) },
   { LSTRKEY( "task" ), LROVAL( node_task_map ) },
@@ -4,6 +4,11 @@
 // 
 // perf.start(start, end, nbins[, pc offset on stack])
 // perf.stop()  -> total sample, samples outside range, table { addr -> count , .. }
+//
+// It can also sample the line of Lua code being run instead of the PC:
+//
+// perf.start("lua"[, nslots])
+// perf.stop()  -> total sample, samples outside Lua, table { "source:line" -> count, .. }
 
 
 #include "ets_sys.h"
@@ -13,12 +18,34 @@
 
 #include "module.h"
 #include "lauxlib.h"
+#include "ldebug.h"
+#include "lobject.h"
+#include "lstate.h"
+#include "ltable.h"
 #include "platform.h"
 #include "hw_timer.h"
 #include "cpu_esp8266.h"
 
+// A Lua line, in the hash of lines which replaces the histogram in Lua mode
+typedef struct {
+  TString *source;
+  int line;
+  uint32_t count;
+} SLOT;
+
 typedef struct {
   int ref;
+  lua_State *L;           // sampled in Lua mode, NULL when sampling the PC
+  // Lua mode samples are counted without a lock: the timer only writes the
+  // first three, the hook only the last two
+  volatile uint32_t flagged;  // samples left to the hook
+  volatile uint32_t switched; // flagged when the hook last went to another thread
+  lua_State *volatile hooked; // that thread, only compared
+  uint32_t taken;         // flagged samples the hook has counted
+  uint32_t dropped;       // of those, the ones not counted against a line
+  uint32_t used;          // slots in use
+  int sources_ref;
+  Table *sources;         // set of the slots' sources, so they are not collected
   uint32_t start;
   uint32_t bucket_shift;
   uint32_t bucket_count;
@@ -33,12 +60,100 @@ extern char _flash_used_end[];
 
 #define TIMER_OWNER ((os_param_t) 'p')
 
+#define SLOTS(d) ((SLOT *) (d)->bucket)
+
+// Runs at the next Lua instruction after a sample and counts the samples
+// taken since against the line it is on
+static void lua_sample_hook(lua_State *L, lua_Debug *ar)
+{
+  (void) ar;
+  DATA *d = data;
+  lua_sethook(L, NULL, 0, 0);
+  if (!d || !d->L) {
+    return;
+  }
+
+  // The timer changes these together with flagged, so read them again
+  // until it did not run in between
+  uint32_t flagged, switched;
+  lua_State *hooked;
+  do {
+    flagged = d->flagged;
+    switched = d->switched;
+    hooked = d->hooked;
+  } while (flagged != d->flagged);
+
+  if ((int32_t) (switched - d->taken) > 0) {
+    // samples of a thread which yielded or returned to its resumer before
+    // running another instruction cannot be placed
+    d->dropped += switched - d->taken;
+    d->taken = switched;
+  }
+  if (hooked != L) {
+    return;
+  }
+  uint32_t n = flagged - d->taken;
+  d->taken = flagged;
+  if (!n) {
+    return;
+  }
+
+  Proto *p = ci_func(L->ci)->l.p;
+  TString *source = p->source;
+  int line = getline(p, pcRel(L->savedpc, p));
+
+  uint32_t mask = d->bucket_count - 1;
+  uint32_t h = (IntPoint(source) ^ line * 0x9E3779B1u) & mask;
+  SLOT *slot;
+  for (slot = SLOTS(d) + h; slot->count; slot = SLOTS(d) + h) {
+    if (slot->source == source && slot->line == line) {
+      slot->count += n;
+      return;
+    }
+    h = (h + 1) & mask;
+  }
+  // Leave a quarter of the slots free so that probes stay short
+  if (d->used >= d->bucket_count - d->bucket_count / 4) {
+    d->dropped += n;
+    return;
+  }
+  d->used++;
+  slot->source = source;
+  slot->line = line;
+  slot->count = n;
+  if (source) {
+    // Only allocates beyond the few sources the set is created for
+    TValue *o = luaH_setstr(L, d->sources, source);
+    setbvalue(o, 1);
+  }
+}
+
 static void ICACHE_RAM_ATTR hw_timer_cb(os_param_t p)
 {
   (void) p;
   uint32_t stackaddr;
 
-  if (data) {
+  if (data && data->L) {
+    // Only flags the sample: the Lua structures may be changing under us and
+    // the flash may be unavailable, so the hook, set up here by hand as
+    // lua_sethook() is in flash, finds the line once it is safe. It goes on
+    // the thread running now, which is a coroutine while one is resumed.
+    lua_State *L = G(data->L)->running;
+    if (L->ci != L->base_ci && (!L->hook || L->hook == lua_sample_hook)) {
+      if (data->hooked != L) {
+        data->switched = data->flagged;
+        data->hooked = L;
+      }
+      data->flagged++;
+      L->hook = lua_sample_hook;
+      L->basehookcount = 1;
+      L->hookcount = 1;
+      L->hookmask = LUA_MASKCOUNT;
+    } else {
+      data->outside_samples++;
+    }
+    data->total_samples++;
+  } else if (data) {
     uint32_t pc = *(&stackaddr + data->pc_offset);
 
     uint32_t bucket_number = (pc - data->start) >> data->bucket_shift;
@@ -51,8 +166,79 @@ static void ICACHE_RAM_ATTR hw_timer_cb(os_param_t p)
   }
 }
 
+// Gives up the data of a run, and the source strings it holds
+static void release_data(lua_State *L, DATA *d)
+{
+  if (d->L) {
+    lua_unref(L, d->sources_ref);
+  }
+  lua_unref(L, d->ref);
+}
+
+static DATA *new_data(lua_State *L, size_t data_size)
+{
+  DATA *d = (DATA *) lua_newuserdata(L, data_size);
+  memset(d, 0, data_size);
+  d->ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  return d;
+}
+
+static void start_timer(lua_State *L, DATA *d)
+{
+  DATA *old = data;
+
+  data = d;
+
+  if (old) {
+    release_data(L, old);
+  }
+
+  // Start the timer
+  if (!platform_hw_timer_init(TIMER_OWNER, NMI_SOURCE, TRUE)) {
+    // Failed to init the timer
+    data = NULL;
+    release_data(L, d);
+    luaL_error(L, "Unable to initialize timer");
+  }
+
+  platform_hw_timer_set_func(TIMER_OWNER, hw_timer_cb, 0);
+  platform_hw_timer_arm_us(TIMER_OWNER, 50);
+}
+
+static int perf_start_lua(lua_State *L)
+{
+  uint32_t slots = luaL_optinteger(L, 2, 128);
+
+  if (slots < 4 || slots > 4096) {
+    luaL_error(L, "nslots must be from 4 to 4096");
+  }
+
+  // Round up to a power of two
+  uint32_t n;
+  for (n = 4; n < slots; n <<= 1) {
+  }
+
+  DATA *d = new_data(L, sizeof(DATA) + n * sizeof(SLOT));
+  lua_createtable(L, 0, 4);
+  d->sources = hvalue(L->top - 1);
+  d->sources_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  d->L = G(L)->mainthread;
+  d->bucket_count = n;
+
+  start_timer(L, d);
+
+  return 0;
+}
+
 static int perf_start(lua_State *L)
 {
+  if (lua_type(L, 1) == LUA_TSTRING) {
+    if (strcmp(lua_tostring(L, 1), "lua") != 0) {
+      luaL_error(L, "unknown mode");
+    }
+    return perf_start_lua(L);
+  }
+
   uint32_t start = luaL_optinteger(L, 1, 0x40000000);
   uint32_t end = luaL_optinteger(L, 2, (uint32_t) _flash_used_end);
   uint32_t bins = luaL_optinteger(L, 3, 1024);
@@ -78,30 +264,13 @@ static int perf_start(lua_State *L)
   }
 
   size_t data_size = sizeof(DATA) + bins * sizeof(uint32_t);
-  DATA *d = (DATA *) lua_newuserdata(L, data_size);
-  memset(d, 0, data_size);
-  d->ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  DATA *d = new_data(L, data_size);
   d->start = start;
   d->bucket_shift = shift;
   d->bucket_count = bins;
   d->pc_offset = pc_offset;	
 
-  if (data) {
-    lua_unref(L, data->ref);
-  }
-
-  data = d;
-
-  // Start the timer
-  if (!platform_hw_timer_init(TIMER_OWNER, NMI_SOURCE, TRUE)) {
-    // Failed to init the timer
-    data = NULL;
-    lua_unref(L, d->ref);
-    luaL_error(L, "Unable to initialize timer");
-  }
-
-  platform_hw_timer_set_func(TIMER_OWNER, hw_timer_cb, 0);
-  platform_hw_timer_arm_us(TIMER_OWNER, 50);
+  start_timer(L, d);
 
   return 0;
 }
@@ -119,9 +288,41 @@ static int perf_stop(lua_State *L)
   data = NULL;
 
   lua_pushnumber(L, d->total_samples);
-  lua_pushnumber(L, d->outside_samples);
+  if (d->L) {
+    // with the samples the hook did not place, or has not taken yet
+    lua_pushnumber(L, d->outside_samples + d->dropped + (d->flagged - d->taken));
+  } else {
+    lua_pushnumber(L, d->outside_samples);
+  }
   lua_newtable(L);
   int i;
+
+  if (d->L) {
+    // The hook may still be set for the last samples, counted as outside;
+    // one left on a suspended coroutine removes itself when that runs again
+    if (L->hook == lua_sample_hook) {
+      lua_sethook(L, NULL, 0, 0);
+    }
+    if (d->L->hook == lua_sample_hook) {
+      lua_sethook(d->L, NULL, 0, 0);
+    }
+
+    char buff[LUA_IDSIZE];
+    SLOT *slot = SLOTS(d);
+    for (i = 0; i < d->bucket_count; i++, slot++) {
+      if (slot->count) {
+        luaO_chunkid(buff, slot->source ? getstr(slot->source) : "=?", LUA_IDSIZE);
+        lua_pushfstring(L, "%s:%d", buff, slot->line);
+        lua_pushnumber(L, slot->count);
+        lua_settable(L, -3);
+      }
+    }
+
+    release_data(L, d);
+
+    return 3;
+  }
+
   uint32_t addr = d->start;
   for (i = 0; i < d->bucket_count; i++, addr += (1 << d->bucket_shift)) {
     if (d->bucket[i]) {
@@ -133,7 +334,7 @@ static int perf_stop(lua_State *L)
 
   lua_pushnumber(L, 1 << d->bucket_shift);
 
-  lua_unref(L, d->ref);
+  release_data(L, d);
 
   return 4;
 }
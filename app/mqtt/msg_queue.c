@@ -3,80 +3,160 @@
 #include "c_stdio.h"
 #include "msg_queue.h"
 
-msg_queue_t *msg_enqueue(msg_queue_t **head, mqtt_message_t *msg, uint16_t msg_id, int msg_type, int publish_qos){
-  if(!head){
+// A slab slot is a node immediately followed by its inline payload.
+#define MSG_QUEUE_SLOT_SIZE ((sizeof(msg_queue_t) + MSG_QUEUE_SLAB_DATA + 3) & ~3)
+
+void msg_queue_init(msg_queue_list_t *q, uint16_t capacity, msg_queue_full_cb full_cb, void *full_arg){
+  if(!q) return;
+  c_memset(q, 0, sizeof(*q));
+  q->capacity = capacity;
+  q->full_cb = full_cb;
+  q->full_arg = full_arg;
+}
+
+void msg_queue_free(msg_queue_list_t *q){
+  if(!q) return;
+  while(q->head){
+    msg_drop(q);
+  }
+  if(q->slab){
+    c_free(q->slab);
+    q->slab = NULL;
+  }
+  q->free = NULL;
+}
+
+static int msg_slab_init(msg_queue_list_t *q){
+  int i;
+  q->slab = (uint8_t *)c_zalloc(MSG_QUEUE_SLAB_NODES * MSG_QUEUE_SLOT_SIZE);
+  if(!q->slab){
+    return 0;
+  }
+  for(i = MSG_QUEUE_SLAB_NODES - 1; i >= 0; i--){
+    msg_queue_t *node = (msg_queue_t *)(q->slab + i * MSG_QUEUE_SLOT_SIZE);
+    node->next = q->free;
+    q->free = node;
+  }
+  return 1;
+}
+
+// Acks and pings answer the broker; refusing them would stall the session,
+// so only messages originated by the application count against capacity.
+static int msg_is_bounded(int msg_type){
+  return msg_type == MQTT_MSG_TYPE_PUBLISH ||
+         msg_type == MQTT_MSG_TYPE_SUBSCRIBE ||
+         msg_type == MQTT_MSG_TYPE_UNSUBSCRIBE;
+}
+
+msg_queue_t *msg_reserve(msg_queue_list_t *q, uint16_t size, int msg_type){
+  if(!q || size == 0){
     return NULL;
   }
-  if (!msg || !msg->data || msg->length == 0){
-    NODE_DBG("empty message\n");
+  if(q->capacity && q->count >= q->capacity && msg_is_bounded(msg_type)){
+    NODE_DBG("queue full\n");
+    if(q->full_cb){
+      q->full_cb(q, q->full_arg);
+    }
     return NULL;
   }
-  msg_queue_t *node = (msg_queue_t *)c_zalloc(sizeof(msg_queue_t));
-  if(!node){
-    NODE_DBG("not enough memory\n");
+
+  msg_queue_t *node;
+  if(size <= MSG_QUEUE_SLAB_DATA && (q->free || (!q->slab && msg_slab_init(q)))){
+    node = q->free;
+    q->free = node->next;
+    node->in_slab = 1;
+  } else {
+    // node and payload share one allocation
+    node = (msg_queue_t *)c_malloc(sizeof(msg_queue_t) + size);
+    if(!node){
+      NODE_DBG("not enough memory\n");
+      return NULL;
+    }
+    node->in_slab = 0;
+  }
+  node->next = NULL;
+  node->msg.data = (uint8_t *)(node + 1);
+  node->msg.length = size;
+  return node;
+}
+
+msg_queue_t *msg_commit(msg_queue_list_t *q, msg_queue_t *node, mqtt_message_t *msg, uint16_t msg_id, int msg_type, int publish_qos){
+  if(!q || !node){
     return NULL;
   }
-  
-  node->msg.data = (uint8_t *)c_zalloc(msg->length);
-  if(!node->msg.data){
-    NODE_DBG("not enough memory\n");
-    c_free(node);
+  if (!msg || !msg->data || msg->length == 0){
+    NODE_DBG("empty message\n");
+    msg_destroy(q, node);
     return NULL;
   }
-  c_memcpy(node->msg.data, msg->data, msg->length);
+  node->msg.data = msg->data;
   node->msg.length = msg->length;
   node->next = NULL;
   node->msg_id = msg_id;
   node->msg_type = msg_type;
   node->publish_qos = publish_qos;
 
-  msg_queue_t *tail = *head;
-  if(tail){
-    while(tail->next!=NULL) tail = tail->next;
-    tail->next = node;
+  if(q->tail){
+    q->tail->next = node;
   } else {
-    *head = node;
+    q->head = node;
   }
+  q->tail = node;
+  q->count++;
   return node;
 }
 
-void msg_destroy(msg_queue_t *node){
+msg_queue_t *msg_enqueue(msg_queue_list_t *q, mqtt_message_t *msg, uint16_t msg_id, int msg_type, int publish_qos){
+  if (!msg || !msg->data || msg->length == 0){
+    NODE_DBG("empty message\n");
+    return NULL;
+  }
+  msg_queue_t *node = msg_reserve(q, msg->length, msg_type);
+  if(!node){
+    return NULL;
+  }
+  c_memcpy(node->msg.data, msg->data, msg->length);
+  return msg_commit(q, node, &node->msg, msg_id, msg_type, publish_qos);
+}
+
+void msg_destroy(msg_queue_list_t *q, msg_queue_t *node){
   if(!node) return;
-  if(node->msg.data){
-    c_free(node->msg.data);
-    node->msg.data = NULL;
+  if(node->in_slab){
+    node->next = q->free;
+    q->free = node;
+  } else {
+    c_free(node);
   }
-  c_free(node);
 }
 
-msg_queue_t * msg_dequeue(msg_queue_t **head){
-  if(!head || !*head){
+msg_queue_t * msg_dequeue(msg_queue_list_t *q){
+  if(!q || !q->head){
     return NULL;
   }
-  msg_queue_t *node = *head;  // fetch head.
-  *head = node->next; // update head.
+  msg_queue_t *node = q->head;  // fetch head.
+  q->head = node->next; // update head.
+  if(!q->head){
+    q->tail = NULL;
+  }
+  q->count--;
   node->next = NULL;
   return node;
 }
 
-msg_queue_t * msg_peek(msg_queue_t **head){
-  if(!head || !*head){
+void msg_drop(msg_queue_list_t *q){
+  msg_destroy(q, msg_dequeue(q));
+}
+
+msg_queue_t * msg_peek(msg_queue_list_t *q){
+  if(!q){
     return NULL;
   }
-  return *head;  // fetch head.
+  return q->head;  // fetch head.
 }
 
-int msg_size(msg_queue_t **head){
-  if(!head || !*head){
+int msg_size(msg_queue_list_t *q){
+  if(!q){
     return 0;
   }
-  int i = 1;
-  msg_queue_t *tail = *head;
-  if(tail){
-    while(tail->next!=NULL){
-      tail = tail->next;
-      i++;
-    }
-  }
-  return i;
+  return q->count;
 }
@@ -5,7 +5,18 @@
 extern "C" {
 #endif
 
+// Number of nodes in the per-queue slab. Messages that fit into a slab slot
+// (acks, pings, subscribes, short publishes) never touch the heap.
+#ifndef MSG_QUEUE_SLAB_NODES
+#define MSG_QUEUE_SLAB_NODES 8
+#endif
+// Payload bytes stored inline in a slab node.
+#ifndef MSG_QUEUE_SLAB_DATA
+#define MSG_QUEUE_SLAB_DATA 48
+#endif
+
 struct msg_queue_t;
+struct msg_queue_list_t;
 
 typedef struct msg_queue_t {
   struct msg_queue_t *next;
@@ -13,13 +24,36 @@ typedef struct msg_queue_t {
   uint16_t msg_id;
   int msg_type;
   int publish_qos;
+  uint8_t in_slab;
 } msg_queue_t;
 
-msg_queue_t * msg_enqueue(msg_queue_t **head, mqtt_message_t *msg, uint16_t msg_id, int msg_type, int publish_qos);
-void msg_destroy(msg_queue_t *node);
-msg_queue_t * msg_dequeue(msg_queue_t **head);
-msg_queue_t * msg_peek(msg_queue_t **head);
-int msg_size(msg_queue_t **head);
+// Invoked when an application message is refused because the queue is full.
+typedef void (*msg_queue_full_cb)(struct msg_queue_list_t *q, void *arg);
+
+typedef struct msg_queue_list_t {
+  msg_queue_t *head;
+  msg_queue_t *tail;
+  msg_queue_t *free;      // unused slab nodes
+  uint8_t *slab;          // allocated on first enqueue
+  uint16_t count;
+  uint16_t capacity;      // 0: bounded by the heap only
+  msg_queue_full_cb full_cb;
+  void *full_arg;
+} msg_queue_list_t;
+
+void msg_queue_init(msg_queue_list_t *q, uint16_t capacity, msg_queue_full_cb full_cb, void *full_arg);
+void msg_queue_free(msg_queue_list_t *q);
+msg_queue_t * msg_enqueue(msg_queue_list_t *q, mqtt_message_t *msg, uint16_t msg_id, int msg_type, int publish_qos);
+// Two-step enqueue for building a message in place: msg_reserve() returns an
+// unlinked node whose msg.data has room for size bytes, the caller serialises
+// into it and msg_commit() links it (or releases it if msg is empty).
+msg_queue_t * msg_reserve(msg_queue_list_t *q, uint16_t size, int msg_type);
+msg_queue_t * msg_commit(msg_queue_list_t *q, msg_queue_t *node, mqtt_message_t *msg, uint16_t msg_id, int msg_type, int publish_qos);
+void msg_destroy(msg_queue_list_t *q, msg_queue_t *node);
+msg_queue_t * msg_dequeue(msg_queue_list_t *q);
+void msg_drop(msg_queue_list_t *q);
+msg_queue_t * msg_peek(msg_queue_list_t *q);
+int msg_size(msg_queue_list_t *q);
 
 #ifdef __cplusplus
 }
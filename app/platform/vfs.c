@@ -2,11 +2,18 @@
 
 #include "c_stdlib.h"
 #include "c_stdio.h"
+#include "c_string.h"
 #include "vfs.h"
 
 
 #define LDRV_TRAVERSAL 0
 
+// size of the buffer each file gets on its first small read or write, which
+// then reads ahead or collects writes, 0 turns buffering off
+#ifndef VFS_FILE_BUFFER
+#define VFS_FILE_BUFFER 256
+#endif
+
 
 // ---------------------------------------------------------------------------
 // RTC system interface
@@ -93,6 +100,14 @@ vfs_vol *vfs_mount( const char *name, int num )
   return NULL;
 }
 
+static int file_opened( vfs_file *f )
+{
+  if (f) {
+    ((struct vfs_file *)f)->fbuf = NULL;
+  }
+  return (int)f;
+}
+
 int vfs_open( const char *name, const char *mode )
 {
   vfs_fs_fns *fs_fns;
@@ -101,13 +116,13 @@ int vfs_open( const char *name, const char *mode )
 
 #ifdef BUILD_SPIFFS
   if (fs_fns = myspiffs_realm( normname, &outname, FALSE )) {
-    return (int)fs_fns->open( outname, mode );
+    return file_opened( fs_fns->open( outname, mode ) );
   }
 #endif
 
 #ifdef BUILD_FATFS
   if (fs_fns = myfatfs_realm( normname, &outname, FALSE )) {
-    int r = (int)fs_fns->open( outname, mode );
+    int r = file_opened( fs_fns->open( outname, mode ) );
     c_free( outname );
     return r;
   }
@@ -280,6 +295,63 @@ sint32_t vfs_fscfg( const char *name, uint32_t *phys_addr, uint32_t *phys_size)
   return VFS_RES_ERR;
 }
 
+sint32_t vfs_gc( sint32_t free_blocks, sint32_t max_steps, vfs_gc_stats *stats )
+{
+  vfs_fs_fns *fs_fns;
+  char *outname;
+
+#ifdef BUILD_SPIFFS
+  if (fs_fns = myspiffs_realm( "/FLASH", &outname, FALSE )) {
+    return fs_fns->gc( free_blocks, max_steps, stats );
+  }
+#endif
+
+#ifdef BUILD_FATFS
+  // not supported
+#endif
+
+  // Error
+  return VFS_RES_ERR;
+}
+
+sint32_t vfs_cache( sint32_t pages, vfs_cache_stats *stats )
+{
+  vfs_fs_fns *fs_fns;
+  char *outname;
+
+#ifdef BUILD_SPIFFS
+  if (fs_fns = myspiffs_realm( "/FLASH", &outname, FALSE )) {
+    return fs_fns->cache( pages, stats );
+  }
+#endif
+
+#ifdef BUILD_FATFS
+  // not supported
+#endif
+
+  // Error
+  return VFS_RES_ERR;
+}
+
+sint32_t vfs_maxopen( sint32_t files )
+{
+  vfs_fs_fns *fs_fns;
+  char *outname;
+
+#ifdef BUILD_SPIFFS
+  if (fs_fns = myspiffs_realm( "/FLASH", &outname, FALSE )) {
+    return fs_fns->maxopen( files );
+  }
+#endif
+
+#ifdef BUILD_FATFS
+  // not supported
+#endif
+
+  // Error
+  return VFS_RES_ERR;
+}
+
 sint32_t vfs_format( void )
 {
   vfs_fs_fns *fs_fns;
@@ -403,6 +475,8 @@ sint32_t vfs_ferrno( int fd )
     }
 #endif
   }
+
+  return 0;
 }
 
 
@@ -446,6 +520,283 @@ const char *vfs_basename( const char *path )
 }
 
 
+// ---------------------------------------------------------------------------
+// file functions
+//
+// Each file gets a buffer on its first small read or write. While it holds
+// read-ahead data, the file system's position runs ahead of the file
+// descriptor's by the bytes left in it; while it holds writes (dirty), the
+// file system's position lags behind by all of them. Anything that depends
+// on the position accounts for that, and switching between reading and
+// writing first brings the file system to where the caller expects it.
+
+static uint16_t fbuf_left( vfs_file *f )
+{
+  return f->fbuf && !f->fbuf->dirty ? f->fbuf->len - f->fbuf->pos : 0;
+}
+
+static int fbuf_alloc( vfs_file *f )
+{
+  if (!f->fbuf) {
+    if (VFS_FILE_BUFFER == 0 ||
+        !(((struct vfs_file *)f)->fbuf = c_zalloc( sizeof( struct vfs_fbuf ) + VFS_FILE_BUFFER ))) {
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+// passes on buffered writes, or gives up what is left of the read-ahead;
+// on failure the buffer keeps what did not reach the file system
+static sint32_t fbuf_sync( vfs_file *f )
+{
+  struct vfs_fbuf *b = f->fbuf;
+
+  if (!b) {
+    return VFS_RES_OK;
+  }
+  if (b->dirty) {
+    sint32_t n = b->len ? f->fns->write( f, b->data, b->len ) : 0;
+    if (n != b->len) {
+      if (n > 0) {
+        c_memmove( b->data, b->data + n, b->len - n );
+        b->len -= n;
+      }
+      return VFS_RES_ERR;
+    }
+  } else if (b->len > b->pos) {
+    if (f->fns->lseek( f, -(sint32_t)(b->len - b->pos), VFS_SEEK_CUR ) < 0) {
+      return VFS_RES_ERR;
+    }
+  }
+  b->len = b->pos = 0;
+  b->dirty = FALSE;
+  return VFS_RES_OK;
+}
+
+// refills the read-ahead buffer, returns the bytes in it or VFS_RES_ERR
+static sint32_t fbuf_fill( vfs_file *f )
+{
+  sint32_t n;
+
+  if (!fbuf_alloc( f )) {
+    return VFS_RES_ERR;
+  }
+  n = f->fns->read( f, f->fbuf->data, VFS_FILE_BUFFER );
+  f->fbuf->len = n > 0 ? n : 0;
+  f->fbuf->pos = 0;
+  return n;
+}
+
+sint32_t vfs_close( int fd )
+{
+  vfs_file *f = (vfs_file *)fd;
+  sint32_t res;
+
+  if (!f) {
+    return VFS_RES_ERR;
+  }
+  res = fbuf_sync( f );
+  c_free( f->fbuf );
+  if (f->fns->close( f ) != VFS_RES_OK) {
+    res = VFS_RES_ERR;
+  }
+  return res;
+}
+
+sint32_t vfs_read( int fd, void *ptr, size_t len )
+{
+  vfs_file *f = (vfs_file *)fd;
+  char *p = (char *)ptr;
+  size_t got = 0;
+  sint32_t n;
+
+  if (!f || f->fbuf && f->fbuf->dirty && fbuf_sync( f ) == VFS_RES_ERR) {
+    return VFS_RES_ERR;
+  }
+
+  while (got < len) {
+    uint16_t left = fbuf_left( f );
+    if (left) {
+      n = len - got < left ? len - got : left;
+      c_memcpy( p + got, f->fbuf->data + f->fbuf->pos, n );
+      f->fbuf->pos += n;
+      got += n;
+    } else if (len - got >= VFS_FILE_BUFFER || fbuf_fill( f ) == VFS_RES_ERR && !f->fbuf) {
+      // big reads, or reads without a buffer, go straight to the file system
+      n = f->fns->read( f, p + got, len - got );
+      if (n > 0) {
+        got += n;
+      }
+      break;
+    } else if (f->fbuf->len == 0) {
+      break;
+    }
+  }
+  return got > 0 || len == 0 ? got : VFS_RES_ERR;
+}
+
+sint32_t vfs_read_until( int fd, void *ptr, size_t len, int end_char )
+{
+  vfs_file *f = (vfs_file *)fd;
+  char *p = (char *)ptr;
+  size_t got = 0;
+
+  if (!f || f->fbuf && f->fbuf->dirty && fbuf_sync( f ) == VFS_RES_ERR) {
+    return VFS_RES_ERR;
+  }
+
+  while (got < len) {
+    uint16_t left = fbuf_left( f );
+    if (left) {
+      char *data = f->fbuf->data + f->fbuf->pos;
+      char *end;
+      size_t n = len - got < left ? len - got : left;
+      if ((end = c_memchr( data, end_char, n ))) {
+        n = end - data + 1;
+      }
+      c_memcpy( p + got, data, n );
+      f->fbuf->pos += n;
+      got += n;
+      if (end) {
+        break;
+      }
+    } else if (fbuf_fill( f ) == VFS_RES_ERR && !f->fbuf) {
+      // no memory for a buffer, read all and give back what follows the delimiter
+      sint32_t n = f->fns->read( f, p + got, len - got );
+      char *end;
+      if (n > 0 && (end = c_memchr( p + got, end_char, n ))) {
+        f->fns->lseek( f, -(n - (end - (p + got) + 1)), VFS_SEEK_CUR );
+        n = end - (p + got) + 1;
+      }
+      if (n > 0) {
+        got += n;
+      }
+      break;
+    } else if (f->fbuf->len == 0) {
+      break;
+    }
+  }
+  return got > 0 || len == 0 ? got : VFS_RES_ERR;
+}
+
+// Small writes are collected in the buffer once a write has gone through,
+// so that a file which cannot be written still fails on the first one.
+sint32_t vfs_write( int fd, const void *ptr, size_t len )
+{
+  vfs_file *f = (vfs_file *)fd;
+  struct vfs_fbuf *b;
+  sint32_t n;
+
+  if (!f) {
+    return VFS_RES_ERR;
+  }
+  b = f->fbuf;
+  if (b && b->writable && len < VFS_FILE_BUFFER) {
+    if (!b->dirty || b->len + len > VFS_FILE_BUFFER) {
+      if (fbuf_sync( f ) == VFS_RES_ERR) {
+        return VFS_RES_ERR;
+      }
+      b->dirty = TRUE;
+    }
+    c_memcpy( b->data + b->len, ptr, len );
+    b->len += len;
+    return len;
+  }
+
+  if (fbuf_sync( f ) == VFS_RES_ERR) {
+    return VFS_RES_ERR;
+  }
+  n = f->fns->write( f, ptr, len );
+  if (n > 0 && len < VFS_FILE_BUFFER && fbuf_alloc( f )) {
+    f->fbuf->writable = TRUE;
+  }
+  return n;
+}
+
+sint32_t vfs_lseek( int fd, sint32_t off, int whence )
+{
+  vfs_file *f = (vfs_file *)fd;
+  uint16_t left;
+
+  if (!f) {
+    return VFS_RES_ERR;
+  }
+
+  left = fbuf_left( f );
+  if (whence == VFS_SEEK_CUR && left) {
+    // stay within the buffer if possible, as vfs_ungetc() does
+    if (off >= -(sint32_t)f->fbuf->pos && off <= left) {
+      f->fbuf->pos += off;
+      return f->fns->tell( f ) - fbuf_left( f );
+    }
+    off -= left;
+  }
+  if (f->fbuf) {
+    if (f->fbuf->dirty) {
+      if (fbuf_sync( f ) == VFS_RES_ERR) {
+        return VFS_RES_ERR;
+      }
+    } else {
+      f->fbuf->len = f->fbuf->pos = 0;
+    }
+  }
+  return f->fns->lseek( f, off, whence );
+}
+
+sint32_t vfs_eof( int fd )
+{
+  vfs_file *f = (vfs_file *)fd;
+
+  if (!f) {
+    return VFS_RES_ERR;
+  }
+  if (f->fbuf && f->fbuf->dirty && fbuf_sync( f ) == VFS_RES_ERR) {
+    return VFS_RES_ERR;
+  }
+  return fbuf_left( f ) ? 0 : f->fns->eof( f );
+}
+
+sint32_t vfs_tell( int fd )
+{
+  vfs_file *f = (vfs_file *)fd;
+
+  if (!f) {
+    return VFS_RES_ERR;
+  }
+  if (f->fbuf && f->fbuf->dirty) {
+    return f->fns->tell( f ) + f->fbuf->len;
+  }
+  return f->fns->tell( f ) - fbuf_left( f );
+}
+
+sint32_t vfs_flush( int fd )
+{
+  vfs_file *f = (vfs_file *)fd;
+
+  if (!f) {
+    return VFS_RES_ERR;
+  }
+  if (f->fbuf && f->fbuf->dirty && fbuf_sync( f ) == VFS_RES_ERR) {
+    return VFS_RES_ERR;
+  }
+  return f->fns->flush( f );
+}
+
+uint32_t vfs_size( int fd )
+{
+  vfs_file *f = (vfs_file *)fd;
+
+  if (!f) {
+    return 0;
+  }
+  if (f->fbuf && f->fbuf->dirty && fbuf_sync( f ) == VFS_RES_ERR) {
+    return 0;
+  }
+  return f->fns->size( f );
+}
+
+
 // ---------------------------------------------------------------------------
 // supplementary functions
 //
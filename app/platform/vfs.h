@@ -15,30 +15,35 @@
 // vfs_close - close file descriptor and free memory
 //   fd: file descriptor
 //   Returns: VFS_RES_OK or negative value in case of error
-inline sint32_t vfs_close( int fd ) {
-  vfs_file *f = (vfs_file *)fd;
-  return f ? f->fns->close( f ) : VFS_RES_ERR;
-}
+sint32_t vfs_close( int fd );
 
 // vfs_read - read data from file
+//   Reads shorter than VFS_FILE_BUFFER fill a read-ahead buffer of that size
+//   and are served from it until it is used up, so that reading a file in
+//   small pieces reads the file system in larger ones.
 //   fd: file descriptor
 //   ptr: destination data buffer
 //   len: requested length
 //   Returns: Number of bytes read, or VFS_RES_ERR in case of error
-inline sint32_t vfs_read( int fd, void *ptr, size_t len ) {
-  vfs_file *f = (vfs_file *)fd;
-  return f ? f->fns->read( f, ptr, len ) : VFS_RES_ERR;
-}
+sint32_t vfs_read( int fd, void *ptr, size_t len );
+
+// vfs_read_until - read data from file up to and including a delimiter
+//   fd: file descriptor
+//   ptr: destination data buffer
+//   len: most bytes to read
+//   end_char: delimiter
+//   Returns: Number of bytes read, or VFS_RES_ERR in case of error
+sint32_t vfs_read_until( int fd, void *ptr, size_t len, int end_char );
 
 // vfs_write - write data to file
+//   Once a write has gone through, writes shorter than VFS_FILE_BUFFER are
+//   collected in a buffer of that size and passed on when it is full, or when
+//   the file is read, moved in, flushed or closed.
 //   fd: file descriptor
 //   ptr: source data buffer
 //   len: requested length
 //   Returns: Number of bytes written, or VFS_RES_ERR in case of error
-inline sint32_t vfs_write( int fd, const void *ptr, size_t len ) {
-  vfs_file *f = (vfs_file *)fd;
-  return f ? f->fns->write( f, ptr, len ) : VFS_RES_ERR;
-}
+sint32_t vfs_write( int fd, const void *ptr, size_t len );
 
 int vfs_getc( int fd );
 
@@ -51,42 +56,27 @@ int vfs_ungetc( int c, int fd );
 //           VFS_SEEK_CUR - set pointer to current position + off
 //           VFS_SEEK_END - set pointer to end of file + off
 //   Returns: New position, or VFS_RES_ERR in case of error
-inline sint32_t vfs_lseek( int fd, sint32_t off, int whence ) {
-  vfs_file *f = (vfs_file *)fd;
-  return f ? f->fns->lseek( f, off, whence ) : VFS_RES_ERR;
-}
+sint32_t vfs_lseek( int fd, sint32_t off, int whence );
 
 // vfs_eof - test for end-of-file
 //   fd: file descriptor
 //   Returns: 0 if not at end, != 0 if end of file
-inline sint32_t vfs_eof( int fd ) {
-  vfs_file *f = (vfs_file *)fd;
-  return f ? f->fns->eof( f ) : VFS_RES_ERR;
-}
+sint32_t vfs_eof( int fd );
 
 // vfs_tell - get read/write position
 //   fd: file descriptor
 //   Returns: Current position
-inline sint32_t vfs_tell( int fd ) {
-  vfs_file *f = (vfs_file *)fd;
-  return f ? f->fns->tell( f ) : VFS_RES_ERR;
-}
+sint32_t vfs_tell( int fd );
 
 // vfs_flush - flush write cache to file
 //   fd: file descriptor
 //   Returns: VFS_RES_OK, or VFS_RES_ERR in case of error
-inline sint32_t vfs_flush( int fd ) {
-  vfs_file *f = (vfs_file *)fd;
-  return f ? f->fns->flush( f ) : VFS_RES_ERR;
-}
+sint32_t vfs_flush( int fd );
 
 // vfs_size - get current file size
 //   fd: file descriptor
 //   Returns: File size
-inline uint32_t vfs_size( int fd ) {
-  vfs_file *f = (vfs_file *)fd;
-  return f ? f->fns->size( f ) : 0;
-}
+uint32_t vfs_size( int fd );
 
 // vfs_ferrno - get file system specific errno
 //   fd: file descriptor
@@ -228,6 +218,24 @@ sint32_t  vfs_chdir( const char *path );
 //   Returns: VFS_RES_OK, or VFS_RES_ERR in case of error
 sint32_t vfs_fscfg( const char *name, uint32_t *phys_addr, uint32_t *phys_size);
 
+// vfs_gc - set up and query background garbage collection of the flash file system
+//   free_blocks: number of free blocks to keep, 0 to stop, negative to leave unchanged
+//   max_steps: most blocks to collect after each change, negative to leave unchanged
+//   stats: receives the statistics, may be NULL
+//   Returns: VFS_RES_OK, or VFS_RES_ERR in case of error
+sint32_t vfs_gc( sint32_t free_blocks, sint32_t max_steps, vfs_gc_stats *stats );
+
+// vfs_cache - resize and query the page cache of the flash file system
+//   pages: number of cache pages, 0 to turn the cache off, negative to leave unchanged
+//   stats: receives the statistics, may be NULL
+//   Returns: VFS_RES_OK, or VFS_RES_ERR if files are open or the memory is short
+sint32_t vfs_cache( sint32_t pages, vfs_cache_stats *stats );
+
+// vfs_maxopen - set and query how many files of the flash file system can be open at a time
+//   files: the new limit, 0 or negative to leave it unchanged
+//   Returns: the limit, or VFS_RES_ERR if files are open or the memory is short
+sint32_t vfs_maxopen( sint32_t files );
+
 // vfs_errno - get file system specific errno
 //   name: logical drive identifier
 //   Returns: errno
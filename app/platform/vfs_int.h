@@ -40,10 +40,38 @@ struct vfs_time {
 };
 typedef struct vfs_time vfs_time;
 
+// statistics of background garbage collection
+struct vfs_gc_stats {
+  uint32_t steps;       // blocks collected
+  uint32_t reclaimed;   // pages reclaimed
+  uint32_t max_us;      // longest step
+};
+typedef struct vfs_gc_stats vfs_gc_stats;
+
+// statistics of the flash file system's page cache
+struct vfs_cache_stats {
+  uint32_t pages;       // pages in the cache
+  uint32_t hits;
+  uint32_t misses;
+  uint32_t evictions;   // cached pages dropped for others
+};
+typedef struct vfs_cache_stats vfs_cache_stats;
+
+// buffer of a file descriptor, managed by vfs.c: holds either read-ahead
+// data or small writes which have not been passed on yet
+struct vfs_fbuf {
+  uint16_t len;         // bytes in data
+  uint16_t pos;         // next byte to return, unused while dirty
+  uint8_t dirty;        // data holds writes
+  uint8_t writable;     // a write has gone through, so later ones may wait
+  char data[];
+};
+
 // generic file descriptor
 struct vfs_file {
   int fs_type;
   const struct vfs_file_fns *fns;
+  struct vfs_fbuf *fbuf;
 };
 typedef const struct vfs_file vfs_file;
 
@@ -119,6 +147,9 @@ struct vfs_fs_fns {
   sint32_t  (*mkdir)( const char *name );
   sint32_t  (*fsinfo)( uint32_t *total, uint32_t *used );
   sint32_t  (*fscfg)( uint32_t *phys_addr, uint32_t *phys_size );
+  sint32_t  (*gc)( sint32_t free_blocks, sint32_t max_steps, vfs_gc_stats *stats );
+  sint32_t  (*cache)( sint32_t pages, vfs_cache_stats *stats );
+  sint32_t  (*maxopen)( sint32_t files );
   sint32_t  (*format)( void );
   sint32_t  (*chdrive)( const char * );
   sint32_t  (*chdir)( const char * );
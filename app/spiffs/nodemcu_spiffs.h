@@ -9,9 +9,19 @@
 typedef uint32_t intptr_t;
 #endif
 
-// Turn off stats
-#define SPIFFS_CACHE_STATS 	    0
+// Cache stats are reported by file.cachestats(), gc stats are only
+// turned on by host builds such as spiffsimg
+#ifndef SPIFFS_CACHE_STATS
+#define SPIFFS_CACHE_STATS 	    1
+#endif
+#ifndef SPIFFS_GC_STATS
 #define SPIFFS_GC_STATS             0
+#endif
+
+// Collect small writes in up to 4 cache pages, if the cache has 8
+#ifndef SPIFFS_CACHE_WR_PAGES
+#define SPIFFS_CACHE_WR_PAGES       4
+#endif
 
 // Needs to align stuff
 #define SPIFFS_ALIGNED_OBJECT_INDEX_TABLES	1
@@ -1,6 +1,7 @@
 #include "c_stdio.h"
 #include "platform.h"
 #include "spiffs.h"
+#include "task/task.h"
 
 #include "spiffs_nucleus.h"
 
@@ -12,10 +13,29 @@ spiffs fs;
 #define MIN_BLOCKS_FS		4
   
 static u8_t spiffs_work_buf[LOG_PAGE_SIZE*2];
-static u8_t spiffs_fds[sizeof(spiffs_fd) * SPIFFS_MAX_OPEN_FILES];
+#define SPIFFS_OPEN_FILES_MAX	32
+// allocated at mount, so that file.maxopen() can resize it
+static u8_t *myspiffs_fds;
+static uint8_t myspiffs_fd_count = SPIFFS_MAX_OPEN_FILES;
 #if SPIFFS_CACHE
-static u8_t myspiffs_cache[(LOG_PAGE_SIZE+32)*2];
+#ifndef SPIFFS_CACHE_PAGES
+#define SPIFFS_CACHE_PAGES	2
 #endif
+#define SPIFFS_CACHE_MAX_PAGES	32
+#define MYSPIFFS_CACHE_SIZE(pages) \
+  (sizeof(spiffs_cache) + (pages) * (sizeof(spiffs_cache_page) + LOG_PAGE_SIZE))
+// allocated at mount, so that file.cache() can resize it
+static u8_t *myspiffs_cache;
+static uint8_t myspiffs_cache_pages = SPIFFS_CACHE_PAGES;
+#endif
+#ifdef SPIFFS_NAME_INDEX_ENTRIES
+static spiffs_name_index_entry myspiffs_name_index[SPIFFS_NAME_INDEX_ENTRIES];
+#endif
+
+#ifndef SPIFFS_GC_FREE_BLOCKS
+#define SPIFFS_GC_FREE_BLOCKS	0
+#endif
+#define SPIFFS_GC_MAX_STEPS	4
 
 static s32_t my_spiffs_read(u32_t addr, u32_t size, u8_t *dst) {
   platform_flash_read(dst, addr, size);
@@ -164,20 +184,36 @@ static bool myspiffs_mount_internal(bool force_mount) {
 
   fs.err_code = 0;
 
+  if (!myspiffs_fds &&
+      !(myspiffs_fds = (u8_t *)c_malloc(sizeof(spiffs_fd) * myspiffs_fd_count))) {
+    return FALSE;
+  }
+#if SPIFFS_CACHE
+  if (!myspiffs_cache &&
+      !(myspiffs_cache = (u8_t *)c_malloc(MYSPIFFS_CACHE_SIZE(myspiffs_cache_pages)))) {
+    return FALSE;
+  }
+#endif
+
   int res = SPIFFS_mount(&fs,
     &cfg,
     spiffs_work_buf,
-    spiffs_fds,
-    sizeof(spiffs_fds),
+    myspiffs_fds,
+    sizeof(spiffs_fd) * myspiffs_fd_count,
 #if SPIFFS_CACHE
     myspiffs_cache,
-    sizeof(myspiffs_cache),
+    MYSPIFFS_CACHE_SIZE(myspiffs_cache_pages),
 #else
     0, 0,
 #endif
     // myspiffs_check_callback);
     0);
   NODE_DBG("mount res: %d, %d\n", res, fs.err_code);
+#ifdef SPIFFS_NAME_INDEX_ENTRIES
+  if (res == SPIFFS_OK) {
+    SPIFFS_set_name_index(&fs, myspiffs_name_index, sizeof(myspiffs_name_index));
+  }
+#endif
   return res == SPIFFS_OK;
 }
 
@@ -206,6 +242,118 @@ int myspiffs_format( void )
   return myspiffs_mount();
 }
 
+// ***************************************************************************
+// background garbage collection
+// ***************************************************************************
+
+#include "vfs_int.h"
+
+static struct {
+  uint8_t free_blocks;        // blocks to keep free, 0 if off
+  uint8_t max_steps;          // most blocks to collect after a change
+  uint8_t steps_left;
+  uint8_t posted;
+  task_handle_t task;
+  vfs_gc_stats stats;
+} myspiffs_gc = { SPIFFS_GC_FREE_BLOCKS, SPIFFS_GC_MAX_STEPS };
+
+// Collects one block per run, so that the system stays responsive, and
+// posts itself again until enough blocks are free
+static void myspiffs_gc_task( task_param_t param, uint8 prio ) {
+  myspiffs_gc.posted = FALSE;
+  if (!myspiffs_gc.free_blocks || !SPIFFS_mounted( &fs )) {
+    return;
+  }
+
+  uint32_t start = system_get_time();
+  s32_t res = SPIFFS_gc_step( &fs, myspiffs_gc.free_blocks );
+  uint32_t us = system_get_time() - start;
+  NODE_DBG("gc step: %d pages in %u us, %u blocks free\n", res, us, fs.free_blocks);
+  if (res <= 0) {
+    return;
+  }
+
+  myspiffs_gc.stats.steps++;
+  myspiffs_gc.stats.reclaimed += res;
+  if (us > myspiffs_gc.stats.max_us) {
+    myspiffs_gc.stats.max_us = us;
+  }
+  if (--myspiffs_gc.steps_left > 0) {
+    myspiffs_gc.posted = task_post_low( myspiffs_gc.task, 0 );
+  }
+}
+
+// Called after changes to the file system, starts collecting garbage once
+// the system is idle if fewer blocks are free than wanted
+static void myspiffs_gc_kick( void ) {
+  if (!myspiffs_gc.free_blocks || fs.free_blocks >= myspiffs_gc.free_blocks ||
+      fs.stats_p_deleted == 0) {
+    return;
+  }
+  myspiffs_gc.steps_left = myspiffs_gc.max_steps;
+  if (!myspiffs_gc.posted) {
+    if (!myspiffs_gc.task) {
+      myspiffs_gc.task = task_get_id( myspiffs_gc_task );
+    }
+    myspiffs_gc.posted = task_post_low( myspiffs_gc.task, 0 );
+  }
+}
+
+// ***************************************************************************
+// page cache and file descriptors
+// ***************************************************************************
+
+static bool myspiffs_files_open( void ) {
+  spiffs_fd *fds = (spiffs_fd *)fs.fd_space;
+  int i;
+  for (i = 0; i < fs.fd_count; i++) {
+    if (fds[i].file_nbr != 0) {
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+// The cache and the file descriptors can only be resized between mounts, as
+// SPIFFS lays them out when mounting. Unmounting flushes all cached writes.
+static bool myspiffs_resize( uint8_t pages, uint8_t fd_count ) {
+#if SPIFFS_CACHE
+  uint8_t old_pages = myspiffs_cache_pages;
+#endif
+  uint8_t old_fd_count = myspiffs_fd_count;
+  bool mounted = SPIFFS_mounted( &fs );
+
+  if (mounted) {
+    if (myspiffs_files_open()) {
+      return FALSE;
+    }
+    SPIFFS_unmount( &fs );
+  }
+#if SPIFFS_CACHE
+  c_free( myspiffs_cache );
+  myspiffs_cache = NULL;
+  myspiffs_cache_pages = pages;
+#endif
+  c_free( myspiffs_fds );
+  myspiffs_fds = NULL;
+  myspiffs_fd_count = fd_count;
+  if (!mounted || myspiffs_mount()) {
+    return TRUE;
+  }
+
+  // not enough memory, go back to the old sizes
+#if SPIFFS_CACHE
+  c_free( myspiffs_cache );
+  myspiffs_cache = NULL;
+  myspiffs_cache_pages = old_pages;
+#endif
+  c_free( myspiffs_fds );
+  myspiffs_fds = NULL;
+  myspiffs_fd_count = old_fd_count;
+  myspiffs_mount();
+  return FALSE;
+}
+
 #if 0
 void test_spiffs() {
   char buf[12];
@@ -230,7 +378,6 @@ void test_spiffs() {
 // ***************************************************************************
 
 #include <c_stdlib.h>
-#include "vfs_int.h"
 
 #define MY_LDRV_ID "FLASH"
 
@@ -264,6 +411,9 @@ static sint32_t  myspiffs_vfs_remove( const char *name );
 static sint32_t  myspiffs_vfs_rename( const char *oldname, const char *newname );
 static sint32_t  myspiffs_vfs_fsinfo( uint32_t *total, uint32_t *used );
 static sint32_t  myspiffs_vfs_fscfg( uint32_t *phys_addr, uint32_t *phys_size );
+static sint32_t  myspiffs_vfs_gc( sint32_t free_blocks, sint32_t max_steps, vfs_gc_stats *stats );
+static sint32_t  myspiffs_vfs_cache( sint32_t pages, vfs_cache_stats *stats );
+static sint32_t  myspiffs_vfs_maxopen( sint32_t files );
 static sint32_t  myspiffs_vfs_format( void );
 static sint32_t  myspiffs_vfs_errno( void );
 static void      myspiffs_vfs_clearerr( void );
@@ -283,6 +433,9 @@ static vfs_fs_fns myspiffs_fs_fns = {
   .mkdir    = NULL,
   .fsinfo   = myspiffs_vfs_fsinfo,
   .fscfg    = myspiffs_vfs_fscfg,
+  .gc       = myspiffs_vfs_gc,
+  .cache    = myspiffs_vfs_cache,
+  .maxopen  = myspiffs_vfs_maxopen,
   .format   = myspiffs_vfs_format,
   .chdrive  = NULL,
   .chdir    = NULL,
@@ -427,6 +580,7 @@ static sint32_t myspiffs_vfs_close( const struct vfs_file *fd ) {
   // free descriptor memory
   c_free( (void *)fd );
 
+  myspiffs_gc_kick();
   return res;
 }
 
@@ -443,6 +597,7 @@ static sint32_t myspiffs_vfs_write( const struct vfs_file *fd, const void *ptr,
 
   sint32_t n = SPIFFS_write( &fs, fh, (void *)ptr, len );
 
+  myspiffs_gc_kick();
   return n >= 0 ? n : VFS_RES_ERR;
 }
 
@@ -577,11 +732,15 @@ static vfs_item *myspiffs_vfs_stat( const char *name ) {
 }
 
 static sint32_t myspiffs_vfs_remove( const char *name ) {
-  return SPIFFS_remove( &fs, name );
+  sint32_t res = SPIFFS_remove( &fs, name );
+  myspiffs_gc_kick();
+  return res;
 }
 
 static sint32_t myspiffs_vfs_rename( const char *oldname, const char *newname ) {
-  return SPIFFS_rename( &fs, oldname, newname );
+  sint32_t res = SPIFFS_rename( &fs, oldname, newname );
+  myspiffs_gc_kick();
+  return res;
 }
 
 static sint32_t myspiffs_vfs_fsinfo( uint32_t *total, uint32_t *used ) {
@@ -594,6 +753,69 @@ static sint32_t myspiffs_vfs_fscfg( uint32_t *phys_addr, uint32_t *phys_size ) {
   return VFS_RES_OK;
 }
 
+static sint32_t myspiffs_vfs_gc( sint32_t free_blocks, sint32_t max_steps, vfs_gc_stats *stats ) {
+  if (free_blocks >= 0) {
+    myspiffs_gc.free_blocks = free_blocks < 255 ? free_blocks : 255;
+  }
+  if (max_steps >= 0) {
+    myspiffs_gc.max_steps = max_steps < 1 ? 1 : max_steps < 255 ? max_steps : 255;
+  }
+  if (stats) {
+    *stats = myspiffs_gc.stats;
+  }
+  myspiffs_gc_kick();
+  return VFS_RES_OK;
+}
+
+static sint32_t myspiffs_vfs_cache( sint32_t pages, vfs_cache_stats *stats ) {
+#if SPIFFS_CACHE
+  if (pages > SPIFFS_CACHE_MAX_PAGES) {
+    pages = SPIFFS_CACHE_MAX_PAGES;
+  }
+  // SPIFFS needs at least one page when built with its cache
+  if (pages == 0) {
+    pages = 1;
+  }
+  if (pages > 0 && pages != myspiffs_cache_pages &&
+      !myspiffs_resize( pages, myspiffs_fd_count )) {
+    return VFS_RES_ERR;
+  }
+  if (stats) {
+    c_memset( stats, 0, sizeof( *stats ) );
+    if (SPIFFS_mounted( &fs )) {
+      stats->pages     = spiffs_get_cache( &fs )->cpage_count;
+#if SPIFFS_CACHE_STATS
+      stats->hits      = fs.cache_hits;
+      stats->misses    = fs.cache_misses;
+      stats->evictions = fs.cache_evictions;
+#endif
+    }
+  }
+  return VFS_RES_OK;
+#else
+  if (stats) {
+    c_memset( stats, 0, sizeof( *stats ) );
+  }
+  return pages > 0 ? VFS_RES_ERR : VFS_RES_OK;
+#endif
+}
+
+static sint32_t myspiffs_vfs_maxopen( sint32_t files ) {
+#if SPIFFS_CACHE
+  uint8_t pages = myspiffs_cache_pages;
+#else
+  uint8_t pages = 0;
+#endif
+
+  if (files > SPIFFS_OPEN_FILES_MAX) {
+    files = SPIFFS_OPEN_FILES_MAX;
+  }
+  if (files > 0 && files != myspiffs_fd_count && !myspiffs_resize( pages, files )) {
+    return VFS_RES_ERR;
+  }
+  return myspiffs_fd_count;
+}
+
 static vfs_vol  *myspiffs_vfs_mount( const char *name, int num ) {
   // volume descriptor not supported, just return TRUE / FALSE
   return myspiffs_mount() ? (vfs_vol *)1 : NULL;
@@ -271,9 +271,21 @@ typedef struct spiffs_t {
 #if SPIFFS_CACHE_STATS
   u32_t cache_hits;
   u32_t cache_misses;
+  u32_t cache_evictions;
 #endif
 #endif
 
+#if SPIFFS_NAME_INDEX
+  // name index memory, see SPIFFS_set_name_index
+  void *name_index;
+  // number of entries in name index
+  u32_t name_index_len;
+  // number of used entries in name index
+  u32_t name_index_used;
+  // name index state, stale, complete or partial
+  u8_t name_index_state;
+#endif
+
   // check callback function
   spiffs_check_callback check_cb_f;
   // file callback function
@@ -628,6 +640,22 @@ s32_t SPIFFS_gc_quick(spiffs *fs, u16_t max_free_pages);
  */
 s32_t SPIFFS_gc(spiffs *fs, u32_t size);
 
+/**
+ * Cleans and erases at most one block, if fewer than min_free_blocks blocks
+ * are free and there are deleted pages to reclaim. The block chosen is the
+ * one the garbage collector would pick. Calling this repeatedly while the
+ * system is idle keeps enough blocks free that writes seldom need to run the
+ * garbage collector themselves, and each call takes at most one block's
+ * worth of page moves and erases.
+ *
+ * Returns the number of pages reclaimed, 0 if there was nothing to do, or
+ * an error code, which is also set as err_no.
+ *
+ * @param fs              the file system struct
+ * @param min_free_blocks number of free blocks to keep
+ */
+s32_t SPIFFS_gc_step(spiffs *fs, u32_t min_free_blocks);
+
 /**
  * Check if EOF reached.
  * @param fs            the file system struct
@@ -658,6 +686,23 @@ s32_t SPIFFS_tell(spiffs *fs, spiffs_file fh);
  */
 s32_t SPIFFS_set_file_callback_func(spiffs *fs, spiffs_file_callback cb_func);
 
+#if SPIFFS_NAME_INDEX
+/**
+ * Gives spiffs memory for an index from file names to object index header
+ * pages. Each entry takes 6 bytes and covers one file. The index is built
+ * by one scan of the object lookup pages on the first lookup by name and is
+ * then kept up to date, so that open, stat, remove and rename find files
+ * without scanning the file system. If there are more files than fit,
+ * lookups of names that are not in the index scan as before.
+ * Must be invoked after mount; mount disables the index.
+ *
+ * @param fs            the file system struct
+ * @param buf           the index memory, or 0 to disable the index
+ * @param size          the size of buf in bytes
+ */
+s32_t SPIFFS_set_name_index(spiffs *fs, void *buf, u32_t size);
+#endif
+
 #if SPIFFS_TEST_VISUALISATION
 /**
  * Prints out a visualization of the filesystem.
@@ -42,14 +42,23 @@ static s32_t spiffs_cache_page_free(spiffs *fs, int ix, u8_t write_back) {
       res = SPIFFS_HAL_WRITE(fs, SPIFFS_PAGE_TO_PADDR(fs, cp->pix), SPIFFS_CFG_LOG_PAGE_SZ(fs), mem);
     }
 
-    cp->flags = 0;
-    cache->cpage_use_map &= ~(1 << ix);
-
     if (cp->flags & SPIFFS_CACHE_FLAG_TYPE_WR) {
       SPIFFS_CACHE_DBG("CACHE_FREE: free cache page %i objid %04x\n", ix, cp->obj_id);
+#if SPIFFS_CACHE_WR
+      // and the pages the write cache continues in
+      int i;
+      if (cp->flags & SPIFFS_CACHE_FLAG_WR_CONT) cp->pages = 1;
+      for (i = ix + 1; i < ix + cp->pages; i++) {
+        spiffs_get_cache_page_hdr(fs, cache, i)->flags = 0;
+        cache->cpage_use_map &= ~(1 << i);
+      }
+#endif
     } else {
       SPIFFS_CACHE_DBG("CACHE_FREE: free cache page %i pix %04x\n", ix, cp->pix);
     }
+
+    cp->flags = 0;
+    cache->cpage_use_map &= ~(1 << ix);
   }
 
   return res;
@@ -79,6 +88,9 @@ static s32_t spiffs_cache_page_remove_oldest(spiffs *fs, u8_t flag_mask, u8_t fl
   }
 
   if (cand_ix >= 0) {
+#if SPIFFS_CACHE_STATS
+    fs->cache_evictions++;
+#endif
     res = spiffs_cache_page_free(fs, cand_ix, 1);
   }
 
@@ -144,10 +156,12 @@ s32_t spiffs_phys_rd(
 #endif
     res = spiffs_cache_page_remove_oldest(fs, SPIFFS_CACHE_FLAG_TYPE_WR, 0);
     cp = spiffs_cache_page_allocate(fs);
-    if (cp) {
-      cp->flags = SPIFFS_CACHE_FLAG_WRTHRU;
-      cp->pix = SPIFFS_PADDR_TO_PAGE(fs, addr);
+    if (cp == 0) {
+      // all cache pages hold written data
+      return SPIFFS_HAL_READ(fs, addr, len, dst);
     }
+    cp->flags = SPIFFS_CACHE_FLAG_WRTHRU;
+    cp->pix = SPIFFS_PADDR_TO_PAGE(fs, addr);
     s32_t res2 = SPIFFS_HAL_READ(fs,
         addr - SPIFFS_PADDR_TO_PAGE_OFFSET(fs, addr),
         SPIFFS_CFG_LOG_PAGE_SZ(fs),
@@ -217,7 +231,7 @@ spiffs_cache_page *spiffs_cache_page_get_by_fd(spiffs *fs, spiffs_fd *fd) {
   for (i = 0; i < cache->cpage_count; i++) {
     spiffs_cache_page *cp = spiffs_get_cache_page_hdr(fs, cache, i);
     if ((cache->cpage_use_map & (1<<i)) &&
-        (cp->flags & SPIFFS_CACHE_FLAG_TYPE_WR) &&
+        (cp->flags & (SPIFFS_CACHE_FLAG_TYPE_WR | SPIFFS_CACHE_FLAG_WR_CONT)) == SPIFFS_CACHE_FLAG_TYPE_WR &&
         cp->obj_id == fd->obj_id) {
       return cp;
     }
@@ -226,19 +240,78 @@ spiffs_cache_page *spiffs_cache_page_get_by_fd(spiffs *fs, spiffs_fd *fd) {
   return 0;
 }
 
+// allocates n adjacent cache pages for writing, of those which are not write
+// cache pages already, preferring free pages and then read cache pages that
+// were accessed longest ago, which are dropped. Returns the first page, or
+// null if there are no n such adjacent pages
+static spiffs_cache_page *spiffs_cache_page_allocate_adjacent(spiffs *fs, int n) {
+  spiffs_cache *cache = spiffs_get_cache(fs);
+  int i, j;
+  int cand_ix = -1;
+  int cand_used = n + 1;
+  u32_t cand_age = 0;
+
+  for (i = 0; i + n <= cache->cpage_count; i++) {
+    int used = 0;
+    // age of the most recently accessed page of these
+    u32_t age = 0xffffffff;
+    for (j = i; j < i + n; j++) {
+      spiffs_cache_page *cp = spiffs_get_cache_page_hdr(fs, cache, j);
+      if ((cache->cpage_use_map & (1<<j)) == 0) {
+        continue;
+      }
+      if (cp->flags & SPIFFS_CACHE_FLAG_TYPE_WR) {
+        break;
+      }
+      used++;
+      age = MIN(age, cache->last_access - cp->last_access);
+    }
+    if (j == i + n &&
+        (used < cand_used || (used == cand_used && age > cand_age))) {
+      cand_ix = i;
+      cand_used = used;
+      cand_age = age;
+    }
+  }
+  if (cand_ix < 0) {
+    return 0;
+  }
+
+  for (j = cand_ix; j < cand_ix + n; j++) {
+    spiffs_cache_page *cp = spiffs_get_cache_page_hdr(fs, cache, j);
+    if (cache->cpage_use_map & (1<<j)) {
+#if SPIFFS_CACHE_STATS
+      fs->cache_evictions++;
+#endif
+      spiffs_cache_page_free(fs, j, 1);
+    }
+    cache->cpage_use_map |= (1<<j);
+    cp->last_access = cache->last_access;
+    cp->flags = SPIFFS_CACHE_FLAG_TYPE_WR | (j > cand_ix ? SPIFFS_CACHE_FLAG_WR_CONT : 0);
+  }
+  SPIFFS_CACHE_DBG("CACHE_ALLO: allocated cache pages %i-%i\n", cand_ix, cand_ix + n - 1);
+  spiffs_cache_page *cp = spiffs_get_cache_page_hdr(fs, cache, cand_ix);
+  cp->pages = n;
+  return cp;
+}
+
 // allocates a new cache page and refers this to given fd - flushes an old cache
-// page if all cache is busy
+// page if all cache is busy. Takes up to SPIFFS_CACHE_WR_PAGES adjacent pages,
+// but leaves at least half of the cache for reading.
 spiffs_cache_page *spiffs_cache_page_allocate_by_fd(spiffs *fs, spiffs_fd *fd) {
   // before this function is called, it is ensured that there is no already existing
   // cache page with same object id
-  spiffs_cache_page_remove_oldest(fs, SPIFFS_CACHE_FLAG_TYPE_WR, 0);
-  spiffs_cache_page *cp = spiffs_cache_page_allocate(fs);
+  spiffs_cache *cache = spiffs_get_cache(fs);
+  int n = MIN(SPIFFS_CACHE_WR_PAGES, MAX(1, cache->cpage_count / 2));
+  spiffs_cache_page *cp = 0;
+  while (n > 0 && (cp = spiffs_cache_page_allocate_adjacent(fs, n)) == 0) {
+    n--;
+  }
   if (cp == 0) {
     // could not get cache page
     return 0;
   }
 
-  cp->flags = SPIFFS_CACHE_FLAG_TYPE_WR;
   cp->obj_id = fd->obj_id;
   fd->cache_page = cp;
   return cp;
@@ -271,6 +344,8 @@ void spiffs_cache_init(spiffs *fs) {
   int cache_entries =
       (sz - sizeof(spiffs_cache)) / (SPIFFS_CACHE_PAGE_SIZE(fs));
   if (cache_entries <= 0) return;
+  // one bit per entry in cpage_use_map
+  if (cache_entries > 32) cache_entries = 32;
 
   for (i = 0; i < cache_entries; i++) {
     cache_mask <<= 1;
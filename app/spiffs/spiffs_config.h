@@ -53,12 +53,39 @@
 #define SPIFFS_CACHE_WR                 1
 #endif
 
+// Most adjacent cache pages a file descriptor's write cache may use, at
+// most half of the cache. Small writes are collected until this many pages
+// are full, so that the object index is updated once for all of them.
+#ifndef  SPIFFS_CACHE_WR_PAGES
+#define SPIFFS_CACHE_WR_PAGES           1
+#endif
+
 // Enable/disable statistics on caching. Debug/test purpose only.
 #ifndef  SPIFFS_CACHE_STATS
 #define SPIFFS_CACHE_STATS              1
 #endif
 #endif
 
+// Enables/disable an index in ram from file names to object index header
+// pages, so that open, stat, remove and rename need not scan all object
+// lookup pages. Memory for it is given with SPIFFS_set_name_index after
+// mount. Enabled when user_config.h sets SPIFFS_NAME_INDEX_ENTRIES.
+#ifndef SPIFFS_NAME_INDEX
+#ifdef SPIFFS_NAME_INDEX_ENTRIES
+#define SPIFFS_NAME_INDEX               1
+#else
+#define SPIFFS_NAME_INDEX               0
+#endif
+#endif
+
+// Number of object index pages each file descriptor remembers the location
+// of, besides the index header and the page at the current offset. Saves
+// searching the object lookup pages when seeking in or reading large files.
+// 0 disables the cache.
+#ifndef SPIFFS_IX_CACHE
+#define SPIFFS_IX_CACHE                 8
+#endif
+
 // Always check header of each accessed page to ensure consistent state.
 // If enabled it will increase number of reads, will increase flash.
 #ifndef SPIFFS_PAGE_CHECK
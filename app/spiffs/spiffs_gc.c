@@ -195,6 +195,46 @@ s32_t spiffs_gc_check(
   return res;
 }
 
+// Collects at most one block, the best candidate, if fewer than
+// min_free_blocks blocks are free and some pages are deleted. Unlike
+// spiffs_gc_check, which collects as many blocks as a write needs, this
+// lets gc run in bounded steps while the system is idle.
+// Returns the number of pages reclaimed, 0 if there was nothing to do.
+s32_t spiffs_gc_step(
+    spiffs *fs,
+    u32_t min_free_blocks) {
+  s32_t res;
+  u32_t deleted = fs->stats_p_deleted;
+  spiffs_block_ix *cands;
+  int count;
+
+  if (fs->free_blocks >= min_free_blocks || fs->stats_p_deleted == 0) {
+    return 0;
+  }
+  res = spiffs_gc_find_candidate(fs, &cands, &count, 0);
+  SPIFFS_CHECK_RES(res);
+  if (count == 0) {
+    return 0;
+  }
+  spiffs_block_ix cand = cands[0];
+#if SPIFFS_GC_STATS
+  fs->stats_gc_runs++;
+#endif
+  SPIFFS_GC_DBG("gc_step: cleaning block %i, free_blocks:%i\n", cand, fs->free_blocks);
+  fs->cleaning = 1;
+  res = spiffs_gc_clean(fs, cand);
+  fs->cleaning = 0;
+  SPIFFS_CHECK_RES(res);
+
+  res = spiffs_gc_erase_page_stats(fs, cand);
+  SPIFFS_CHECK_RES(res);
+
+  res = spiffs_gc_erase_block(fs, cand);
+  SPIFFS_CHECK_RES(res);
+
+  return deleted > fs->stats_p_deleted ? deleted - fs->stats_p_deleted : 0;
+}
+
 // Updates page statistics for a block that is about to be erased
 s32_t spiffs_gc_erase_page_stats(
     spiffs *fs,
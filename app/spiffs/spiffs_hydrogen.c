@@ -113,7 +113,9 @@ s32_t SPIFFS_mount(spiffs *fs, spiffs_config *config, u8_t *work,
 
 #if SPIFFS_CACHE
   fs->cache = cache;
-  fs->cache_size = (cache_size > (SPIFFS_CFG_LOG_PAGE_SZ(fs)*32)) ? SPIFFS_CFG_LOG_PAGE_SZ(fs)*32 : cache_size;
+  // one bit per page in cpage_use_map
+  fs->cache_size = MIN(cache_size,
+      sizeof(spiffs_cache) + 32 * (sizeof(spiffs_cache_page) + SPIFFS_CFG_LOG_PAGE_SZ(fs)));
   spiffs_cache_init(fs);
 #endif
 
@@ -483,14 +485,14 @@ s32_t SPIFFS_write(spiffs *fs, spiffs_file fh, void *buf, s32_t len) {
 
 #if SPIFFS_CACHE_WR
   if ((fd->flags & SPIFFS_O_DIRECT) == 0) {
-    if (len < (s32_t)SPIFFS_CFG_LOG_PAGE_SZ(fs)) {
+    if (len < (s32_t)(SPIFFS_CFG_LOG_PAGE_SZ(fs) * SPIFFS_CACHE_WR_PAGES)) {
       // small write, try to cache it
       u8_t alloc_cpage = 1;
       if (fd->cache_page) {
         // have a cached page for this fd already, check cache page boundaries
         if (offset < fd->cache_page->offset || // writing before cache
             offset > fd->cache_page->offset + fd->cache_page->size || // writing after cache
-            offset + len > fd->cache_page->offset + SPIFFS_CFG_LOG_PAGE_SZ(fs)) // writing beyond cache page
+            offset + len > fd->cache_page->offset + SPIFFS_CACHE_WR_SIZE(fs, fd->cache_page)) // writing beyond cache page
         {
           // boundary violation, write back cache first and allocate new
           SPIFFS_CACHE_DBG("CACHE_WR_DUMP: dumping cache page %i for fd %i:%04x, boundary viol, offs:%i size:%i\n",
@@ -513,6 +515,10 @@ s32_t SPIFFS_write(spiffs *fs, spiffs_file fh, void *buf, s32_t len) {
           fd->cache_page->size = 0;
           SPIFFS_CACHE_DBG("CACHE_WR_ALLO: allocating cache page %i for fd %i:%04x\n",
               fd->cache_page->ix, fd->file_nbr, fd->obj_id);
+          if ((u32_t)len > SPIFFS_CACHE_WR_SIZE(fs, fd->cache_page)) {
+            // got fewer pages than needed, write directly
+            spiffs_cache_fd_release(fs, fd->cache_page);
+          }
         }
       }
 
@@ -546,8 +552,7 @@ s32_t SPIFFS_write(spiffs *fs, spiffs_file fh, void *buf, s32_t len) {
             fd->cache_page->offset, fd->cache_page->size);
         spiffs_cache_fd_release(fs, fd->cache_page);
         SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
-        res = spiffs_hydro_write(fs, fd, buf, offset, len);
-        SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+        // the big write itself follows below
       }
     }
   }
@@ -596,8 +601,7 @@ s32_t SPIFFS_lseek(spiffs *fs, spiffs_file fh, s32_t offs, int whence) {
   spiffs_span_ix objix_spix = SPIFFS_OBJ_IX_ENTRY_SPAN_IX(fs, data_spix);
   if (fd->cursor_objix_spix != objix_spix) {
     spiffs_page_ix pix;
-    res = spiffs_obj_lu_find_id_and_span(
-        fs, fd->obj_id | SPIFFS_OBJ_ID_IX_FLAG, objix_spix, 0, &pix);
+    res = spiffs_fd_find_objix(fd, objix_spix, &pix);
     SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
     fd->cursor_objix_spix = objix_spix;
     fd->cursor_objix_pix = pix;
@@ -814,9 +818,14 @@ s32_t SPIFFS_close(spiffs *fs, spiffs_file fh) {
   fh = SPIFFS_FH_UNOFFS(fs, fh);
 #if SPIFFS_CACHE
   res = spiffs_fflush_cache(fs, fh);
-  SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
 #endif
-  res = spiffs_fd_return(fs, fh);
+  // the descriptor is returned even if the flush failed, e.g. because the
+  // file system is full, otherwise it could never be closed
+  s32_t ret_res = spiffs_fd_return(fs, fh);
+  if (res == SPIFFS_OK || res == SPIFFS_ERR_BAD_DESCRIPTOR ||
+      res == SPIFFS_ERR_FILE_CLOSED) {
+    res = ret_res;
+  }
   SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
 
   SPIFFS_UNLOCK(fs);
@@ -984,6 +993,19 @@ s32_t SPIFFS_check(spiffs *fs) {
 
   res = spiffs_obj_lu_scan(fs);
 
+#if SPIFFS_NAME_INDEX
+  // checks move and delete pages behind the name index' back
+  fs->name_index_state = SPIFFS_NIX_STALE;
+#endif
+#if SPIFFS_IX_CACHE
+  // ... and behind the object index caches' back
+  u32_t i;
+  spiffs_fd *fds = (spiffs_fd *)fs->fd_space;
+  for (i = 0; i < fs->fd_count; i++) {
+    memset(fds[i].ix_cache_pix, 0, sizeof(fds[i].ix_cache_pix));
+  }
+#endif
+
   SPIFFS_UNLOCK(fs);
   return res;
 #endif // SPIFFS_READ_ONLY
@@ -1050,6 +1072,24 @@ s32_t SPIFFS_gc(spiffs *fs, u32_t size) {
 #endif // SPIFFS_READ_ONLY
 }
 
+s32_t SPIFFS_gc_step(spiffs *fs, u32_t min_free_blocks) {
+#if SPIFFS_READ_ONLY
+  (void)fs; (void)min_free_blocks;
+  return SPIFFS_ERR_RO_NOT_IMPL;
+#else
+  s32_t res;
+  SPIFFS_API_CHECK_CFG(fs);
+  SPIFFS_API_CHECK_MOUNT(fs);
+  SPIFFS_LOCK(fs);
+
+  res = spiffs_gc_step(fs, min_free_blocks);
+
+  SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+  SPIFFS_UNLOCK(fs);
+  return res;
+#endif // SPIFFS_READ_ONLY
+}
+
 s32_t SPIFFS_eof(spiffs *fs, spiffs_file fh) {
   s32_t res;
   SPIFFS_API_CHECK_CFG(fs);
@@ -1103,6 +1143,24 @@ s32_t SPIFFS_set_file_callback_func(spiffs *fs, spiffs_file_callback cb_func) {
   return 0;
 }
 
+#if SPIFFS_NAME_INDEX
+s32_t SPIFFS_set_name_index(spiffs *fs, void *buf, u32_t size) {
+  SPIFFS_LOCK(fs);
+  // align index to entry boundary
+  u8_t addr_lsb = ((u8_t)(intptr_t)buf) & (sizeof(spiffs_obj_id)-1);
+  if (buf && addr_lsb && size >= sizeof(spiffs_obj_id)) {
+    buf = (u8_t *)buf + (sizeof(spiffs_obj_id)-addr_lsb);
+    size -= (sizeof(spiffs_obj_id)-addr_lsb);
+  }
+  fs->name_index_len = buf ? size / sizeof(spiffs_name_index_entry) : 0;
+  fs->name_index = fs->name_index_len ? buf : 0;
+  fs->name_index_used = 0;
+  fs->name_index_state = SPIFFS_NIX_STALE;
+  SPIFFS_UNLOCK(fs);
+  return 0;
+}
+#endif
+
 #if SPIFFS_TEST_VISUALISATION
 s32_t SPIFFS_vis(spiffs *fs) {
   s32_t res = SPIFFS_OK;
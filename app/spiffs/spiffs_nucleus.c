@@ -594,6 +594,41 @@ s32_t spiffs_obj_lu_find_id_and_span(
   return res;
 }
 
+// Find object index page of given span index of an open object. Looks at
+// the object index header, the page at the cursor and the object index
+// cache of the file descriptor before searching the object lookup pages.
+s32_t spiffs_fd_find_objix(
+    spiffs_fd *fd,
+    spiffs_span_ix objix_spix,
+    spiffs_page_ix *pix) {
+  s32_t res;
+  if (objix_spix == 0) {
+    *pix = fd->objix_hdr_pix;
+    return SPIFFS_OK;
+  }
+  if (fd->cursor_objix_spix == objix_spix && fd->cursor_objix_pix != 0) {
+    *pix = fd->cursor_objix_pix;
+    return SPIFFS_OK;
+  }
+#if SPIFFS_IX_CACHE
+  int i;
+  for (i = 0; i < SPIFFS_IX_CACHE; i++) {
+    if (fd->ix_cache_pix[i] != 0 && fd->ix_cache_spix[i] == objix_spix) {
+      *pix = fd->ix_cache_pix[i];
+      return SPIFFS_OK;
+    }
+  }
+#endif
+  res = spiffs_obj_lu_find_id_and_span(fd->fs, fd->obj_id | SPIFFS_OBJ_ID_IX_FLAG, objix_spix, 0, pix);
+  SPIFFS_CHECK_RES(res);
+#if SPIFFS_IX_CACHE
+  fd->ix_cache_spix[fd->ix_cache_next] = objix_spix;
+  fd->ix_cache_pix[fd->ix_cache_next] = *pix;
+  fd->ix_cache_next = (fd->ix_cache_next + 1) % SPIFFS_IX_CACHE;
+#endif
+  return res;
+}
+
 // Find object lookup entry containing given id and span index in page headers only
 // Iterate over object lookup pages in each block until a given object id entry is found
 s32_t spiffs_obj_lu_find_id_and_span_by_phdr(
@@ -789,6 +824,173 @@ s32_t spiffs_page_delete(
 }
 #endif // !SPIFFS_READ_ONLY
 
+#if SPIFFS_NAME_INDEX
+// The name index maps object names to object index header pages. It is an
+// open addressed hash table with linear probing, keyed by a 16 bit hash of
+// the name; a pix of 0, which always is an object lookup page, marks a free
+// slot. Entries follow the object index headers through
+// spiffs_cb_object_event, and a hit is always checked against the header on
+// flash, so an out of date entry costs a scan but never finds the wrong file.
+
+static u16_t spiffs_name_hash(const u8_t *name) {
+  // FNV-1a, folded to 16 bits
+  u32_t h = 2166136261u;
+  while (*name) {
+    h ^= *name++;
+    h *= 16777619u;
+  }
+  return (u16_t)(h ^ (h >> 16));
+}
+
+static spiffs_name_index_entry *spiffs_name_index_find_id(spiffs *fs, spiffs_obj_id obj_id) {
+  spiffs_name_index_entry *e = (spiffs_name_index_entry *)fs->name_index;
+  u32_t i;
+  for (i = 0; i < fs->name_index_len; i++) {
+    if (e[i].pix != 0 && e[i].obj_id == obj_id) return &e[i];
+  }
+  return 0;
+}
+
+static void spiffs_name_index_add(spiffs *fs, u16_t hash, spiffs_obj_id obj_id, spiffs_page_ix pix) {
+  spiffs_name_index_entry *e = (spiffs_name_index_entry *)fs->name_index;
+  u32_t i;
+  // keep some slots free so that probe sequences stay short and end
+  if (fs->name_index_used + 1 >= fs->name_index_len - fs->name_index_len / 8) {
+    fs->name_index_state = SPIFFS_NIX_PARTIAL;
+    return;
+  }
+  for (i = hash % fs->name_index_len; e[i].pix != 0; i = (i + 1) % fs->name_index_len);
+  e[i].hash = hash;
+  e[i].obj_id = obj_id;
+  e[i].pix = pix;
+  fs->name_index_used++;
+}
+
+static void spiffs_name_index_remove(spiffs *fs, spiffs_name_index_entry *entry) {
+  spiffs_name_index_entry *e = (spiffs_name_index_entry *)fs->name_index;
+  u32_t len = fs->name_index_len;
+  u32_t i = entry - e;
+  u32_t j = i;
+  // shift following entries of the probe sequence back into the hole
+  while (1) {
+    j = (j + 1) % len;
+    if (e[j].pix == 0) break;
+    u32_t home = e[j].hash % len;
+    if (i <= j ? (i < home && home <= j) : (i < home || home <= j)) continue;
+    e[i] = e[j];
+    i = j;
+  }
+  e[i].pix = 0;
+  fs->name_index_used--;
+}
+
+static s32_t spiffs_name_index_build_v(
+    spiffs *fs,
+    spiffs_obj_id obj_id,
+    spiffs_block_ix bix,
+    int ix_entry,
+    const void *user_const_p,
+    void *user_var_p) {
+  (void)user_const_p;
+  (void)user_var_p;
+  s32_t res;
+  spiffs_page_object_ix_header objix_hdr;
+  spiffs_page_ix pix = SPIFFS_OBJ_LOOKUP_ENTRY_TO_PIX(fs, bix, ix_entry);
+  if (obj_id == SPIFFS_OBJ_ID_FREE || obj_id == SPIFFS_OBJ_ID_DELETED ||
+      (obj_id & SPIFFS_OBJ_ID_IX_FLAG) == 0) {
+    return SPIFFS_VIS_COUNTINUE;
+  }
+  res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU2 | SPIFFS_OP_C_READ,
+      0, SPIFFS_PAGE_TO_PADDR(fs, pix), sizeof(spiffs_page_object_ix_header), (u8_t *)&objix_hdr);
+  SPIFFS_CHECK_RES(res);
+  if (objix_hdr.p_hdr.span_ix == 0 &&
+      (objix_hdr.p_hdr.flags & (SPIFFS_PH_FLAG_DELET | SPIFFS_PH_FLAG_FINAL | SPIFFS_PH_FLAG_IXDELE)) ==
+          (SPIFFS_PH_FLAG_DELET | SPIFFS_PH_FLAG_IXDELE)) {
+    objix_hdr.name[SPIFFS_OBJ_NAME_LEN - 1] = 0;
+    spiffs_name_index_add(fs, spiffs_name_hash(objix_hdr.name), obj_id & ~SPIFFS_OBJ_ID_IX_FLAG, pix);
+    if (fs->name_index_state == SPIFFS_NIX_PARTIAL) {
+      // index is full, no point in looking further
+      return SPIFFS_OK;
+    }
+  }
+  return SPIFFS_VIS_COUNTINUE;
+}
+
+// Fills the name index from the object lookup pages
+static s32_t spiffs_name_index_build(spiffs *fs) {
+  s32_t res;
+  memset(fs->name_index, 0, fs->name_index_len * sizeof(spiffs_name_index_entry));
+  fs->name_index_used = 0;
+  fs->name_index_state = SPIFFS_NIX_COMPLETE;
+  res = spiffs_obj_lu_find_entry_visitor(fs, 0, 0, SPIFFS_VIS_NO_WRAP, 0,
+      spiffs_name_index_build_v, 0, 0, 0, 0);
+  if (res == SPIFFS_VIS_END) {
+    res = SPIFFS_OK;
+  }
+  if (res != SPIFFS_OK) {
+    fs->name_index_state = SPIFFS_NIX_STALE;
+  }
+  SPIFFS_DBG("name index: built, %i of %i entries, state %i\n", fs->name_index_used, fs->name_index_len, fs->name_index_state);
+  return res;
+}
+
+// Looks up name in the name index. Returns SPIFFS_OK and the object index
+// header page if found, SPIFFS_ERR_NOT_FOUND if the index holds all objects
+// and name is not amongst them, or SPIFFS_VIS_COUNTINUE if the object lookup
+// pages must be searched.
+static s32_t spiffs_name_index_lookup(spiffs *fs, const u8_t *name, spiffs_page_ix *pix) {
+  spiffs_name_index_entry *e = (spiffs_name_index_entry *)fs->name_index;
+  spiffs_page_object_ix_header objix_hdr;
+  s32_t res;
+  u16_t hash;
+  u32_t i;
+
+  if (e == 0) return SPIFFS_VIS_COUNTINUE;
+  if (fs->name_index_state == SPIFFS_NIX_STALE) {
+    res = spiffs_name_index_build(fs);
+    SPIFFS_CHECK_RES(res);
+  }
+
+  hash = spiffs_name_hash(name);
+  for (i = hash % fs->name_index_len; e[i].pix != 0; i = (i + 1) % fs->name_index_len) {
+    if (e[i].hash != hash) continue;
+    res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU2 | SPIFFS_OP_C_READ,
+        0, SPIFFS_PAGE_TO_PADDR(fs, e[i].pix), sizeof(spiffs_page_object_ix_header), (u8_t *)&objix_hdr);
+    SPIFFS_CHECK_RES(res);
+    if ((objix_hdr.p_hdr.obj_id & ~SPIFFS_OBJ_ID_IX_FLAG) != e[i].obj_id ||
+        objix_hdr.p_hdr.span_ix != 0 ||
+        (objix_hdr.p_hdr.flags & (SPIFFS_PH_FLAG_DELET | SPIFFS_PH_FLAG_FINAL | SPIFFS_PH_FLAG_IXDELE)) !=
+            (SPIFFS_PH_FLAG_DELET | SPIFFS_PH_FLAG_IXDELE)) {
+      // out of step with flash, rebuild on next lookup
+      SPIFFS_DBG("name index: stale entry %04x @ %04x\n", e[i].obj_id, e[i].pix);
+      fs->name_index_state = SPIFFS_NIX_STALE;
+      return SPIFFS_VIS_COUNTINUE;
+    }
+    if (strncmp((const char *)name, (char *)objix_hdr.name, SPIFFS_OBJ_NAME_LEN) == 0) {
+      if (pix) *pix = e[i].pix;
+      return SPIFFS_OK;
+    }
+  }
+  return fs->name_index_state == SPIFFS_NIX_COMPLETE ? SPIFFS_ERR_NOT_FOUND : SPIFFS_VIS_COUNTINUE;
+}
+
+// Enters a new or renamed object in the name index
+static void spiffs_name_index_set_name(spiffs *fs, spiffs_obj_id obj_id, const u8_t *name, spiffs_page_ix pix) {
+  spiffs_name_index_entry *e;
+  u8_t n[SPIFFS_OBJ_NAME_LEN];
+  if (fs->name_index == 0 || fs->name_index_state == SPIFFS_NIX_STALE) return;
+  obj_id &= ~SPIFFS_OBJ_ID_IX_FLAG;
+  e = spiffs_name_index_find_id(fs, obj_id);
+  if (e) {
+    spiffs_name_index_remove(fs, e);
+  }
+  // hash the name as it is stored in the object index header
+  strncpy((char *)n, (const char *)name, SPIFFS_OBJ_NAME_LEN);
+  n[SPIFFS_OBJ_NAME_LEN - 1] = 0;
+  spiffs_name_index_add(fs, spiffs_name_hash(n), obj_id, pix);
+}
+#endif // SPIFFS_NAME_INDEX
+
 #if !SPIFFS_READ_ONLY
 // Create an object index header page with empty index and undefined length
 s32_t spiffs_object_create(
@@ -834,6 +1036,9 @@ s32_t spiffs_object_create(
 
   SPIFFS_CHECK_RES(res);
   spiffs_cb_object_event(fs, 0, SPIFFS_EV_IX_NEW, obj_id, 0, SPIFFS_OBJ_LOOKUP_ENTRY_TO_PIX(fs, bix, entry), SPIFFS_UNDEFINED_LEN);
+#if SPIFFS_NAME_INDEX
+  spiffs_name_index_set_name(fs, obj_id, name, SPIFFS_OBJ_LOOKUP_ENTRY_TO_PIX(fs, bix, entry));
+#endif
 
   if (objix_hdr_pix) {
     *objix_hdr_pix = SPIFFS_OBJ_LOOKUP_ENTRY_TO_PIX(fs, bix, entry);
@@ -893,6 +1098,11 @@ s32_t spiffs_object_update_index_hdr(
     }
     // callback on object index update
     spiffs_cb_object_event(fs, fd, SPIFFS_EV_IX_UPD, obj_id, objix_hdr->p_hdr.span_ix, new_objix_hdr_pix, objix_hdr->size);
+#if SPIFFS_NAME_INDEX
+    if (name) {
+      spiffs_name_index_set_name(fs, obj_id, name, new_objix_hdr_pix);
+    }
+#endif
     if (fd) fd->objix_hdr_pix = new_objix_hdr_pix; // if this is not in the registered cluster
   }
 
@@ -936,7 +1146,31 @@ void spiffs_cb_object_event(
         cur_fd->cursor_objix_pix = 0;
       }
     }
+#if SPIFFS_IX_CACHE
+    int j;
+    for (j = 0; j < SPIFFS_IX_CACHE; j++) {
+      if (cur_fd->ix_cache_pix[j] != 0 && cur_fd->ix_cache_spix[j] == spix) {
+        cur_fd->ix_cache_pix[j] = ev == SPIFFS_EV_IX_DEL ? 0 : new_pix;
+      }
+    }
+#endif
+  }
+
+#if SPIFFS_NAME_INDEX
+  // follow object index headers in name index
+  if (spix == 0 && fs->name_index && fs->name_index_state != SPIFFS_NIX_STALE) {
+    spiffs_name_index_entry *e = spiffs_name_index_find_id(fs, obj_id);
+    if (e && (ev == SPIFFS_EV_IX_NEW || ev == SPIFFS_EV_IX_UPD)) {
+      e->pix = new_pix;
+    } else if (e && ev == SPIFFS_EV_IX_DEL && e->pix == new_pix) {
+      spiffs_name_index_remove(fs, e);
+      if (fs->name_index_state == SPIFFS_NIX_PARTIAL) {
+        // there is room now for objects left out, rebuild on next lookup
+        fs->name_index_state = SPIFFS_NIX_STALE;
+      }
+    }
   }
+#endif
 
   // callback to user if object index header
   if (fs->file_cb_f && spix == 0 && (obj_id_raw & SPIFFS_OBJ_ID_IX_FLAG)) {
@@ -1124,12 +1358,8 @@ s32_t spiffs_object_append(spiffs_fd *fd, u32_t offset, u8_t *data, u32_t len) {
           // on first pass, we load existing object index page
           spiffs_page_ix pix;
           SPIFFS_DBG("append: %04x find objix span_ix:%04x\n", fd->obj_id, cur_objix_spix);
-          if (fd->cursor_objix_spix == cur_objix_spix) {
-            pix = fd->cursor_objix_pix;
-          } else {
-            res = spiffs_obj_lu_find_id_and_span(fs, fd->obj_id | SPIFFS_OBJ_ID_IX_FLAG, cur_objix_spix, 0, &pix);
-            SPIFFS_CHECK_RES(res);
-          }
+          res = spiffs_fd_find_objix(fd, cur_objix_spix, &pix);
+          SPIFFS_CHECK_RES(res);
           SPIFFS_DBG("append: %04x found object index at page %04x [fd size %i]\n", fd->obj_id, pix, fd->size);
           res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_IX | SPIFFS_OP_C_READ,
               fd->file_nbr, SPIFFS_PAGE_TO_PADDR(fs, pix), SPIFFS_CFG_LOG_PAGE_SZ(fs), fs->work);
@@ -1322,12 +1552,8 @@ s32_t spiffs_object_modify(spiffs_fd *fd, u32_t offset, u8_t *data, u32_t len) {
         // load existing object index page on first pass
         spiffs_page_ix pix;
         SPIFFS_DBG("modify: find objix span_ix:%04x\n", cur_objix_spix);
-        if (fd->cursor_objix_spix == cur_objix_spix) {
-          pix = fd->cursor_objix_pix;
-        } else {
-          res = spiffs_obj_lu_find_id_and_span(fs, fd->obj_id | SPIFFS_OBJ_ID_IX_FLAG, cur_objix_spix, 0, &pix);
-          SPIFFS_CHECK_RES(res);
-        }
+        res = spiffs_fd_find_objix(fd, cur_objix_spix, &pix);
+        SPIFFS_CHECK_RES(res);
         SPIFFS_DBG("modify: found object index at page %04x\n", pix);
         res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_IX | SPIFFS_OP_C_READ,
             fd->file_nbr, SPIFFS_PAGE_TO_PADDR(fs, pix), SPIFFS_CFG_LOG_PAGE_SZ(fs), fs->work);
@@ -1495,6 +1721,13 @@ s32_t spiffs_object_find_object_index_header_by_name(
   spiffs_block_ix bix;
   int entry;
 
+#if SPIFFS_NAME_INDEX
+  res = spiffs_name_index_lookup(fs, name, pix);
+  if (res != SPIFFS_VIS_COUNTINUE) {
+    return res;
+  }
+#endif
+
   res = spiffs_obj_lu_find_entry_visitor(fs,
       fs->cursor_block_ix,
       fs->cursor_obj_lu_entry,
@@ -1594,12 +1827,8 @@ s32_t spiffs_object_truncate(
         }
       }
       // load current object index (header) page
-      if (cur_objix_spix == 0) {
-        objix_pix = fd->objix_hdr_pix;
-      } else {
-        res = spiffs_obj_lu_find_id_and_span(fs, fd->obj_id | SPIFFS_OBJ_ID_IX_FLAG, cur_objix_spix, 0, &objix_pix);
-        SPIFFS_CHECK_RES(res);
-      }
+      res = spiffs_fd_find_objix(fd, cur_objix_spix, &objix_pix);
+      SPIFFS_CHECK_RES(res);
 
       SPIFFS_DBG("truncate: load objix page %04x:%04x for data spix:%04x\n", objix_pix, cur_objix_spix, data_spix);
       res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_IX | SPIFFS_OP_C_READ,
@@ -1779,13 +2008,9 @@ s32_t spiffs_object_read(
     cur_objix_spix = SPIFFS_OBJ_IX_ENTRY_SPAN_IX(fs, data_spix);
     if (prev_objix_spix != cur_objix_spix) {
       // load current object index (header) page
-      if (cur_objix_spix == 0) {
-        objix_pix = fd->objix_hdr_pix;
-      } else {
-        SPIFFS_DBG("read: find objix %04x:%04x\n", fd->obj_id, cur_objix_spix);
-        res = spiffs_obj_lu_find_id_and_span(fs, fd->obj_id | SPIFFS_OBJ_ID_IX_FLAG, cur_objix_spix, 0, &objix_pix);
-        SPIFFS_CHECK_RES(res);
-      }
+      SPIFFS_DBG("read: find objix %04x:%04x\n", fd->obj_id, cur_objix_spix);
+      res = spiffs_fd_find_objix(fd, cur_objix_spix, &objix_pix);
+      SPIFFS_CHECK_RES(res);
       SPIFFS_DBG("read: load objix page %04x:%04x for data spix:%04x\n", objix_pix, cur_objix_spix, data_spix);
       res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_IX | SPIFFS_OP_C_READ,
           fd->file_nbr, SPIFFS_PAGE_TO_PADDR(fs, objix_pix), SPIFFS_CFG_LOG_PAGE_SZ(fs), fs->work);
@@ -2014,6 +2239,9 @@ s32_t spiffs_fd_find_new(spiffs *fs, spiffs_fd **fd) {
     spiffs_fd *cur_fd = &fds[i];
     if (cur_fd->file_nbr == 0) {
       cur_fd->file_nbr = i+1;
+#if SPIFFS_IX_CACHE
+      memset(cur_fd->ix_cache_pix, 0, sizeof(cur_fd->ix_cache_pix));
+#endif
       *fd = cur_fd;
       return SPIFFS_OK;
     }
@@ -124,6 +124,10 @@
 #define SPIFFS_EV_IX_NEW                1
 #define SPIFFS_EV_IX_DEL                2
 
+#define SPIFFS_NIX_STALE                0
+#define SPIFFS_NIX_COMPLETE             1
+#define SPIFFS_NIX_PARTIAL              2
+
 #define SPIFFS_OBJ_ID_IX_FLAG           ((spiffs_obj_id)(1<<(8*sizeof(spiffs_obj_id)-1)))
 
 #define SPIFFS_UNDEFINED_LEN            (u32_t)(-1)
@@ -346,6 +350,8 @@
 #define SPIFFS_CACHE_FLAG_OBJLU       (1<<2)
 #define SPIFFS_CACHE_FLAG_OBJIX       (1<<3)
 #define SPIFFS_CACHE_FLAG_DATA        (1<<4)
+// write cache page which continues the one before it
+#define SPIFFS_CACHE_FLAG_WR_CONT     (1<<6)
 #define SPIFFS_CACHE_FLAG_TYPE_WR     (1<<7)
 
 #define SPIFFS_CACHE_PAGE_SIZE(fs) \
@@ -354,11 +360,17 @@
 #define spiffs_get_cache(fs) \
   ((spiffs_cache *)((fs)->cache))
 
+// all cache page headers come first, followed by the pages, so that the
+// pages of adjacent cache entries are contiguous
 #define spiffs_get_cache_page_hdr(fs, c, ix) \
-  ((spiffs_cache_page *)(&((c)->cpages[(ix) * SPIFFS_CACHE_PAGE_SIZE(fs)])))
+  (&((spiffs_cache_page *)((c)->cpages))[(ix)])
 
 #define spiffs_get_cache_page(fs, c, ix) \
-  ((u8_t *)(&((c)->cpages[(ix) * SPIFFS_CACHE_PAGE_SIZE(fs)])) + sizeof(spiffs_cache_page))
+  ((c)->cpages + (c)->cpage_count * sizeof(spiffs_cache_page) + (ix) * SPIFFS_CFG_LOG_PAGE_SZ(fs))
+
+// bytes a write cache page can hold
+#define SPIFFS_CACHE_WR_SIZE(fs, cp) \
+  ((cp)->pages * SPIFFS_CFG_LOG_PAGE_SZ(fs))
 
 // cache page struct
 typedef struct {
@@ -383,6 +395,8 @@ typedef struct {
       u32_t offset;
       // size of cache page
       u16_t size;
+      // number of adjacent cache pages used
+      u8_t pages;
     };
 #endif
   };
@@ -422,6 +436,14 @@ typedef struct {
   u32_t fdoffset;
   // fd flags
   spiffs_flags flags;
+#if SPIFFS_IX_CACHE
+  // cached object index span indices
+  spiffs_span_ix ix_cache_spix[SPIFFS_IX_CACHE];
+  // cached object index page indices, 0 if entry is unused
+  spiffs_page_ix ix_cache_pix[SPIFFS_IX_CACHE];
+  // next object index cache entry to replace
+  u8_t ix_cache_next;
+#endif
 #if SPIFFS_CACHE_WR
   spiffs_cache_page *cache_page;
 #endif
@@ -466,6 +488,18 @@ typedef struct __attribute(( packed )) {
  u8_t _align[4 - ((sizeof(spiffs_page_header)&3)==0 ? 4 : (sizeof(spiffs_page_header)&3))];
 } spiffs_page_object_ix;
 
+#if SPIFFS_NAME_INDEX
+// name index entry
+typedef struct {
+  // hash of object name
+  u16_t hash;
+  // object id without index flag
+  spiffs_obj_id obj_id;
+  // object index header page, 0 if entry is free
+  spiffs_page_ix pix;
+} spiffs_name_index_entry;
+#endif
+
 // callback func for object lookup visitor
 typedef s32_t (*spiffs_visitor_f)(spiffs *fs, spiffs_obj_id id, spiffs_block_ix bix, int ix_entry,
     const void *user_const_p, void *user_var_p);
@@ -575,6 +609,11 @@ s32_t spiffs_obj_lu_find_id_and_span(
     spiffs_page_ix exclusion_pix,
     spiffs_page_ix *pix);
 
+s32_t spiffs_fd_find_objix(
+    spiffs_fd *fd,
+    spiffs_span_ix objix_spix,
+    spiffs_page_ix *pix);
+
 s32_t spiffs_obj_lu_find_id_and_span_by_phdr(
     spiffs *fs,
     spiffs_obj_id obj_id,
@@ -700,6 +739,10 @@ s32_t spiffs_gc_clean(
 s32_t spiffs_gc_quick(
     spiffs *fs, u16_t max_free_pages);
 
+s32_t spiffs_gc_step(
+    spiffs *fs,
+    u32_t min_free_blocks);
+
 // ---------------
 
 s32_t spiffs_fd_find_new(
@@ -0,0 +1,36 @@
+-- What node.compile() costs, on the firmware or the host build of the firmware
+-- Lua VM (lua.host):
+--   lua.host -d dir compile.lua [script.lua ...]
+-- Without arguments a script of about 40kB with many small functions and
+-- constants is written to compile_bench.lua and compiled. Each line reports,
+-- tab separated:
+--   script, size of the .lc, ms, and on the host the writes which reached the
+--   file system and the bytes they wrote
+
+local fmt = string.format
+
+local clock = bench and bench.clock or function() return tmr.now() / 1000 end
+local fswrites = bench and bench.fswrites or function() return 0, 0 end
+
+local scripts = { ... }
+if #scripts == 0 then
+  local f = file.open("compile_bench.lua", "w")
+  f:write("local M = {}\n")
+  for i = 1, 400 do
+    f:write(fmt("function M.f%d(t, x)\n  if x > %d then t.k%d = %q .. x end\n  return x * %d + %g\nend\n",
+      i, i, i % 50, "value" .. i, i, i / 7))
+  end
+  f:write("return M\n")
+  f:close()
+  scripts[1] = "compile_bench.lua"
+end
+
+for _, name in ipairs(scripts) do
+  local w0, b0 = fswrites()
+  local t0 = clock()
+  node.compile(name)
+  local ms = clock() - t0
+  local w1, b1 = fswrites()
+  local lc = name:gsub("%.lua$", ".lc")
+  print(fmt("%s\t%d\t%.1f\t%d\t%d", name, file.list()[lc] or 0, ms, w1 - w0, b1 - b0))
+end
@@ -0,0 +1,43 @@
+-- Several files in use at once, on the firmware or the host build of the
+-- firmware Lua VM (lua.host):
+--   lua.host -d dir files.lua [lines]
+-- A log is appended a line at a time while a config file is read a line at a
+-- time and a static file is served in 64 byte pieces, all three kept open,
+-- for lines (default 2000) log lines. Each line reports, tab separated:
+--   what, ms, and on the host the reads and writes which reached the file
+--   system and the bytes they moved
+
+local fmt = string.format
+local lines = tonumber((...)) or 2000
+
+local clock = bench and bench.clock or function() return tmr.now() / 1000 end
+local fsreads = bench and bench.fsreads or function() return 0, 0 end
+local fswrites = bench and bench.fswrites or function() return 0, 0 end
+
+local function make(name, line, n)
+  local f = file.open(name, "w")
+  for i = 1, n do f:write(fmt(line, i)) end
+  f:close()
+end
+make("files_cfg.txt", "key%d=value\n", 50)
+make("files_www.txt", "<p>paragraph %d of the page</p>\n", 200)
+file.remove("files_log.txt")
+
+local r0, rb0 = fsreads()
+local w0, wb0 = fswrites()
+local t0 = clock()
+local log = file.open("files_log.txt", "a+")
+local cfg = file.open("files_cfg.txt", "r")
+local www = file.open("files_www.txt", "r")
+for i = 1, lines do
+  log:write(fmt("%d,event,%d\n", i, i * 7 % 1000))
+  if not cfg:readline() then cfg:seek("set", 0) end
+  if not www:read(64) then www:seek("set", 0) end
+end
+log:close()
+cfg:close()
+www:close()
+local ms = clock() - t0
+local r1, rb1 = fsreads()
+local w1, wb1 = fswrites()
+print(fmt("log+cfg+www\t%.1f\t%d\t%d\t%d\t%d", ms, r1 - r0, rb1 - rb0, w1 - w0, wb1 - wb0))
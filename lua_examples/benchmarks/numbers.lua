@@ -0,0 +1,106 @@
+-- Number microbenchmarks for the host build of the firmware Lua VM:
+--   lua.host numbers.lua [name]
+-- Integer loops, arithmetic, array indexing and bit operations, which a
+-- build with LUA_NUMBER_DUAL keeps on the integer ALU, and some float code
+-- for comparison. Each line reports, tab separated:
+--   name, iterations, VM instructions, bytes allocated, allocations,
+--   peak heap above the starting point, cpu ms
+-- The host has an FPU, so the gain on the ESP8266, where every double
+-- operation is a soft float library call, is larger than shown here.
+
+local run = bench.run
+local fmt = string.format
+local band, bxor, rshift, lshift = bit.band, bit.bxor, bit.rshift, bit.lshift
+
+local benchmarks = {}
+local function def(name, n, fn) benchmarks[#benchmarks + 1] = { name, n, fn } end
+
+def("loop.empty", 1000000, function(n)
+  for _ = 1, n do end
+end)
+
+def("loop.sum", 1000000, function(n)
+  for _ = 1, n / 50000 do
+    local s = 0
+    for i = 1, 50000 do s = s + i end  -- stays below 2^31
+  end
+end)
+
+def("loop.nested", 1000000, function(n)
+  local s = 0
+  for i = 1, n / 1000 do
+    for j = 1000, 1, -1 do s = s + j - i end
+  end
+end)
+
+def("arith.mul_mod", 500000, function(n)
+  local x = 1
+  for i = 1, n do x = (x * 31 + i) % 65521 end
+end)
+
+def("arith.compare", 500000, function(n)
+  local lo, hi = 0, 0
+  for i = 1, n do
+    if i % 7 < 3 then lo = lo + 1 elseif i <= n / 2 then hi = hi + 1 end
+  end
+end)
+
+def("array.index", 500000, function(n)
+  local t = {}
+  for i = 1, 256 do t[i] = i end
+  local s = 0
+  for i = 1, n do s = s + t[i % 256 + 1] end
+end)
+
+def("array.hash_int", 200000, function(n)
+  -- integer keys beyond the array part live in the hash part
+  local t = {}
+  for i = 1, 256 do t[i * 1000] = i end
+  local s = 0
+  for i = 1, n do s = s + t[(i % 256 + 1) * 1000] end
+end)
+
+def("bit.crc16", 20000, function(n)
+  local crc = 0xffff
+  for i = 1, n do
+    crc = bxor(crc, band(i, 0xff))
+    for _ = 1, 8 do
+      if band(crc, 1) ~= 0 then crc = bxor(rshift(crc, 1), 0xa001)
+      else crc = rshift(crc, 1) end
+    end
+  end
+end)
+
+def("bit.pack", 200000, function(n)
+  local s = 0
+  for i = 1, n do
+    local v = lshift(band(i, 0xff), 8) + band(rshift(i, 8), 0xff)
+    s = bxor(s, v)
+  end
+end)
+
+def("tostring.int", 50000, function(n)
+  for i = 1, n do local s = tostring(i) end
+end)
+
+def("float.mix", 500000, function(n)
+  -- mixes floats with the int loop counter, which costs a conversion
+  local x = 0.5
+  for i = 1, n do x = x * 1.000001 + i / 3 end
+end)
+
+def("float.loop", 500000, function(n)
+  local s = 0
+  for x = 0.5, n, 1.5 do s = s + x end
+end)
+
+-- run
+
+local only = ...
+for _, b in ipairs(benchmarks) do
+  local name, n, fn = b[1], b[2], b[3]
+  if not only or name:find(only, 1, true) then
+    local instr, bytes, allocs, peak, ms = run(fn, n)
+    print(fmt("%s\t%d\t%d\t%d\t%d\t%d\t%.2f", name, n, instr, bytes, allocs, peak, ms))
+  end
+end
@@ -0,0 +1,44 @@
+-- Reading a file a line or a few bytes at a time, on the firmware or the host
+-- build of the firmware Lua VM (lua.host):
+--   lua.host -d dir readline.lua [kbytes]
+-- Writes a CSV file of about kbytes (default 100) kB to readline.csv unless it
+-- is already that long, then reads it with file.readline() and file.read(n).
+-- Each line reports, tab separated:
+--   how, calls, lines or calls per second, and on the host the reads which
+--   reached the file system and the bytes they read
+
+local fmt = string.format
+local name = "readline.csv"
+local size = (tonumber((...)) or 100) * 1024
+
+local clock = bench and bench.clock or function() return tmr.now() / 1000 end
+local fsreads = bench and bench.fsreads or function() return 0, 0 end
+
+if not file.exists(name) or file.list()[name] < size then
+  local f = file.open(name, "w")
+  local n = 0
+  while n < size do
+    local line = fmt("%d,sensor%02d,%d.%02d,%d\n", n, n % 16, n % 40, n % 100, n * 7 % 1000)
+    f:write(line)
+    n = n + #line
+  end
+  f:close()
+end
+
+local function run(how, read)
+  local f = file.open(name, "r")
+  local calls, r0, b0 = 0, fsreads()
+  local t0 = clock()
+  while read(f) do
+    calls = calls + 1
+  end
+  local ms = clock() - t0
+  local r1, b1 = fsreads()
+  f:close()
+  print(fmt("%s\t%d\t%d\t%d\t%d", how, calls, calls * 1000 / (ms > 0 and ms or 1), r1 - r0, b1 - b0))
+end
+
+run("readline", function(f) return f:readline() end)
+run("read(16)", function(f) return f:read(16) end)
+run("read(',')", function(f) return f:read(",") end)
+run("read()", function(f) return f:read() end)
@@ -0,0 +1,28 @@
+-- What require() costs, for the host build of the firmware Lua VM (lua.host).
+-- Modules are found the way the firmware finds them, so the same module can
+-- be measured as a file and from the Lua flash store:
+--   lua.host -d dir require.lua mymodule
+--   lua.host -d dir -f lfs.img require.lua mymodule
+--   lua.host -d dir -f mymodule.lc require.lua mymodule
+-- Each line reports, tab separated:
+--   module, heap retained once loaded, bytes allocated while loading,
+--   allocations, cpu ms
+
+local fmt = string.format
+
+for _, name in ipairs({ ... }) do
+  local function load()
+    package.loaded[name] = nil
+    require(name)
+  end
+  local _, bytes, allocs, _, ms = bench.run(load)
+
+  package.loaded[name] = nil
+  collectgarbage()
+  collectgarbage()
+  local before = bench.heap()
+  local m = require(name)
+  collectgarbage()
+  collectgarbage()
+  print(fmt("%s\t%d\t%d\t%d\t%.2f", name, bench.heap() - before, bytes, allocs, ms))
+end
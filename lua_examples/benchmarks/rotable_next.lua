@@ -0,0 +1,40 @@
+-- Iterates every built-in (ROM) module table with pairs() and reports the
+-- time taken per module. Runs on the device (tmr.now), on lua.host
+-- (bench.clock) and on other host builds of the VM (os.clock).
+
+local names = {
+  "adc", "bit", "cjson", "coap", "crypto", "dht", "encoder", "enduser_setup",
+  "file", "gpio", "http", "i2c", "mdns", "mqtt", "net", "node", "ow", "perf",
+  "pwm", "rtcfifo", "rtcmem", "rtctime", "sntp", "spi", "struct", "tmr",
+  "u8g", "uart", "ucg", "websocket", "wifi", "ws2812",
+  "string", "table", "math", "debug", "coroutine", "os",
+}
+
+local now
+if tmr then
+  now = function() return tmr.now() end
+elseif bench then
+  now = function() return bench.clock() * 1000 end
+else
+  now = function() return os.clock() * 1000000 end
+end
+
+local ROUNDS = 20
+local total_us, total_keys = 0, 0
+
+for _, name in ipairs(names) do
+  local t = _G[name]
+  if type(t) == "romtable" then
+    local keys = 0
+    local start = now()
+    for _ = 1, ROUNDS do
+      for k in pairs(t) do keys = keys + 1 end
+    end
+    local us = now() - start
+    keys = keys / ROUNDS
+    total_us, total_keys = total_us + us, total_keys + keys
+    print(string.format("%-14s %4d keys %8d us/iteration", name, keys, us / ROUNDS))
+  end
+end
+
+print(string.format("%-14s %4d keys %8d us/iteration", "total", total_keys, total_us / ROUNDS))
@@ -0,0 +1,40 @@
+-- Heap churn of a long-running node, on the firmware or the host build of
+-- the firmware Lua VM (lua.host):
+--   lua.host slab.lua [rounds]
+-- Each round (default 200) builds short lived strings, tables and closures
+-- next to a cache which keeps some of them, as a request handler would. At
+-- the end it prints the occupancy of each slab size class, tab separated:
+--   size, pages, used, free
+-- and on the host the number of heap blocks, counting each slab page as one.
+-- Without LUA_SLAB_ALLOC every small object is a block of its own.
+
+local fmt = string.format
+local rounds = tonumber((...)) or 200
+
+local cache, keep = {}, 0
+local function round(r)
+  local t = {}
+  for i = 1, 50 do
+    local k = fmt("k%d.%d", r, i)
+    t[k] = { i, k, function() return i end }
+  end
+  for k, v in pairs(t) do
+    if #k % 7 == 0 then keep = keep % 500 + 1; cache[keep] = v end
+  end
+end
+
+for r = 1, rounds do round(r) end
+collectgarbage()
+
+local slab = node.egc.slabinfo and node.egc.slabinfo()
+local pages, used = 0, 0
+if slab then
+  for _, c in ipairs(slab) do
+    print(fmt("%d\t%d\t%d\t%d", c.size, c.pages, c.used, c.free))
+    pages, used = pages + c.pages, used + c.used
+  end
+end
+if bench then
+  local inuse, _, _, _, blocks = bench.heap()
+  print(fmt("heap\t%d bytes\t%d blocks", inuse, blocks - used + pages))
+end
@@ -0,0 +1,185 @@
+-- VM microbenchmarks for the host build of the firmware Lua VM
+-- (make -C app/lua/host bench). Each line reports, tab separated:
+--   name, iterations, VM instructions, bytes allocated, allocations,
+--   peak heap above the starting point, cpu ms
+-- Instruction and allocation counts are deterministic, so they can be
+-- compared across commits; cpu time is for orientation only.
+
+local run = bench.run
+local fmt = string.format
+
+local benchmarks = {}
+local function def(name, n, fn) benchmarks[#benchmarks + 1] = { name, n, fn } end
+
+-- tables
+
+def("table.array_fill", 20000, function(n)
+  local t = {}
+  for i = 1, n do t[i] = i end
+end)
+
+def("table.hash_fill", 5000, function(n)
+  local t = {}
+  for i = 1, n do t["k" .. i] = i end
+end)
+
+def("table.presized", 20000, function(n)
+  for _ = 1, n / 10 do
+    local t = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, a = 1, b = 2 }
+  end
+end)
+
+def("table.read", 100000, function(n)
+  local t, s = { 1, 2, 3, 4, 5, 6, 7, 8, x = 1, y = 2 }, 0
+  for i = 1, n do s = s + t[(i % 8) + 1] + t.x end
+end)
+
+def("table.insert_remove", 5000, function(n)
+  local t = {}
+  for i = 1, n do table.insert(t, i) end
+  for _ = 1, n do table.remove(t) end
+end)
+
+def("table.sort", 2000, function(n)
+  local t = {}
+  for i = 1, n do t[i] = (i * 7919) % n end
+  table.sort(t)
+end)
+
+def("table.ipairs", 20000, function(n)
+  local t = {}
+  for i = 1, 100 do t[i] = i end
+  local s = 0
+  for _ = 1, n / 100 do
+    for _, v in ipairs(t) do s = s + v end
+  end
+end)
+
+-- strings
+
+def("string.concat", 2000, function(n)
+  local s = ""
+  for i = 1, n do s = s .. "x" end
+end)
+
+def("string.table_concat", 5000, function(n)
+  local t = {}
+  for i = 1, n do t[i] = tostring(i) end
+  local s = table.concat(t, ",")
+end)
+
+def("string.format", 5000, function(n)
+  for i = 1, n do local s = fmt("%d:%s:%5.2f", i, "abc", i / 3) end
+end)
+
+def("string.find_gsub", 2000, function(n)
+  local line = "GET /index.html?user=alice&id=42 HTTP/1.1"
+  for _ = 1, n do
+    local _, _, method, path = line:find("^(%u+) (%S+)")
+    local q = line:gsub("%%(%x%x)", "")
+  end
+end)
+
+def("string.intern", 5000, function(n)
+  -- short strings are interned: repeated creation mostly hits the string table
+  for i = 1, n do local s = "key" .. (i % 64) end
+end)
+
+def("string.payload", 2000, function(n)
+  -- strings the size of a TCP segment, as net and file callbacks make them
+  local seg = string.rep("x", 1454)
+  for i = 1, n do local s = seg .. (100000 + i) end
+end)
+
+def("string.byte_char", 10000, function(n)
+  local s = "The quick brown fox jumps over the lazy dog"
+  for i = 1, n do
+    local b = s:byte((i % #s) + 1)
+    local c = string.char(b)
+  end
+end)
+
+-- functions and closures
+
+def("call.lua", 100000, function(n)
+  local function f(a, b) return a + b end
+  local s = 0
+  for i = 1, n do s = f(s, i) end
+end)
+
+def("call.c_light", 100000, function(n)
+  -- math.floor is a light function in a rotable
+  local floor, s = math.floor, 0
+  for i = 1, n do s = s + floor(i / 2) end
+end)
+
+def("call.rotable_lookup", 50000, function(n)
+  -- looks the function up in the ROM table every time
+  local s = 0
+  for i = 1, n do s = s + math.abs(-i) end
+end)
+
+def("closure.create", 20000, function(n)
+  for i = 1, n do local f = function() return i end end
+end)
+
+def("closure.upvalue", 100000, function(n)
+  local count = 0
+  local function inc() count = count + 1 end
+  for _ = 1, n do inc() end
+end)
+
+def("coroutine.resume", 10000, function(n)
+  local co = coroutine.wrap(function()
+    while true do coroutine.yield() end
+  end)
+  for _ = 1, n do co() end
+end)
+
+def("method.call", 50000, function(n)
+  local obj = { v = 0 }
+  function obj:inc(d) self.v = self.v + d end
+  for i = 1, n do obj:inc(i) end
+end)
+
+def("metatable.index", 50000, function(n)
+  local base = { get = function(self) return self.v end }
+  local o = setmetatable({ v = 1 }, { __index = base })
+  local s = 0
+  for _ = 1, n do s = s + o:get() end
+end)
+
+-- garbage collector pressure
+
+def("gc.small_tables", 20000, function(n)
+  for i = 1, n do local t = { i, i } end
+end)
+
+def("gc.strings", 10000, function(n)
+  for i = 1, n do local s = "str" .. i end
+end)
+
+def("gc.retained", 5000, function(n)
+  -- keeps a sliding window of live objects so collections have work to do
+  local window = {}
+  for i = 1, n do
+    window[(i % 256) + 1] = { i, tostring(i) }
+  end
+end)
+
+def("gc.full_collect", 50, function(n)
+  local keep = {}
+  for i = 1, 2000 do keep[i] = { i } end
+  for _ = 1, n do collectgarbage("collect") end
+end)
+
+-- run
+
+local only = ...
+for _, b in ipairs(benchmarks) do
+  local name, n, fn = b[1], b[2], b[3]
+  if not only or name:find(only, 1, true) then
+    local instr, bytes, allocs, peak, ms = run(fn, n)
+    print(fmt("%s\t%d\t%d\t%d\t%d\t%d\t%.2f", name, n, instr, bytes, allocs, peak, ms))
+  end
+end
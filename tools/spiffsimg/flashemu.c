@@ -0,0 +1,98 @@
+/*
+ * NOR flash emulation for running SPIFFS on the host, see flashemu.h.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "flashemu.h"
+
+// Typical figures for the SPI NOR chips on ESP8266 modules (W25Q32 and
+// similar) with the flash clocked at 40MHz
+#define READ_SETUP_US     2.0     // command and address
+#define READ_BYTE_US      0.05
+#define PROGRAM_SETUP_US  30.0    // per program command, which stays within a page
+#define PROGRAM_BYTE_US   2.5
+#define ERASE_SECTOR_US   45000.0
+
+static uint8_t *flash;
+static uint32_t flash_size;
+static uint32_t *erase_counts;
+static flashemu_stats stats;
+
+void flashemu_init (uint8_t *mem, uint32_t size)
+{
+  flash = mem;
+  flash_size = size;
+  free (erase_counts);
+  erase_counts = calloc (flashemu_sectors (), sizeof (*erase_counts));
+  flashemu_reset_stats ();
+}
+
+static int in_range (uint32_t addr, uint32_t size)
+{
+  return addr <= flash_size && size <= flash_size - addr;
+}
+
+int flashemu_read (uint32_t addr, uint32_t size, uint8_t *dst)
+{
+  if (!in_range (addr, size))
+    return -1;
+  memcpy (dst, flash + addr, size);
+  stats.reads++;
+  stats.read_bytes += size;
+  stats.time_us += READ_SETUP_US + size * READ_BYTE_US;
+  return 0;
+}
+
+int flashemu_write (uint32_t addr, uint32_t size, const uint8_t *src)
+{
+  uint32_t i;
+  if (!in_range (addr, size))
+    return -1;
+  // programming only clears bits; SPIFFS relies on this when it marks
+  // pages by writing a flags byte with just the bits to clear set to 0
+  for (i = 0; i < size; i++)
+    flash[addr + i] &= src[i];
+  stats.writes++;
+  stats.write_bytes += size;
+  // one program command per flash page touched
+  if (size)
+    stats.time_us += ((addr + size - 1) / FLASHEMU_PAGE_SIZE - addr / FLASHEMU_PAGE_SIZE + 1) *
+      PROGRAM_SETUP_US + size * PROGRAM_BYTE_US;
+  return 0;
+}
+
+int flashemu_erase (uint32_t addr, uint32_t size)
+{
+  uint32_t sector;
+  if (!in_range (addr, size) || addr % FLASHEMU_SECTOR_SIZE || size % FLASHEMU_SECTOR_SIZE)
+    return -1;
+  memset (flash + addr, 0xff, size);
+  for (sector = addr / FLASHEMU_SECTOR_SIZE; sector < (addr + size) / FLASHEMU_SECTOR_SIZE; sector++)
+  {
+    erase_counts[sector]++;
+    stats.erases++;
+    stats.time_us += ERASE_SECTOR_US;
+  }
+  return 0;
+}
+
+const flashemu_stats *flashemu_get_stats (void)
+{
+  return &stats;
+}
+
+void flashemu_reset_stats (void)
+{
+  memset (&stats, 0, sizeof (stats));
+}
+
+uint32_t flashemu_sectors (void)
+{
+  return flash_size / FLASHEMU_SECTOR_SIZE;
+}
+
+uint32_t flashemu_erase_count (uint32_t sector)
+{
+  return sector < flashemu_sectors () ? erase_counts[sector] : 0;
+}
@@ -0,0 +1,42 @@
+/*
+ * NOR flash emulation for running SPIFFS on the host.
+ *
+ * Emulates the SPI flash behind the firmware's my_spiffs_read/write/erase
+ * on a memory buffer: writes can only clear bits and erases set a whole
+ * sector to 0xff. Every access is counted, erases per sector are tracked
+ * for wear, and the time the access would take on a typical SPI NOR chip
+ * is accumulated, so that file system settings can be compared without
+ * hardware.
+ */
+
+#ifndef FLASHEMU_H
+#define FLASHEMU_H
+
+#include <stdint.h>
+
+#define FLASHEMU_SECTOR_SIZE  4096
+#define FLASHEMU_PAGE_SIZE    256
+
+typedef struct {
+  uint32_t reads, writes, erases;
+  uint64_t read_bytes, write_bytes;
+  // modelled time of all accesses
+  double time_us;
+} flashemu_stats;
+
+// Emulates flash on mem, which is size bytes long
+void flashemu_init (uint8_t *mem, uint32_t size);
+
+// Accesses return 0, or -1 if out of range
+int flashemu_read (uint32_t addr, uint32_t size, uint8_t *dst);
+int flashemu_write (uint32_t addr, uint32_t size, const uint8_t *src);
+int flashemu_erase (uint32_t addr, uint32_t size);
+
+const flashemu_stats *flashemu_get_stats (void);
+void flashemu_reset_stats (void);
+
+uint32_t flashemu_sectors (void);
+// Erases of sector since flashemu_init
+uint32_t flashemu_erase_count (uint32_t sector);
+
+#endif
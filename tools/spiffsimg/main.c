@@ -41,7 +41,11 @@
 #include <getopt.h>
 #include <sys/mman.h>
 #include <errno.h>
+#include <time.h>
 #include "spiffs.h"
+#include "spiffs_nucleus.h"
+#include "flashemu.h"
+#include "workload.h"
 #define NO_CPU_ESP8266_INCLUDE
 #include "../platform/cpu_esp8266.h"
 
@@ -63,21 +67,18 @@ static const char *delete_list[10];
 static int delete_list_index = 0;
 
 static u8_t spiffs_work_buf[LOG_PAGE_SIZE*2];
-static u8_t spiffs_fds[32*4];
+static u8_t spiffs_fds[sizeof(spiffs_fd)*4];
 
 static s32_t flash_read (u32_t addr, u32_t size, u8_t *dst) {
-  memcpy (dst, flash + addr, size);
-  return SPIFFS_OK;
+  return flashemu_read (addr, size, dst) < 0 ? SPIFFS_ERR_INTERNAL : SPIFFS_OK;
 }
 
 static s32_t flash_write (u32_t addr, u32_t size, u8_t *src) {
-  memcpy (flash + addr, src, size);
-  return SPIFFS_OK;
+  return flashemu_write (addr, size, src) < 0 ? SPIFFS_ERR_INTERNAL : SPIFFS_OK;
 }
 
 static s32_t flash_erase (u32_t addr, u32_t size) {
-  memset (flash + addr, 0xff, size);
-  return SPIFFS_OK;
+  return flashemu_erase (addr, size) < 0 ? SPIFFS_ERR_INTERNAL : SPIFFS_OK;
 }
 
 
@@ -170,6 +171,289 @@ static void export (char *src, char *dst)
 }
 
 
+static void rename_file (char *line)
+{
+  char *src = 0, *dst = 0;
+  if (sscanf (line, " %ms %ms", &src, &dst) != 2)
+  {
+    fprintf (stderr, "SYNTAX ERROR: mv %s\n", line);
+    retcode = 1;
+  }
+  else if (SPIFFS_rename (&fs, src, dst) < 0)
+  {
+    fprintf (stderr, "FAILED: mv %s\n", line);
+    retcode = 1;
+  }
+  free (src);
+  free (dst);
+}
+
+
+static void make_files (int count, int size)
+{
+  char name[32], buff[256];
+  int i, n;
+  for (i = 0; i < count; i++)
+  {
+    snprintf (name, sizeof (name), "file%04d.txt", i);
+    spiffs_file fh = SPIFFS_open (&fs, name, SPIFFS_CREAT | SPIFFS_TRUNC | SPIFFS_WRONLY, 0);
+    if (fh < 0)
+      die ("spiffs_open");
+    memset (buff, 'a' + i % 26, sizeof (buff));
+    for (n = size; n > 0; n -= sizeof (buff))
+      if (SPIFFS_write (&fs, fh, buff, n < (int)sizeof (buff) ? n : (int)sizeof (buff)) < 0)
+        die ("spiffs_write");
+    if (SPIFFS_close (&fs, fh) < 0)
+      die ("spiffs_close");
+  }
+}
+
+
+static void set_name_index (int entries)
+{
+  static void *index;
+  free (index);
+  index = entries ? malloc (entries * sizeof (spiffs_name_index_entry)) : 0;
+  SPIFFS_set_name_index (&fs, index, entries * sizeof (spiffs_name_index_entry));
+}
+
+
+static double now_us (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+
+// Looks up files in random order by stat and open, and names that do not
+// exist, <rounds> times as many as there are files, and prints flash reads
+// and time per lookup
+static void bench (int rounds)
+{
+  enum { STAT, OPEN, MISS };
+  static const char *what[] = { "stat", "open", "missing" };
+  struct { u32_t ops, reads; uint64_t read_bytes; double us; } res[3];
+  char (*names)[SPIFFS_OBJ_NAME_LEN] = 0;
+  int count = 0, r, i, j, k;
+
+  spiffs_DIR dir;
+  struct spiffs_dirent de;
+  if (!SPIFFS_opendir (&fs, "/", &dir))
+    die ("spiffs_opendir");
+  while (SPIFFS_readdir (&dir, &de))
+  {
+    names = realloc (names, (count + 1) * sizeof (*names));
+    memcpy (names[count++], de.name, sizeof (*names));
+  }
+  SPIFFS_closedir (&dir);
+
+  memset (res, 0, sizeof (res));
+  srand (1);
+  for (r = 0; r < rounds; r++)
+    for (i = 0; i < count; i++)
+      for (k = STAT, j = rand () % count; k <= MISS; k++)
+      {
+        spiffs_stat st;
+        char missing[32];
+        const flashemu_stats *io = flashemu_get_stats ();
+        u32_t reads = io->reads;
+        uint64_t read_bytes = io->read_bytes;
+        double t = now_us ();
+        if (k == STAT)
+        {
+          if (SPIFFS_stat (&fs, names[j], &st) < 0)
+            die ("spiffs_stat");
+        }
+        else if (k == OPEN)
+        {
+          spiffs_file fh = SPIFFS_open (&fs, names[j], SPIFFS_RDONLY, 0);
+          if (fh < 0)
+            die ("spiffs_open");
+          SPIFFS_close (&fs, fh);
+        }
+        else
+        {
+          snprintf (missing, sizeof (missing), "missing%d", i);
+          if (SPIFFS_stat (&fs, missing, &st) >= 0)
+            die ("spiffs_stat");
+        }
+        res[k].us += now_us () - t;
+        res[k].ops++;
+        res[k].reads += io->reads - reads;
+        res[k].read_bytes += io->read_bytes - read_bytes;
+      }
+
+  printf ("%d files\n%-8s %8s %10s %12s %8s\n", count, "lookup", "ops", "reads/op", "bytes/op", "us/op");
+  for (k = STAT; k <= MISS; k++)
+    if (res[k].ops)
+      printf ("%-8s %8u %10.1f %12.1f %8.2f\n", what[k], res[k].ops,
+        (double)res[k].reads / res[k].ops, (double)res[k].read_bytes / res[k].ops,
+        res[k].us / res[k].ops);
+  free (names);
+}
+
+
+// Reads a file from start to end, then <count> times 64 bytes from random
+// offsets, and prints flash reads and time for both
+static void readbench (const char *fname, int count, int chunk)
+{
+  spiffs_stat st;
+  char buff[4096];
+  const flashemu_stats *io = flashemu_get_stats ();
+  u32_t reads;
+  uint64_t read_bytes;
+  double t, flash_t;
+  int i;
+
+  spiffs_file fh = SPIFFS_open (&fs, fname, SPIFFS_RDONLY, 0);
+  if (fh < 0 || SPIFFS_fstat (&fs, fh, &st) < 0)
+    die ("spiffs_open");
+
+  if (chunk <= 0 || chunk > (int)sizeof (buff))
+    chunk = 256;
+  reads = io->reads;
+  read_bytes = io->read_bytes;
+  t = now_us ();
+  flash_t = io->time_us;
+  while (SPIFFS_read (&fs, fh, buff, chunk) > 0)
+    ;
+  printf ("%s, %u bytes\n%-10s %8s %10s %12s %8s\n", fname, st.size, "read", "ops", "reads/op", "bytes/op", "us/op");
+  printf ("%-10s %8u %10.1f %12.1f %8.2f   flash %.1f ms in %d byte reads\n", "sequential", (st.size + chunk - 1) / chunk,
+    (double)(io->reads - reads) * chunk / st.size, (double)(io->read_bytes - read_bytes) * chunk / st.size,
+    (now_us () - t) * chunk / st.size, (io->time_us - flash_t) / 1000, chunk);
+
+  srand (1);
+  reads = io->reads;
+  read_bytes = io->read_bytes;
+  t = now_us ();
+  for (i = 0; i < count; i++)
+  {
+    if (SPIFFS_lseek (&fs, fh, rand () % (st.size - 64), SPIFFS_SEEK_SET) < 0 ||
+        SPIFFS_read (&fs, fh, buff, 64) != 64)
+      die ("spiffs_read");
+  }
+  if (count)
+    printf ("%-10s %8u %10.1f %12.1f %8.2f\n", "random", count,
+      (double)(io->reads - reads) / count, (double)(io->read_bytes - read_bytes) / count,
+      (now_us () - t) / count);
+  SPIFFS_close (&fs, fh);
+}
+
+
+// Writes size bytes to a new file in chunks of chunk bytes, as a script
+// writing lines to a file does, and prints what reaches the flash
+static void writebench (const char *fname, int size, int chunk)
+{
+  char buff[1024];
+  const flashemu_stats *io = flashemu_get_stats ();
+  u32_t writes = io->writes;
+  uint64_t write_bytes = io->write_bytes;
+  double t = io->time_us;
+  int i;
+
+  if (chunk <= 0 || chunk > (int)sizeof (buff))
+    chunk = sizeof (buff);
+  for (i = 0; i < chunk; i++)
+    buff[i] = 'a' + i % 26;
+
+  spiffs_file fh = SPIFFS_open (&fs, fname, SPIFFS_CREAT | SPIFFS_TRUNC | SPIFFS_WRONLY, 0);
+  if (fh < 0)
+    die ("spiffs_open");
+  for (i = 0; i < size; i += chunk)
+  {
+    int len = size - i < chunk ? size - i : chunk;
+    if (SPIFFS_write (&fs, fh, buff, len) != len)
+      die ("spiffs_write");
+  }
+  if (SPIFFS_close (&fs, fh) < 0)
+    die ("spiffs_close");
+  printf ("%s, %d bytes in %d byte writes: flash writes %u (%llu bytes), flash time %.1f ms\n",
+    fname, size, chunk, io->writes - writes, (unsigned long long)(io->write_bytes - write_bytes),
+    (io->time_us - t) / 1000);
+}
+
+
+// Prints flash accesses, modelled flash time, garbage collections and cache
+// hits since the last reset, and the spread of erases over the sectors
+static void print_stats (void)
+{
+  const flashemu_stats *st = flashemu_get_stats ();
+  u32_t sector, count, min = ~0, max = 0, total = 0;
+
+  printf ("reads %u (%llu bytes), writes %u (%llu bytes), erases %u",
+    st->reads, (unsigned long long)st->read_bytes,
+    st->writes, (unsigned long long)st->write_bytes, st->erases);
+  printf ("\nflash time %.1f ms, gc runs %u, cache hits %u, misses %u, evictions %u\n",
+    st->time_us / 1000, fs.stats_gc_runs, fs.cache_hits, fs.cache_misses, fs.cache_evictions);
+
+  for (sector = 0; sector < flashemu_sectors (); sector++)
+  {
+    count = flashemu_erase_count (sector);
+    total += count;
+    min = count < min ? count : min;
+    max = count > max ? count : max;
+  }
+  printf ("sector erases min %u, avg %.1f, max %u\n",
+    min, (double)total / flashemu_sectors (), max);
+}
+
+
+static void reset_stats (void)
+{
+  flashemu_reset_stats ();
+  fs.stats_gc_runs = 0;
+  fs.cache_hits = fs.cache_misses = fs.cache_evictions = 0;
+}
+
+
+// Prints the erase count of every sector, 16 to a line
+static void print_wear (void)
+{
+  u32_t sector;
+  for (sector = 0; sector < flashemu_sectors (); sector++)
+    printf ("%s%5u", sector % 16 ? " " : sector ? "\n" : "", flashemu_erase_count (sector));
+  printf ("\n");
+}
+
+
+// Blocks to keep free and most blocks to collect between workload operations
+static u32_t idle_gc_blocks, idle_gc_steps = 4;
+
+static void run_workload (char *line)
+{
+  char *name = 0;
+  int ops = 0;
+  unsigned seed = 1;
+  workload_result res;
+  double t;
+
+  if (sscanf (line, " %ms %d %u", &name, &ops, &seed) < 2)
+  {
+    fprintf (stderr, "SYNTAX ERROR: workload %s\n", line);
+    retcode = 1;
+    free (name);
+    return;
+  }
+  reset_stats ();
+  t = now_us ();
+  if (workload_run (&fs, name, ops, seed, idle_gc_blocks, idle_gc_steps, &res) < 0)
+  {
+    fprintf (stderr, "FAILED: unknown workload %s\n", name);
+    retcode = 1;
+  }
+  else
+  {
+    t = now_us () - t;
+    printf ("%s: %d ops, %d failed, %.1f ms host time\n", name, ops, res.failed, t / 1000);
+    printf ("slowest op %.1f ms, idle gc %u blocks in %.1f ms\n",
+      res.max_op_us / 1000, res.idle_steps, res.idle_us / 1000);
+    print_stats ();
+  }
+  free (name);
+}
+
+
 char *trim (char *in)
 {
   if (!in)
@@ -194,7 +478,7 @@ char *trim (char *in)
 void syntax (void)
 {
   fprintf (stderr,
-    "Syntax: spiffsimg -f <filename> [-d] [-o <locationfilename>] [-c size] [-S flashsize] [-U usedsize] [-l | -i | -r <scriptname> ]\n\n"
+    "Syntax: spiffsimg -f <filename> [-d] [-o <locationfilename>] [-c size] [-S flashsize] [-U usedsize] [-C cachesize] [-l | -i | -r <scriptname> ]\n\n"
   );
   exit (1);
 }
@@ -240,7 +524,8 @@ int main (int argc, char *argv[])
   const char *resolved = 0;
   int flashsize = 0;
   int used = 0;
-  while ((opt = getopt (argc, argv, "do:f:c:lir:S:U:")) != -1)
+  int cache_size = 65536;
+  while ((opt = getopt (argc, argv, "do:f:c:lir:S:U:C:")) != -1)
   {
     switch (opt)
     {
@@ -249,6 +534,7 @@ int main (int argc, char *argv[])
       case 'c': create = true; sz = strtol(optarg, 0, 0); break;
       case 'S': create = true; flashsize = getsize(optarg); break;
       case 'U': create = true; used = strtol(optarg, 0, 0); break;
+      case 'C': cache_size = strtol(optarg, 0, 0); break;
       case 'd': delete_on_die = 1; break;
       case 'l': command = CMD_LIST; break;
       case 'i': command = CMD_INTERACTIVE; break;
@@ -332,6 +618,7 @@ int main (int argc, char *argv[])
 
   if (create)
     memset (flash, 0xff, sz);
+  flashemu_init (flash, sz);
 
   spiffs_config cfg;
   cfg.phys_size = sz;
@@ -350,7 +637,7 @@ int main (int argc, char *argv[])
       spiffs_work_buf,
       spiffs_fds,
       sizeof(spiffs_fds),
-      malloc(65536), 65536, 0) != 0) {
+      malloc(cache_size), cache_size, 0) != 0) {
     if (create) {
       if (SPIFFS_format(&fs) != 0) {
         die("spiffs_format");
@@ -359,7 +646,7 @@ int main (int argc, char *argv[])
           spiffs_work_buf,
           spiffs_fds,
           sizeof(spiffs_fds),
-          malloc(65536), 65536, 0) != 0) {
+          malloc(cache_size), cache_size, 0) != 0) {
         die ("spiffs_mount");
       }
       if (command == CMD_INTERACTIVE) {
@@ -425,6 +712,65 @@ int main (int argc, char *argv[])
       }
       else if (strncmp (line, "cat ", 4) == 0)
         cat (trim (line + 4));
+      else if (strncmp (line, "mv ", 3) == 0)
+        rename_file (line + 3);
+      else if (strncmp (line, "mkfiles ", 8) == 0)
+      {
+        int count = 0, size = 0;
+        if (sscanf (line + 8, "%d %d", &count, &size) < 1)
+        {
+          fprintf (stderr, "SYNTAX ERROR: %s\n", line);
+          retcode = 1;
+        }
+        else
+          make_files (count, size);
+      }
+      else if (strncmp (line, "nameindex ", 10) == 0)
+        set_name_index (atoi (line + 10));
+      else if (strncmp (line, "readbench ", 10) == 0)
+      {
+        char *fname = 0;
+        int count = 1000, chunk = 256;
+        if (sscanf (line + 10, " %ms %d %d", &fname, &count, &chunk) < 1)
+        {
+          fprintf (stderr, "SYNTAX ERROR: %s\n", line);
+          retcode = 1;
+        }
+        else
+          readbench (fname, count, chunk);
+        free (fname);
+      }
+      else if (strncmp (line, "writebench ", 11) == 0)
+      {
+        char *fname = 0;
+        int size, chunk = 32;
+        if (sscanf (line + 11, " %ms %d %d", &fname, &size, &chunk) < 2)
+        {
+          fprintf (stderr, "SYNTAX ERROR: %s\n", line);
+          retcode = 1;
+        }
+        else
+          writebench (fname, size, chunk);
+        free (fname);
+      }
+      else if (strncmp (line, "workload ", 9) == 0)
+        run_workload (line + 9);
+      else if (strncmp (line, "idlegc ", 7) == 0)
+      {
+        if (sscanf (line + 7, "%u %u", &idle_gc_blocks, &idle_gc_steps) < 1)
+        {
+          fprintf (stderr, "SYNTAX ERROR: %s\n", line);
+          retcode = 1;
+        }
+      }
+      else if (strcmp (line, "stats reset") == 0)
+        reset_stats ();
+      else if (strcmp (line, "stats") == 0)
+        print_stats ();
+      else if (strcmp (line, "wear") == 0)
+        print_wear ();
+      else if (strncmp (line, "bench", 5) == 0)
+        bench (line[5] ? atoi (line + 5) : 1);
       else if (strncmp (line, "info", 4) == 0)
       {
         u32_t total, used;
@@ -0,0 +1,137 @@
+/*
+ * Synthetic file system workloads for tuning SPIFFS on the host, see
+ * workload.h.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "workload.h"
+#include "flashemu.h"
+
+#define LOG_ROTATE_SIZE   8192
+#define SMALL_FILES       100
+
+// Private generator, so that a workload does not depend on the C library
+static unsigned rnd_state;
+
+static unsigned rnd (unsigned n)
+{
+  rnd_state = rnd_state * 1103515245 + 12345;
+  return (rnd_state >> 8) % n;
+}
+
+static void fill (char *buff, int len)
+{
+  int i;
+  for (i = 0; i < len; i++)
+    buff[i] = 'a' + rnd (26);
+}
+
+static int write_file (spiffs *fs, const char *name, spiffs_flags flags, const char *buff, int len)
+{
+  spiffs_file fh = SPIFFS_open (fs, name, flags, 0);
+  int ok;
+  if (fh < 0)
+    return -1;
+  ok = SPIFFS_write (fs, fh, (void *)buff, len) == len;
+  if (SPIFFS_close (fs, fh) < 0)
+    ok = 0;
+  return ok ? 0 : -1;
+}
+
+static int log_op (spiffs *fs)
+{
+  char line[100];
+  int len = 40 + rnd (61);
+  spiffs_stat st;
+
+  fill (line, len - 1);
+  line[len - 1] = '\n';
+  if (write_file (fs, "log.txt", SPIFFS_CREAT | SPIFFS_APPEND | SPIFFS_WRONLY, line, len) < 0)
+    return -1;
+  if (SPIFFS_stat (fs, "log.txt", &st) < 0)
+    return -1;
+  if (st.size >= LOG_ROTATE_SIZE)
+  {
+    SPIFFS_remove (fs, "log.old");
+    if (SPIFFS_rename (fs, "log.txt", "log.old") < 0)
+      return -1;
+  }
+  return 0;
+}
+
+static int config_op (spiffs *fs)
+{
+  char buff[600];
+  int len = 200 + rnd (401);
+  fill (buff, len);
+  return write_file (fs, "config.json", SPIFFS_CREAT | SPIFFS_TRUNC | SPIFFS_WRONLY, buff, len);
+}
+
+static int small_op (spiffs *fs)
+{
+  char name[16], buff[1024];
+  int len;
+
+  snprintf (name, sizeof (name), "s%03u.dat", rnd (SMALL_FILES));
+  if (rnd (4) == 0)
+  {
+    spiffs_stat st;
+    // removing a file which is not there is not a failure
+    return SPIFFS_stat (fs, name, &st) < 0 || SPIFFS_remove (fs, name) >= 0 ? 0 : -1;
+  }
+  len = 32 + rnd (993);
+  fill (buff, len);
+  return write_file (fs, name, SPIFFS_CREAT | SPIFFS_TRUNC | SPIFFS_WRONLY, buff, len);
+}
+
+static int mixed_op (spiffs *fs)
+{
+  unsigned r = rnd (10);
+  return r < 6 ? log_op (fs) : r < 7 ? config_op (fs) : small_op (fs);
+}
+
+int workload_run (spiffs *fs, const char *name, int ops, unsigned seed,
+  u32_t idle_gc_blocks, u32_t idle_gc_steps, workload_result *res)
+{
+  static const struct {
+    const char *name;
+    int (*op) (spiffs *fs);
+  } workloads[] = {
+    { "log", log_op },
+    { "config", config_op },
+    { "small", small_op },
+    { "mixed", mixed_op },
+  };
+  const flashemu_stats *io = flashemu_get_stats ();
+  unsigned i, step;
+  int n;
+  double t;
+
+  for (i = 0; i < sizeof (workloads) / sizeof (workloads[0]); i++)
+    if (strcmp (name, workloads[i].name) == 0)
+      break;
+  if (i == sizeof (workloads) / sizeof (workloads[0]))
+    return -1;
+
+  memset (res, 0, sizeof (*res));
+  rnd_state = seed;
+  for (n = 0; n < ops; n++)
+  {
+    t = io->time_us;
+    if (workloads[i].op (fs) < 0)
+      res->failed++;
+    if (io->time_us - t > res->max_op_us)
+      res->max_op_us = io->time_us - t;
+
+    t = io->time_us;
+    for (step = 0; idle_gc_blocks && step < idle_gc_steps; step++)
+    {
+      if (SPIFFS_gc_step (fs, idle_gc_blocks) <= 0)
+        break;
+      res->idle_steps++;
+    }
+    res->idle_us += io->time_us - t;
+  }
+  return 0;
+}
@@ -0,0 +1,31 @@
+/*
+ * Synthetic file system workloads for tuning SPIFFS on the host.
+ */
+
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+#include "spiffs.h"
+
+typedef struct {
+  int failed;
+  // modelled flash time of the slowest operation
+  double max_op_us;
+  // blocks collected and their flash time between operations
+  u32_t idle_steps;
+  double idle_us;
+} workload_result;
+
+// Runs ops operations of the named workload on fs, which is one of
+//   log     appends lines to log.txt, rotating it to log.old at 8kB
+//   config  rewrites config.json
+//   small   rewrites or removes files from a pool of 100 small files
+//   mixed   all of the above, weighted 6:1:3
+// The operations only depend on seed. If idle_gc_blocks is not 0, up to
+// idle_gc_steps calls of SPIFFS_gc_step between operations keep that many
+// blocks free, as the firmware's background garbage collection does.
+// Returns 0, or -1 if the workload is unknown.
+int workload_run (spiffs *fs, const char *name, int ops, unsigned seed,
+  u32_t idle_gc_blocks, u32_t idle_gc_steps, workload_result *res);
+
+#endif